@@ -0,0 +1,181 @@
+/** @file bench.c
+ *
+ * @brief Decode benchmark: runs the playback core back to back on a virtual tick clock.
+ *
+ * @par
+ * zsm_update() is called in a tight loop, each call standing for one tick of the song's clock, until the song
+ * ends; the song is played through again until at least BENCH_MIN_BIOS_TICKS of wall time have passed. The wall
+ * time is taken from the BIOS timer tick count, starting on a tick edge. No timer interrupt is hooked.
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <conio.h>
+#include <i86.h>
+#include "i8253.h"
+#include "bios.h"
+#include "ram.h"
+#include "zsm.h"
+#include "ym2151.h"
+#include "saa1099.h"
+#include "bench.h"
+
+#if defined(_M_I86)
+    #pragma code_seg("bench_TRANSIENT_TEXT", "TRANSIENT") // not kept by the resident player (see tsr.c)
+#endif
+
+#define BENCH_PERCENT (100U)
+
+static uint8_t g_ym2151_image[ZSM_YM2151_REGISTER_COUNT];
+static uint8_t g_vera_psg_image[ZSM_VERA_PSG_REGISTER_COUNT];
+
+static void
+bench_write_null(uint8_t const address, uint8_t const data)
+{
+    (void)address;
+    (void)data;
+} /* bench_write_null() */
+
+static void
+bench_ym2151_write_shadow(uint8_t const address, uint8_t const data)
+{
+    g_ym2151_image[address] = data;
+} /* bench_ym2151_write_shadow() */
+
+static void
+bench_vera_psg_write_shadow(uint8_t const address, uint8_t const data)
+{
+    g_vera_psg_image[address & (ZSM_VERA_PSG_REGISTER_COUNT - 1U)] = data;
+} /* bench_vera_psg_write_shadow() */
+
+/*!
+ * @brief Sets the playback core up for one pass of the song on the selected backend.
+ *
+ * @param[in] p_ram_handle The loaded ZSM file.
+ * @param[in] backend      Where the register writes go.
+ *
+ * @return ZSM_SUCCESS, or the reason the song can not be played.
+ */
+static e_zsm_result_t
+bench_setup_pass(ram_handle_t const p_ram_handle, e_bench_backend_t const backend)
+{
+    e_zsm_result_t result = ZSM_SUCCESS;
+
+    switch (backend)
+    {
+        case BENCH_BACKEND_SHADOW:
+            result = zsm_initialize(p_ram_handle, &bench_ym2151_write_shadow, &bench_vera_psg_write_shadow);
+            zsm_set_write_burst_funcs(NULL, NULL);
+            zsm_set_vera_psg_volume_func(NULL);
+            break;
+
+        case BENCH_BACKEND_PORTS:
+            result = zsm_initialize(p_ram_handle, &ym2151_write, &saa1099_vera_psg_write);
+            zsm_set_write_burst_funcs(&ym2151_write_burst, &saa1099_vera_psg_write_burst);
+            zsm_set_vera_psg_volume_func(&saa1099_vera_psg_set_volume);
+            break;
+
+        default:
+            result = zsm_initialize(p_ram_handle, &bench_write_null, &bench_write_null);
+            zsm_set_write_burst_funcs(NULL, NULL);
+            zsm_set_vera_psg_volume_func(NULL);
+            break;
+    }
+
+    if (result == ZSM_SUCCESS)
+    {
+        zsm_start(0);
+    }
+
+    return result;
+} /* bench_setup_pass() */
+
+/*!
+ * @brief Waits for the next BIOS timer tick.
+ *
+ * @return The BIOS tick count just after it changed.
+ */
+static uint32_t
+bench_wait_bios_tick(void)
+{
+    uint32_t const start = BIOS_TICK_COUNT;
+    uint32_t       now   = start;
+
+    while (now == start)
+    {
+        now = BIOS_TICK_COUNT;
+    }
+
+    return now;
+} /* bench_wait_bios_tick() */
+
+/*!
+ * @brief Plays the song through as fast as possible and measures the decode rate.
+ *
+ * @note Plays the song once (no repeats) per pass. With BENCH_BACKEND_PORTS the YM2151 and SAA1099 drivers must
+ *       have been initialized; the other backends never touch the hardware (unless built with PCZSM_SAAYM_DIRECT,
+ *       where the writes always go to the SAAYM and only BENCH_BACKEND_PORTS may be used).
+ *
+ * @param[in]  p_ram_handle The loaded ZSM file.
+ * @param[in]  backend      Where the register writes go.
+ * @param[out] p_result     Benchmark figures (valid on ZSM_SUCCESS).
+ *
+ * @return ZSM_SUCCESS, or the reason the song can not be played.
+ */
+e_zsm_result_t
+bench_run(ram_handle_t const p_ram_handle, e_bench_backend_t const backend, bench_result_t * const p_result)
+{
+    e_zsm_result_t result = bench_setup_pass(p_ram_handle, backend);
+
+    if (result != ZSM_SUCCESS)
+    {
+        return result;
+    }
+
+    uint32_t passes = 0;
+    uint32_t ticks  = 0;
+    uint32_t bytes  = 0;
+
+    uint32_t const start   = bench_wait_bios_tick();
+    uint32_t       elapsed = 0;
+
+    do
+    {
+        if (passes && ((result = bench_setup_pass(p_ram_handle, backend)) != ZSM_SUCCESS))
+        {
+            return result;
+        }
+
+        uint32_t const start_offset = zsm_get_stream_offset();
+
+        while (zsm_is_playing())
+        {
+            zsm_update();
+            ++ticks;
+        }
+
+        bytes += zsm_get_stream_offset() - start_offset;
+        ++passes;
+
+        uint32_t const now = BIOS_TICK_COUNT;
+
+        elapsed = bios_ticks_elapsed(start, now);
+    } while (elapsed < BENCH_MIN_BIOS_TICKS);
+
+    uint16_t const tick_rate   = zsm_get_header().tick_rate;
+    uint64_t const wall_clocks = (uint64_t)elapsed << BIOS_TICK_PIT_SHIFT;
+
+    p_result->passes           = passes;
+    p_result->ticks            = ticks;
+    p_result->bytes            = bytes;
+    p_result->centiseconds     = (uint32_t)((wall_clocks * BENCH_PERCENT) / I8253_CLOCK_SPEED_IN_HZ);
+    p_result->ticks_per_second = (uint32_t)(((uint64_t)ticks * I8253_CLOCK_SPEED_IN_HZ) / wall_clocks);
+    p_result->bytes_per_second = (uint32_t)(((uint64_t)bytes * I8253_CLOCK_SPEED_IN_HZ) / wall_clocks);
+    p_result->speedup_percent  = tick_rate ? (uint32_t)(((uint64_t)ticks * I8253_CLOCK_SPEED_IN_HZ * BENCH_PERCENT) / (wall_clocks * tick_rate)) : 0;
+
+    return ZSM_SUCCESS;
+} /* bench_run() */
+
+/*** end of file ***/
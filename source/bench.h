@@ -0,0 +1,43 @@
+/** @file bench.h
+ *
+ * @brief Decode benchmark: runs the playback core back to back on a virtual tick clock.
+ *
+ */
+
+#pragma once
+
+#define BENCH_MIN_BIOS_TICKS (91U) // whole passes of the song are run for at least ~5 seconds
+
+typedef enum
+{
+    BENCH_BACKEND_NULL,   // register writes are dropped (decode and dispatch only)
+    BENCH_BACKEND_SHADOW, // register writes are stored in memory images of the chips
+    BENCH_BACKEND_PORTS   // register writes go to the SAAYM (drivers initialized by the caller)
+} e_bench_backend_t;
+
+typedef struct
+{
+    uint32_t passes;           // times the song was played through
+    uint32_t ticks;            // ticks run over all passes
+    uint32_t bytes;            // ZSM stream bytes decoded over all passes
+    uint32_t centiseconds;     // wall time taken (BIOS timer resolution, ~55 ms)
+    uint32_t ticks_per_second;
+    uint32_t bytes_per_second;
+    uint32_t speedup_percent;  // song time played per wall time, in percent
+} bench_result_t;
+
+//--------------------------------------------------------------------
+#ifdef __cplusplus
+extern "C" {
+#endif
+//--------------------------------------------------------------------
+
+e_zsm_result_t bench_run(ram_handle_t const p_ram_handle, e_bench_backend_t const backend, bench_result_t * const p_result);
+
+//--------------------------------------------------------------------
+#ifdef __cplusplus
+}
+#endif
+//--------------------------------------------------------------------
+
+/*** end of file ***/
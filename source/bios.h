@@ -0,0 +1,37 @@
+/** @file bios.h
+ *
+ * @brief BIOS data area timer tick count
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <i86.h>
+
+#define BIOS_TICK_PIT_SHIFT  (16U)                          // PIT clocks per BIOS tick as a shift (count 0)
+#define BIOS_TICK_PIT_CLOCKS (1UL << BIOS_TICK_PIT_SHIFT)   // PIT clocks per BIOS tick
+#define BIOS_TICKS_PER_DAY   (0x1800B0UL)                   // the BIOS tick count wraps at midnight
+
+// BIOS data area timer tick count (0040:006C)
+#if defined(__386__)
+    #define BIOS_TICK_COUNT (*(uint32_t volatile *)0x046CUL) // flat model: low memory at its linear address
+#else
+    #define BIOS_TICK_COUNT (*(uint32_t volatile __far *)MK_FP(0x0040U, 0x006CU))
+#endif
+
+/*!
+ * @brief Returns the BIOS ticks from start to now, allowing for the count wrapping at midnight.
+ *
+ * @param[in] start An earlier BIOS tick count.
+ * @param[in] now   A later BIOS tick count.
+ *
+ * @return The elapsed BIOS ticks.
+ */
+static inline uint32_t
+bios_ticks_elapsed(uint32_t const start, uint32_t const now)
+{
+    return (now >= start) ? (now - start) : (now + BIOS_TICKS_PER_DAY - start);
+} /* bios_ticks_elapsed() */
+
+/*** end of file ***/
@@ -34,3 +34,27 @@
 
 #define I8253_BCD_0 0x0   // Binary Counter 16-bits
 #define I8253_BCD_1 0x1   // Binary Coded Decimal (BCD) Counter (4 Decades)
+
+#include <stdint.h>
+#include <conio.h>
+
+/*!
+ * @brief Latches and reads PIT channel 0's current count.
+ *
+ * @note Inline so the interrupt handlers can use it; the caller keeps interrupts disabled around it when another
+ *       latch or reprogramming of channel 0 could come in between the two byte reads.
+ *
+ * @return The current count.
+ */
+static inline uint16_t
+i8253_read_counter(void)
+{
+    outp(I8253_CONTROL_WORD_PORT, I8253_COUNTER_0 | I8253_ACCESS_MODE_LATCH_COUNT);
+
+    uint8_t const counter_low  = inp(I8253_COUNTER_0_DATA_PORT);
+    uint8_t const counter_high = inp(I8253_COUNTER_0_DATA_PORT);
+
+    return ((uint16_t)counter_high << 8U) | counter_low;
+} /* i8253_read_counter() */
+
+/*** end of file ***/
@@ -13,3 +13,8 @@
 #define PIC2_DATA    (PIC2_COMMAND + 1)
 
 #define PIC_EOI 0x20
+
+#define PIC_OCW2_SET_PRIORITY 0xC0 // specific rotate: OR in the IRQ to make lowest priority
+#define PIC_LOWEST_DEFAULT    0x07 // power-on priority: IRQ 0 highest, IRQ 7 lowest
+#define PIC_MASK_IRQ          0x07
+#define PIC_OCW3_READ_IRR     0x0A // the next read of the command port returns the interrupt request register
@@ -14,8 +14,22 @@
 #include "timer.h"
 #include "i8259a.h"
 
+#pragma off (check_stack) // irq_run_on_stack() and the handlers it serves run on private stacks
+
 #define IRQ_START_MASK (0x53U) // Mask for IRQs 7, 5, 3, and 2 (used by SAAYM)
 
+#if defined(__386__)
+    #define IRQ_DPMI_INTERRUPT         (0x31U)
+    #define IRQ_DPMI_GET_SEGMENT_BASE  (0x0006U)
+    #define IRQ_DPMI_GET_PM_VECTOR     (0x0204U)
+    #define IRQ_DPMI_SET_PM_VECTOR     (0x0205U)
+    #define IRQ_DPMI_LOCK_LINEAR       (0x0600U)
+    #define IRQ_MULTIPLEX_INTERRUPT    (0x2FU)
+    #define IRQ_RELEASE_TIME_SLICE     (0x1680U)
+    #define IRQ_SHIFT_HIGH_WORD        (16U)
+    #define IRQ_MASK_LOW_WORD          (0xFFFFUL)
+#endif
+
 typedef enum
 {
     IRQ_2,
@@ -48,7 +62,24 @@ static irq_detect_handler_state_t g_detect_handler_states[IRQ_COUNT] =
     { &irq_7_detect_handler, 0x0FU, NULL, false, false }  // IRQ7
 };
 
-static uint8_t g_pic_old_mask = 0;
+static uint8_t      g_pic_old_mask         = 0;
+static char const * g_p_lock_failed_module = NULL; // first module whose interrupt time memory could not be locked
+
+static void irq_lock_begin(void);
+static void irq_lock_end(void);
+
+static irq_lock_region_t const g_lock_regions[] =
+{
+    IRQ_LOCK_REGION(g_detect_handler_states)
+};
+
+/*!
+ * @brief Start of the code reached at interrupt time (see irq_lock_code()).
+ */
+static void
+irq_lock_begin(void)
+{
+} /* irq_lock_begin() */
 
 static void IRQ_FAR_INTERRUPT
 irq_2_detect_handler(void)
@@ -87,9 +118,19 @@ irq_7_detect_handler(void)
     outp(PIC1_COMMAND, PIC_EOI);
 } /* irq_7_detect_handler() */
 
+/*!
+ * @brief End of the code reached at interrupt time.
+ */
+static void
+irq_lock_end(void)
+{
+} /* irq_lock_end() */
+
 void
 irq_install_detect_handlers(void)
 {
+    irq_lock_module("IRQ detection", &irq_lock_begin, &irq_lock_end, g_lock_regions, IRQ_LOCK_REGION_COUNT(g_lock_regions));
+
     g_pic_old_mask = inp(PIC1_DATA);
 
     _disable(); // Disable IRQs
@@ -98,8 +139,8 @@ irq_install_detect_handlers(void)
     {
         irq_detect_handler_state_t * const p_detect_handler_state = &g_detect_handler_states[index];
 
-        p_detect_handler_state->p_old_handler = _dos_getvect(p_detect_handler_state->irq_number);
-        _dos_setvect(p_detect_handler_state->irq_number, p_detect_handler_state->p_new_handler);
+        p_detect_handler_state->p_old_handler = irq_get_vector(p_detect_handler_state->irq_number);
+        irq_set_vector(p_detect_handler_state->irq_number, p_detect_handler_state->p_new_handler);
     }
 
     _enable(); // Enable IRQs
@@ -128,7 +169,7 @@ irq_uninstall_detect_handlers(void)
 
         if (p_detect_handler_state->p_old_handler != NULL)
         {
-            _dos_setvect(p_detect_handler_state->irq_number, p_detect_handler_state->p_old_handler);
+            irq_set_vector(p_detect_handler_state->irq_number, p_detect_handler_state->p_old_handler);
         }
     }   
 
@@ -170,4 +211,311 @@ irq_clear_mask(uint8_t const irq_number)
     outp(PIC1_DATA, mask);
 } /* irq_clear_mask() */
 
+/*!
+ * @brief Rotates the master PIC priorities so the IRQ ranks highest.
+ *
+ * @note Uses the specific rotate (set priority) command: the IRQ below it becomes the lowest. IRQ 2 ranks the
+ *       slave PIC's IRQs highest.
+ *
+ * @param[in] irq_number Master PIC IRQ (0-7).
+ */
+void
+irq_set_highest_priority(uint8_t const irq_number)
+{
+    outp(PIC1_COMMAND, PIC_OCW2_SET_PRIORITY | ((irq_number - 1U) & PIC_MASK_IRQ));
+} /* irq_set_highest_priority() */
+
+/*!
+ * @brief Restores the power-on master PIC priorities (IRQ 0 highest, IRQ 7 lowest).
+ *
+ * @note The PIC cannot be read back; the BIOS leaves the power-on priorities in place.
+ */
+void
+irq_restore_priority(void)
+{
+    outp(PIC1_COMMAND, PIC_OCW2_SET_PRIORITY | PIC_LOWEST_DEFAULT);
+} /* irq_restore_priority() */
+
+#if defined(__WATCOMC__) && !defined(__386__)
+void irq_enable_and_halt(void);
+#pragma aux irq_enable_and_halt = \
+    "sti" \
+    "hlt"
+#endif
+
+/*!
+ * @brief Enables interrupts and idles the CPU while the foreground has no work.
+ *
+ * @note Call with interrupts disabled after checking that there is no work left: STI only takes effect after the
+ *       next instruction, so an interrupt that arrives after the check still ends the HLT. Returns with interrupts
+ *       enabled. HLT is privileged in protected mode (the DPMI host would trap it), so the 32-bit build releases
+ *       the time slice with INT 2Fh function 1680h instead; without a multitasker that returns at once and the
+ *       caller polls again.
+ */
+void
+irq_wait_for_interrupt(void)
+{
+#if defined(__386__)
+    union REGS regs;
+
+    _enable();
+
+    regs.x.eax = IRQ_RELEASE_TIME_SLICE;
+    int386(IRQ_MULTIPLEX_INTERRUPT, &regs, &regs);
+#elif defined(__WATCOMC__)
+    irq_enable_and_halt();
+#else
+    _enable();
+#endif
+} /* irq_wait_for_interrupt() */
+
+#if defined(__WATCOMC__) && defined(_M_I86)
+void irq_switch_stack_and_call(void (* p_function)(void), uint16_t stack_segment, uint16_t stack_top);
+#pragma aux irq_switch_stack_and_call = \
+    "mov    si, ss"             \
+    "mov    di, sp"             \
+    "mov    ss, bx"             \
+    "mov    sp, cx"             \
+    "push   si"                 \
+    "push   di"                 \
+    "push   bp"                 \
+    "push   dx"                 \
+    "push   ax"                 \
+    "mov    bp, sp"             \
+    "call   dword ptr [bp]"     \
+    "add    sp, 4"              \
+    "pop    bp"                 \
+    "pop    di"                 \
+    "pop    si"                 \
+    "mov    ss, si"             \
+    "mov    sp, di"             \
+    parm [dx ax] [bx] [cx]      \
+    modify [ax bx cx dx si di es];
+#endif
+
+/*!
+ * @brief Runs a function on a private stack.
+ *
+ * @note Interrupt handlers and the resident API start on whatever stack the interrupted program uses, which may be
+ *       too small and is never in DGROUP. Call with interrupts disabled; p_function may enable them. A call made
+ *       while the stack is already in use (an interrupt arriving while p_function runs with interrupts enabled)
+ *       continues on it. Keep the stack in DGROUP so SS equals DS while p_function runs. Only the 16-bit build
+ *       switches; DPMI hosts already run protected mode handlers on a locked stack of their own.
+ *
+ * @param[in,out] p_stack    The stack.
+ * @param[in]     p_function Function to run.
+ */
+void
+irq_run_on_stack(irq_stack_t * const p_stack, void (* const p_function)(void))
+{
+#if defined(__WATCOMC__) && defined(_M_I86)
+    if (p_stack->depth++ == 0)
+    {
+        irq_switch_stack_and_call(p_function, FP_SEG(p_stack->p_memory), FP_OFF(p_stack->p_memory) + p_stack->size);
+    }
+    else
+    {
+        p_function();
+    }
+
+    --p_stack->depth;
+#else
+    (void)p_stack;
+
+    p_function();
+#endif
+} /* irq_run_on_stack() */
+
+/*!
+ * @brief Gets an interrupt vector.
+ *
+ * @note The 32-bit (PMODE/W) build reads the protected mode vector through DPMI.
+ *
+ * @param[in] interrupt_number Interrupt number.
+ *
+ * @return The interrupt handler.
+ */
+interrupt_handler_t
+irq_get_vector(uint8_t const interrupt_number)
+{
+#if defined(__386__)
+    union REGS regs;
+
+    regs.x.eax = IRQ_DPMI_GET_PM_VECTOR;
+    regs.x.ebx = interrupt_number;
+    int386(IRQ_DPMI_INTERRUPT, &regs, &regs);
+
+    return (interrupt_handler_t)MK_FP(regs.w.cx, regs.x.edx);
+#else
+    return _dos_getvect(interrupt_number);
+#endif
+} /* irq_get_vector() */
+
+/*!
+ * @brief Sets an interrupt vector.
+ *
+ * @note The 32-bit (PMODE/W) build installs a protected mode handler through DPMI, so IRQs are serviced without a
+ *       trip through the real mode vector.
+ *
+ * @param[in] interrupt_number Interrupt number.
+ * @param[in] p_handler        The interrupt handler.
+ */
+void
+irq_set_vector(uint8_t const interrupt_number, interrupt_handler_t const p_handler)
+{
+#if defined(__386__)
+    union REGS regs;
+
+    regs.x.eax = IRQ_DPMI_SET_PM_VECTOR;
+    regs.x.ebx = interrupt_number;
+    regs.x.ecx = FP_SEG(p_handler);
+    regs.x.edx = FP_OFF(p_handler);
+    int386(IRQ_DPMI_INTERRUPT, &regs, &regs);
+#else
+    _dos_setvect(interrupt_number, p_handler);
+#endif
+} /* irq_set_vector() */
+
+/*!
+ * @brief Locks memory used at interrupt time so a paging DPMI host never swaps it out.
+ *
+ * @note Only the 32-bit (PMODE/W) build locks; real mode memory is never paged. The lock lasts until the program exits.
+ *
+ * @param[in] p_memory Start of the memory.
+ * @param[in] size     Size in bytes.
+ *
+ * @return true if the memory is locked (or needs no locking), otherwise false.
+ */
+bool
+irq_lock_memory(void const * const p_memory, uint32_t const size)
+{
+#if defined(__386__)
+    union REGS regs;
+
+    regs.x.eax = IRQ_DPMI_GET_SEGMENT_BASE;
+    regs.x.ebx = FP_SEG((void const __far *)p_memory);
+    int386(IRQ_DPMI_INTERRUPT, &regs, &regs);
+
+    if (regs.x.cflag)
+    {
+        return false;
+    }
+
+    uint32_t const linear = (((uint32_t)regs.w.cx << IRQ_SHIFT_HIGH_WORD) | regs.w.dx) + (uint32_t)p_memory;
+
+    regs.x.eax = IRQ_DPMI_LOCK_LINEAR;
+    regs.x.ebx = linear >> IRQ_SHIFT_HIGH_WORD;
+    regs.x.ecx = linear & IRQ_MASK_LOW_WORD;
+    regs.x.esi = size >> IRQ_SHIFT_HIGH_WORD;
+    regs.x.edi = size & IRQ_MASK_LOW_WORD;
+    int386(IRQ_DPMI_INTERRUPT, &regs, &regs);
+
+    return (regs.x.cflag == 0);
+#else
+    (void)p_memory;
+    (void)size;
+
+    return true;
+#endif
+} /* irq_lock_memory() */
+
+/*!
+ * @brief Locks a list of memory regions used at interrupt time.
+ *
+ * @param[in] p_regions Regions to lock.
+ * @param[in] count     Number of regions.
+ *
+ * @return true if every region is locked, otherwise false.
+ */
+bool
+irq_lock_regions(irq_lock_region_t const * const p_regions, uint8_t const count)
+{
+    bool b_locked = true;
+
+    for (uint8_t index = 0; index < count; ++index)
+    {
+        b_locked = irq_lock_memory(p_regions[index].p_memory, p_regions[index].size) && b_locked;
+    }
+
+    return b_locked;
+} /* irq_lock_regions() */
+
+/*!
+ * @brief Locks the code between two marker functions.
+ *
+ * @note The markers are empty functions placed around the interrupt time code of a module; the compiler emits
+ *       a module's functions in source order. In the flat model code and data share the same linear base.
+ *
+ * @param[in] p_begin Marker function before the code.
+ * @param[in] p_end   Marker function after the code.
+ *
+ * @return true if the code is locked, otherwise false.
+ */
+bool
+irq_lock_code(void (* const p_begin)(void), void (* const p_end)(void))
+{
+#if defined(__386__)
+    uint8_t const * const p_code_begin = (uint8_t const *)p_begin;
+    uint8_t const * const p_code_end   = (uint8_t const *)p_end;
+
+    if (p_code_end <= p_code_begin)
+    {
+        return false;
+    }
+
+    return irq_lock_memory(p_code_begin, (uint32_t)(p_code_end - p_code_begin));
+#else
+    (void)p_begin;
+    (void)p_end;
+
+    return true;
+#endif
+} /* irq_lock_code() */
+
+/*!
+ * @brief Locks the interrupt time code and data of a module, remembering the first module that fails.
+ *
+ * @note A failed lock is not fatal; the module still works unless the DPMI host pages its memory out at interrupt
+ *       time. Report irq_get_lock_failure() to the user once everything is locked.
+ *
+ * @param[in] p_name    Module name for the report.
+ * @param[in] p_begin   Marker function before the code, or NULL for data only.
+ * @param[in] p_end     Marker function after the code, or NULL for data only.
+ * @param[in] p_regions Data regions to lock.
+ * @param[in] count     Number of data regions.
+ *
+ * @return true if the code and every region are locked, otherwise false.
+ */
+bool
+irq_lock_module(char const * const p_name, void (* const p_begin)(void), void (* const p_end)(void),
+                irq_lock_region_t const * const p_regions, uint8_t const count)
+{
+    bool b_locked = true;
+
+    if ((p_begin != NULL) && (p_end != NULL))
+    {
+        b_locked = irq_lock_code(p_begin, p_end);
+    }
+
+    b_locked = irq_lock_regions(p_regions, count) && b_locked;
+
+    if ((b_locked == false) && (g_p_lock_failed_module == NULL))
+    {
+        g_p_lock_failed_module = p_name;
+    }
+
+    return b_locked;
+} /* irq_lock_module() */
+
+/*!
+ * @brief Gets the first module whose interrupt time memory could not be locked.
+ *
+ * @return Module name, or NULL if every lock succeeded.
+ */
+char const *
+irq_get_lock_failure(void)
+{
+    return g_p_lock_failed_module;
+} /* irq_get_lock_failure() */
+
 /*** end of file ***/
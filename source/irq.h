@@ -17,6 +17,22 @@ typedef void (IRQ_FAR_INTERRUPT * interrupt_handler_t)(void);
 #define INT08H_IRQ0 (0x08U)
 #define INT10H_IRQ2 (0x0AU)
 
+typedef struct
+{
+    void const * p_memory;
+    uint32_t     size;
+} irq_lock_region_t;
+
+typedef struct
+{
+    uint8_t * p_memory;
+    uint16_t  size;
+    uint8_t   depth;    // calls running on the stack; nested calls stay on it
+} irq_stack_t;
+
+#define IRQ_LOCK_REGION(variable) { (void const *)&(variable), sizeof(variable) }
+#define IRQ_LOCK_REGION_COUNT(regions) ((uint8_t)(sizeof(regions) / sizeof((regions)[0])))
+
 //--------------------------------------------------------------------
 #ifdef __cplusplus
 extern "C" {
@@ -28,6 +44,17 @@ uint8_t irq_sense(void);
 void irq_uninstall_detect_handlers(void);
 void irq_set_mask(uint8_t const irq_number);
 void irq_clear_mask(uint8_t const irq_number);
+void irq_set_highest_priority(uint8_t const irq_number);
+void irq_restore_priority(void);
+void irq_wait_for_interrupt(void);
+interrupt_handler_t irq_get_vector(uint8_t const interrupt_number);
+void irq_set_vector(uint8_t const interrupt_number, interrupt_handler_t const p_handler);
+bool irq_lock_memory(void const * const p_memory, uint32_t const size);
+bool irq_lock_regions(irq_lock_region_t const * const p_regions, uint8_t const count);
+bool irq_lock_code(void (* const p_begin)(void), void (* const p_end)(void));
+bool irq_lock_module(char const * const p_name, void (* const p_begin)(void), void (* const p_end)(void), irq_lock_region_t const * const p_regions, uint8_t const count);
+char const * irq_get_lock_failure(void);
+void irq_run_on_stack(irq_stack_t * const p_stack, void (* const p_function)(void));
 
 //--------------------------------------------------------------------
 #ifdef __cplusplus
@@ -8,18 +8,285 @@
 #include <stdbool.h>
 #include <i86.h>
 #include <string.h>
+#include <conio.h>
+#include "irq.h"
+#include "keyboard.h"
 
+#if defined(_M_I86)
+    #pragma code_seg("keyboard_TRANSIENT_TEXT", "TRANSIENT") // not kept by the resident player (see tsr.c)
+#endif
+
+#pragma off (check_stack) // the INT 09h handler runs on whatever stack it interrupted
+
+#define INT09H 0x09
 #define INT16H 0x16
 
+#define KEYBOARD_PORT_DATA         (0x60U)
+#define KEYBOARD_QUEUE_SIZE        (16U) // power of two
+#define KEYBOARD_QUEUE_MASK        (KEYBOARD_QUEUE_SIZE - 1U)
+#define KEYBOARD_BREAK_BIT         (0x80U)
+#define KEYBOARD_PREFIX_EXTENDED   (0xE0U)
+#define KEYBOARD_SCANCODE_CTRL     (0x1DU)
+#define KEYBOARD_SCANCODE_LSHIFT   (0x2AU)
+#define KEYBOARD_SCANCODE_RSHIFT   (0x36U)
+#define KEYBOARD_SCANCODE_ALT      (0x38U)
+#define KEYBOARD_MODIFIER_LSHIFT   (0x01U)
+#define KEYBOARD_MODIFIER_RSHIFT   (0x02U)
+#define KEYBOARD_MODIFIER_CTRL     (0x04U)
+#define KEYBOARD_MODIFIER_ALT      (0x08U)
+#define KEYBOARD_MODIFIER_SHIFT    (KEYBOARD_MODIFIER_LSHIFT | KEYBOARD_MODIFIER_RSHIFT)
+
+// BIOS data area keyboard buffer head and tail (offsets into the buffer at 0040:001E)
+#if defined(__386__)
+    #define KEYBOARD_BIOS_BUFFER_HEAD ((uint16_t volatile *)0x041AUL) // flat model: low memory at its linear address
+    #define KEYBOARD_BIOS_BUFFER_TAIL ((uint16_t volatile *)0x041CUL)
+#else
+    #define KEYBOARD_BIOS_BUFFER_HEAD ((uint16_t volatile __far *)MK_FP(0x0040U, 0x001AU))
+    #define KEYBOARD_BIOS_BUFFER_TAIL ((uint16_t volatile __far *)MK_FP(0x0040U, 0x001CU))
+#endif
+
+static interrupt_handler_t g_p_old_keyboard_handler = NULL;
+
+static volatile uint8_t g_queue[KEYBOARD_QUEUE_SIZE];
+static volatile uint8_t g_queue_head = 0; // written by the interrupt only
+static volatile uint8_t g_queue_tail = 0; // written by the main loop only
+
+static uint8_t g_modifiers  = 0;     // Shift/Ctrl/Alt held, tracked by the main loop
+static bool    g_b_extended = false; // last raw scan code was the E0 prefix
+
+static void keyboard_lock_begin(void);
+static void keyboard_lock_end(void);
+
+static irq_lock_region_t const g_lock_regions[] =
+{
+    IRQ_LOCK_REGION(g_p_old_keyboard_handler),
+    IRQ_LOCK_REGION(g_queue),
+    IRQ_LOCK_REGION(g_queue_head),
+    IRQ_LOCK_REGION(g_queue_tail)
+};
+
 /*!
- * @brief Checks if the key represented by the scan code is pressed.
- * 
- * @param[in] scan_code  Scan code representing the key that would be pressed.
+ * @brief Start of the code reached at interrupt time (see irq_lock_code()).
+ */
+static void
+keyboard_lock_begin(void)
+{
+} /* keyboard_lock_begin() */
+
+/*!
+ * @brief INT 9 handler; queues the raw scan code and lets the BIOS handle the key.
+ *
+ * @note The BIOS handler acknowledges the keyboard, sends the EOI and keeps Ctrl+Break and Ctrl+Alt+Del working.
+ *       Its type-ahead buffer is emptied right away so INT 16h is never needed and the buffer never fills (beeps).
+ *       A full queue drops the scan code.
+ */
+static void IRQ_FAR_INTERRUPT
+keyboard_int_9_handler(void)
+{
+    uint8_t const scancode = inp(KEYBOARD_PORT_DATA);
+    uint8_t const next     = (g_queue_head + 1U) & KEYBOARD_QUEUE_MASK;
+
+    if (next != g_queue_tail)
+    {
+        g_queue[g_queue_head] = scancode;
+        g_queue_head          = next;
+    }
+
+    g_p_old_keyboard_handler();
+
+    *KEYBOARD_BIOS_BUFFER_HEAD = *KEYBOARD_BIOS_BUFFER_TAIL;
+} /* keyboard_int_9_handler() */
+
+/*!
+ * @brief End of the code reached at interrupt time.
+ */
+static void
+keyboard_lock_end(void)
+{
+} /* keyboard_lock_end() */
+
+/*!
+ * @brief Translates a raw scan code into the scan code INT 16h would return.
+ *
+ * @note Tracks Shift, Ctrl and Alt so F1-F10 and Alt+1-0 map to their BIOS extended codes.
+ *
+ * @param[in] raw Raw scan code (make or break) from the keyboard.
+ *
+ * @return Scan code of the key pressed, otherwise 0 (key release, modifier or prefix).
+ */
+static uint8_t
+keyboard_translate(uint8_t const raw)
+{
+    if (raw == KEYBOARD_PREFIX_EXTENDED)
+    {
+        g_b_extended = true;
+        return 0;
+    }
+
+    bool    const b_extended = g_b_extended;
+    bool    const b_release  = (raw & KEYBOARD_BREAK_BIT) != 0;
+    uint8_t const scancode   = raw & (uint8_t)~KEYBOARD_BREAK_BIT;
+    uint8_t       modifier   = 0;
+
+    g_b_extended = false;
+
+    switch (scancode)
+    {
+        case KEYBOARD_SCANCODE_CTRL:
+            modifier = KEYBOARD_MODIFIER_CTRL;
+            break;
+
+        case KEYBOARD_SCANCODE_ALT:
+            modifier = KEYBOARD_MODIFIER_ALT;
+            break;
+
+        case KEYBOARD_SCANCODE_LSHIFT:
+            modifier = KEYBOARD_MODIFIER_LSHIFT;
+            break;
+
+        case KEYBOARD_SCANCODE_RSHIFT:
+            modifier = KEYBOARD_MODIFIER_RSHIFT;
+            break;
+
+        default:
+            break;
+    }
+
+    if (modifier)
+    {
+        if (b_extended && (modifier & KEYBOARD_MODIFIER_SHIFT))
+        {
+            return 0; // E0 2A/E0 36 are fake shifts sent around the gray keys
+        }
+
+        g_modifiers = b_release ? (g_modifiers & (uint8_t)~modifier) : (g_modifiers | modifier);
+        return 0;
+    }
+
+    if (b_release)
+    {
+        return 0;
+    }
+
+    if ((scancode >= KEYBOARD_SCANCODE_F1) && (scancode <= KEYBOARD_SCANCODE_F10))
+    {
+        if (g_modifiers & KEYBOARD_MODIFIER_ALT)
+        {
+            return scancode - KEYBOARD_SCANCODE_F1 + KEYBOARD_SCANCODE_ALT_F1;
+        }
+
+        if (g_modifiers & KEYBOARD_MODIFIER_CTRL)
+        {
+            return scancode - KEYBOARD_SCANCODE_F1 + KEYBOARD_SCANCODE_CTRL_F1;
+        }
+
+        if (g_modifiers & KEYBOARD_MODIFIER_SHIFT)
+        {
+            return scancode - KEYBOARD_SCANCODE_F1 + KEYBOARD_SCANCODE_SHIFT_F1;
+        }
+    }
+    else if ((scancode >= KEYBOARD_SCANCODE_1) && (scancode <= KEYBOARD_SCANCODE_0) && (g_modifiers & KEYBOARD_MODIFIER_ALT))
+    {
+        return scancode - KEYBOARD_SCANCODE_1 + KEYBOARD_SCANCODE_ALT_1;
+    }
+
+    return scancode;
+} /* keyboard_translate() */
+
+/*!
+ * @brief Hooks INT 9 so key presses are queued at interrupt time.
+ *
+ * @note Replaces polling INT 16h; read keys with keyboard_get_scancode() and restore with keyboard_uninstall().
+ */
+void
+keyboard_install(void)
+{
+    if (g_p_old_keyboard_handler != NULL)
+    {
+        return;
+    }
+
+    irq_lock_module("keyboard", &keyboard_lock_begin, &keyboard_lock_end, g_lock_regions, IRQ_LOCK_REGION_COUNT(g_lock_regions));
+
+    _disable();
+
+    g_queue_head = 0;
+    g_queue_tail = 0;
+    g_modifiers  = 0;
+    g_b_extended = false;
+
+    *KEYBOARD_BIOS_BUFFER_HEAD = *KEYBOARD_BIOS_BUFFER_TAIL; // keys typed before playback are not hotkeys
+
+    g_p_old_keyboard_handler = irq_get_vector(INT09H);
+    irq_set_vector(INT09H, &keyboard_int_9_handler);
+
+    _enable();
+} /* keyboard_install() */
+
+/*!
+ * @brief Restores the INT 9 handler replaced by keyboard_install().
+ */
+void
+keyboard_uninstall(void)
+{
+    if (g_p_old_keyboard_handler == NULL)
+    {
+        return;
+    }
+
+    _disable();
+
+    irq_set_vector(INT09H, g_p_old_keyboard_handler);
+    g_p_old_keyboard_handler = NULL;
+
+    _enable();
+} /* keyboard_uninstall() */
+
+/*!
+ * @brief Checks if the INT 9 queue holds a scan code.
+ *
+ * @return true if a scan code is waiting, otherwise false.
+ */
+bool
+keyboard_has_scancode(void)
+{
+    return g_queue_head != g_queue_tail;
+} /* keyboard_has_scancode() */
+
+/*!
+ * @brief Gets the scan code of the next key pressed from the INT 9 queue (if any).
+ *
+ * @note Scan codes match keyboard_get_scancode_pcxt_bios(). Key releases and modifiers are consumed.
+ *
+ * @return scan code of the key pressed, otherwise 0.
+ */
+uint8_t
+keyboard_get_scancode(void)
+{
+    while (g_queue_head != g_queue_tail)
+    {
+        uint8_t const raw = g_queue[g_queue_tail];
+
+        g_queue_tail = (g_queue_tail + 1U) & KEYBOARD_QUEUE_MASK;
+
+        uint8_t const scancode = keyboard_translate(raw);
+
+        if (scancode)
+        {
+            return scancode;
+        }
+    }
+
+    return 0;
+} /* keyboard_get_scancode() */
+
+/*!
+ * @brief Gets the scan code of the next key pressed (if any).
  * 
- * @return true if the key is pressed, otherwise false.
+ * @return scan code of the key pressed, otherwise 0.
  */
-bool const
-keyboard_get_state_pcxt_bios(uint8_t const scan_code)
+uint8_t const
+keyboard_get_scancode_pcxt_bios(void)
 {
     union REGPACK regs;
 
@@ -35,10 +302,23 @@ keyboard_get_state_pcxt_bios(uint8_t const scan_code)
 
         intr(INT16H, &regs);
 
-        return scan_code == regs.h.ah;
+        return regs.h.ah;
     }
 
-    return false;
+    return 0;
+} /* keyboard_get_scancode_pcxt_bios() */
+
+/*!
+ * @brief Checks if the key represented by the scan code is pressed.
+ * 
+ * @param[in] scan_code  Scan code representing the key that would be pressed.
+ * 
+ * @return true if the key is pressed, otherwise false.
+ */
+bool const
+keyboard_get_state_pcxt_bios(uint8_t const scan_code)
+{
+    return scan_code == keyboard_get_scancode_pcxt_bios();
 } /* keyboard_get_state_pcxt_bios() */
 
 /*** end of file ***/
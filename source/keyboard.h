@@ -6,7 +6,25 @@
 
 #pragma once
 
-#define KEYBOARD_SCANCODE_ESC 0x01
+#define KEYBOARD_SCANCODE_ESC          0x01
+#define KEYBOARD_SCANCODE_1            0x02
+#define KEYBOARD_SCANCODE_8            0x09
+#define KEYBOARD_SCANCODE_0            0x0B
+#define KEYBOARD_SCANCODE_MINUS        0x0C
+#define KEYBOARD_SCANCODE_EQUALS       0x0D
+#define KEYBOARD_SCANCODE_P            0x19
+#define KEYBOARD_SCANCODE_KEYPAD_MINUS 0x4A
+#define KEYBOARD_SCANCODE_KEYPAD_PLUS  0x4E
+#define KEYBOARD_SCANCODE_F1           0x3B
+#define KEYBOARD_SCANCODE_F10          0x44
+#define KEYBOARD_SCANCODE_SHIFT_F1     0x54
+#define KEYBOARD_SCANCODE_SHIFT_F6     0x59
+#define KEYBOARD_SCANCODE_CTRL_F1      0x5E
+#define KEYBOARD_SCANCODE_CTRL_F6      0x63
+#define KEYBOARD_SCANCODE_ALT_F1       0x68
+#define KEYBOARD_SCANCODE_ALT_F10      0x71
+#define KEYBOARD_SCANCODE_ALT_1        0x78
+#define KEYBOARD_SCANCODE_ALT_8        0x7F
 
 //--------------------------------------------------------------------
 #ifdef __cplusplus
@@ -14,7 +32,12 @@ extern "C" {
 #endif
 //--------------------------------------------------------------------
 
-bool const keyboard_get_state_pcxt_bios(uint8_t const scan_code);
+uint8_t const keyboard_get_scancode_pcxt_bios(void);
+bool const    keyboard_get_state_pcxt_bios(uint8_t const scan_code);
+void          keyboard_install(void);
+void          keyboard_uninstall(void);
+bool          keyboard_has_scancode(void);
+uint8_t       keyboard_get_scancode(void);
 
 //--------------------------------------------------------------------
 #ifdef __cplusplus
@@ -9,7 +9,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <conio.h>
+#include <i86.h>
 #include "irq.h"
 #include "ram.h"
 #include "zsm.h"
@@ -18,6 +20,18 @@
 #include "saaym.h"
 #include "timer.h"
 #include "keyboard.h"
+#include "telemetry.h"
+#include "tsr.h"
+#include "bench.h"
+#include "status.h"
+
+#if defined(_M_I86)
+    #pragma code_seg("main_TRANSIENT_TEXT", "TRANSIENT") // not kept by the resident player (see tsr.c)
+#endif
+
+#if defined(PCZSM_PROFILE)
+    #include "profile.h"
+#endif
 
 #ifdef _DEBUG
     #define PCZSM_TARGET " development"
@@ -39,55 +53,770 @@
 #define PCZSM_BUILD_VERSION          (PCZSM_VERSION " (" PCZSM_PLATFORM PCZSM_TARGET ")")
 #define PCZSM_AUTHORS                ("OPLx")
 #define PCZSM_FILENAME               ("FILENAME.ZSM")
+#define PCZSM_VOLUME_STEP            (4U)
+#define PCZSM_PSG_SECOND_BANK        (10U)
+#define PCZSM_WRITE_BUDGET_SHARE     (2U)  // register writes may take 1/N of a tick before writes are deferred
+#define PCZSM_JITTER_WINDOW_MS       (500U)
+
+#if defined(PCZSM_SAAYM_DIRECT)
+    #define PCZSM_BENCH_BACKEND_DEFAULT BENCH_BACKEND_PORTS // the specialized core always writes to the SAAYM
+#else
+    #define PCZSM_BENCH_BACKEND_DEFAULT BENCH_BACKEND_NULL
+#endif
+
+typedef struct
+{
+    uint16_t            zsm_repeat;
+    e_zsm_write_order_t write_order;
+    uint8_t             volume;
+    e_timer_ym2151_t    ym2151_timer;
+    bool                b_shed_writes;
+    bool                b_irq_priority;
+    bool                b_resident;
+    uint8_t             tsr_interrupt;
+    bool                b_redetect;
+    bool                b_latency;
+    bool                b_benchmark;
+    e_bench_backend_t   bench_backend;
+    bool                b_status_screen;
+    char const *        p_cache_file_name;
+    char const *        p_profile_file_name; // tick cost profile appended here (profile builds)
+} pczsm_options_t;
+
+typedef struct
+{
+    bool    b_fm;
+    bool    b_solo;
+    uint8_t channel;
+} pczsm_channel_key_t;
+
+typedef struct
+{
+    uint32_t ticks;
+    uint32_t key_ons;
+    uint32_t late_ticks;  // ticks run late, decimated or after an overrun
+    uint16_t peak_writes;
+} pczsm_tick_stats_t;
+
+/*!
+ * @brief Decodes a channel mute/solo key.
+ *
+ * @note 1-8 toggle FM channels, F1-F10 and Shift+F1-F6 toggle PSG channels 1-16;
+ *       Alt+1-8, Alt+F1-F10 and Ctrl+F1-F6 solo the same channels.
+ *
+ * @param[in]  scancode      Scan code of the key pressed.
+ * @param[out] p_channel_key Decoded channel and action.
+ *
+ * @return true if the key selects a channel, otherwise false.
+ */
+static bool
+decode_channel_key(uint8_t const scancode, pczsm_channel_key_t * const p_channel_key)
+{
+    p_channel_key->b_fm   = false;
+    p_channel_key->b_solo = false;
+
+    if ((scancode >= KEYBOARD_SCANCODE_1) && (scancode <= KEYBOARD_SCANCODE_8))
+    {
+        p_channel_key->b_fm    = true;
+        p_channel_key->channel = scancode - KEYBOARD_SCANCODE_1;
+    }
+    else if ((scancode >= KEYBOARD_SCANCODE_ALT_1) && (scancode <= KEYBOARD_SCANCODE_ALT_8))
+    {
+        p_channel_key->b_fm    = true;
+        p_channel_key->b_solo  = true;
+        p_channel_key->channel = scancode - KEYBOARD_SCANCODE_ALT_1;
+    }
+    else if ((scancode >= KEYBOARD_SCANCODE_F1) && (scancode <= KEYBOARD_SCANCODE_F10))
+    {
+        p_channel_key->channel = scancode - KEYBOARD_SCANCODE_F1;
+    }
+    else if ((scancode >= KEYBOARD_SCANCODE_SHIFT_F1) && (scancode <= KEYBOARD_SCANCODE_SHIFT_F6))
+    {
+        p_channel_key->channel = scancode - KEYBOARD_SCANCODE_SHIFT_F1 + PCZSM_PSG_SECOND_BANK;
+    }
+    else if ((scancode >= KEYBOARD_SCANCODE_ALT_F1) && (scancode <= KEYBOARD_SCANCODE_ALT_F10))
+    {
+        p_channel_key->b_solo  = true;
+        p_channel_key->channel = scancode - KEYBOARD_SCANCODE_ALT_F1;
+    }
+    else if ((scancode >= KEYBOARD_SCANCODE_CTRL_F1) && (scancode <= KEYBOARD_SCANCODE_CTRL_F6))
+    {
+        p_channel_key->b_solo  = true;
+        p_channel_key->channel = scancode - KEYBOARD_SCANCODE_CTRL_F1 + PCZSM_PSG_SECOND_BANK;
+    }
+    else
+    {
+        return false;
+    }
+
+    return true;
+} /* decode_channel_key() */
+
+/*!
+ * @brief Mutes, unmutes or solos a channel.
+ *
+ * @note Soloing the channel that is already soloed unmutes every channel.
+ *
+ * @param[in] p_channel_key Channel and action.
+ */
+static void
+update_channel_mutes(pczsm_channel_key_t const * const p_channel_key)
+{
+    uint8_t  fm_mutes  = 0;
+    uint16_t psg_mutes = 0;
+
+    zsm_get_channel_mutes(&fm_mutes, &psg_mutes);
+
+    uint8_t  const fm_bit  = p_channel_key->b_fm ? (uint8_t)(1U << p_channel_key->channel) : 0;
+    uint16_t const psg_bit = p_channel_key->b_fm ? 0 : (uint16_t)(1U << p_channel_key->channel);
+
+    if (p_channel_key->b_solo)
+    {
+        uint8_t  const fm_solo_mutes  = (uint8_t)~fm_bit;
+        uint16_t const psg_solo_mutes = (uint16_t)~psg_bit;
+        bool     const b_soloed       = (fm_mutes == fm_solo_mutes) && (psg_mutes == psg_solo_mutes);
+
+        fm_mutes  = b_soloed ? 0 : fm_solo_mutes;
+        psg_mutes = b_soloed ? 0 : psg_solo_mutes;
+    }
+    else
+    {
+        fm_mutes  ^= fm_bit;
+        psg_mutes ^= psg_bit;
+    }
+
+    zsm_set_channel_mutes(fm_mutes, psg_mutes);
+} /* update_channel_mutes() */
+
+/*!
+ * @brief Takes the tick records the playback interrupt published and adds them to the statistics.
+ *
+ * @param[in,out] p_tick_stats Tick statistics.
+ */
+static void
+collect_tick_stats(pczsm_tick_stats_t * const p_tick_stats)
+{
+    telemetry_record_t record;
+
+    while (telemetry_read(&record))
+    {
+        ++p_tick_stats->ticks;
+        p_tick_stats->key_ons += record.key_ons;
+
+        if (record.writes > p_tick_stats->peak_writes)
+        {
+            p_tick_stats->peak_writes = record.writes;
+        }
+
+        if (record.flags & (TELEMETRY_FLAG_CATCH_UP | TELEMETRY_FLAG_LATE | TELEMETRY_FLAG_OVERRUN))
+        {
+            ++p_tick_stats->late_ticks;
+        }
+    }
+} /* collect_tick_stats() */
+
+/*!
+ * @brief Fills in the playback status that changes while playing and redraws the status screen.
+ *
+ * @param[in,out] p_status_info Status; the file, timer and length fields are set once by the caller.
+ * @param[in]     p_tick_stats  Tick statistics.
+ * @param[in]     b_paused      Playback is paused.
+ */
+static void
+update_status(status_info_t * const p_status_info, pczsm_tick_stats_t const * const p_tick_stats, bool const b_paused)
+{
+    uint32_t const load_permille = ((uint32_t)timer_get_tick_cost_in_microseconds() * p_status_info->tick_rate) / 1000U;
+
+    p_status_info->position_ticks = p_tick_stats->ticks + telemetry_get_dropped(); // lost records still played
+    p_status_info->volume         = zsm_get_volume();
+    p_status_info->load_permille  = (uint16_t)((load_permille > 1000U) ? 1000U : load_permille);
+    p_status_info->late_ticks     = p_tick_stats->late_ticks;
+    p_status_info->b_paused       = b_paused;
+
+    zsm_get_channel_mutes(&p_status_info->fm_mutes, &p_status_info->psg_mutes);
+    zsm_get_channel_levels(p_status_info->fm_levels, p_status_info->psg_levels);
+
+    status_draw(p_status_info);
+} /* update_status() */
+
+/*!
+ * @brief Issues one harmless YM2151 write (key off channel 0) to time register writes.
+ */
+static void
+calibrate_write(void)
+{
+    ym2151_write(YM2151_ADDRESS_KON, 0);
+} /* calibrate_write() */
+
+/*!
+ * @brief Prints why the resident player could not carry out a request.
+ *
+ * @param[in] tsr_result       Result of the request.
+ * @param[in] interrupt_number API software interrupt.
+ */
+static void
+print_tsr_error(e_tsr_error_t const tsr_result, uint8_t const interrupt_number)
+{
+    switch (tsr_result)
+    {
+        case TSR_ERROR_NONE:
+            break;
+
+        case TSR_ERROR_UNABLE_TO_OPEN_FILE:
+            printf("The resident player is unable to open the file!\n");
+            break;
+
+        case TSR_ERROR_INSUFFICIENT_MEMORY:
+            printf("Insufficient memory to load file!\n");
+            break;
+
+        case TSR_ERROR_BAD_ZSM:
+            printf("Nothing to play, or ZSM version not supported.\n");
+            break;
+
+        case TSR_ERROR_VECTOR_IN_USE:
+            printf("INT %02Xh is already in use; pick another with -tNN.\n", interrupt_number);
+            break;
+
+        case TSR_ERROR_VECTOR_HOOKED:
+            printf("INT %02Xh was hooked after the player; unload that program first.\n", interrupt_number);
+            break;
+
+        case TSR_ERROR_NOT_INSTALLED:
+            printf("No resident player on INT %02Xh.\n", interrupt_number);
+            break;
+
+        case TSR_ERROR_UNSUPPORTED:
+            printf("Resident mode needs the 16-bit build (%s16).\n", PCZSM_APP_NAME);
+            break;
+
+        default:
+            printf("Resident player error: %d\n", tsr_result);
+            break;
+    }
+} /* print_tsr_error() */
+
+/*!
+ * @brief Hands the ZSM file to the resident player and plays it there.
+ *
+ * @param[in] p_file_name ZSM file name.
+ * @param[in] p_options   Playback options.
+ */
+static void
+control_resident(char const * const p_file_name, pczsm_options_t const * const p_options)
+{
+    uint8_t const interrupt_number = p_options->tsr_interrupt;
+
+    e_tsr_error_t tsr_result = tsr_call(interrupt_number, TSR_FUNCTION_LOAD, 0, p_file_name);
+
+    if (tsr_result == TSR_ERROR_NONE)
+    {
+        tsr_call(interrupt_number, TSR_FUNCTION_VOLUME, p_options->volume, NULL);
+        tsr_result = tsr_call(interrupt_number, TSR_FUNCTION_PLAY, p_options->zsm_repeat, NULL);
+    }
+
+    if (tsr_result == TSR_ERROR_NONE)
+    {
+        printf("Playing %s in the resident player\n", p_file_name);
+    }
+    else
+    {
+        print_tsr_error(tsr_result, interrupt_number);
+    }
+} /* control_resident() */
+
+#if defined(_M_I86)
+    #pragma code_seg("main_TEXT", "CODE") // called by the resident player (tsr_config_t)
+#endif
+
+#pragma off (check_stack) // also called on the resident stack
+
+/*!
+ * @brief Sets up the player for a loaded ZSM file.
+ *
+ * @param[in] p_saaym_config SAAYM configuration information.
+ * @param[in] p_ram_handle   The loaded ZSM file.
+ *
+ * @return ZSM_SUCCESS, or the reason the file can not be played.
+ */
+static e_zsm_result_t
+initialize_zsm(saaym_config_t const * const p_saaym_config, ram_handle_t const p_ram_handle)
+{
+    ym2151_write_func_t   p_ym2151_write_func   = (p_saaym_config->ym2151_clock  == YM2151_CLOCK_INVALID)  ? NULL : &ym2151_write;
+    vera_psg_write_func_t p_vera_psg_write_func = (p_saaym_config->saa1099_clock == SAA1099_CLOCK_INVALID) ? NULL : &saa1099_vera_psg_write;
+
+    e_zsm_result_t const zsm_result = zsm_initialize(p_ram_handle, p_ym2151_write_func, p_vera_psg_write_func);
+
+    if (zsm_result == ZSM_SUCCESS)
+    {
+        zsm_set_write_burst_funcs(&ym2151_write_burst, &saa1099_vera_psg_write_burst);
+        zsm_set_vera_psg_volume_func(&saa1099_vera_psg_set_volume);
+    }
+
+    return zsm_result;
+} /* initialize_zsm() */
+
+/*!
+ * @brief Shuts both sound chips down.
+ */
+static void
+terminate_chips(void)
+{
+    saa1099_vera_psg_terminate();
+    ym2151_terminate();
+} /* terminate_chips() */
+
+#pragma on (check_stack)
+
+#if defined(_M_I86)
+    #pragma code_seg("main_TRANSIENT_TEXT", "TRANSIENT")
+#endif
+
+/*!
+ * @brief Initializes the sound chips and applies the playback options, short of starting the timer.
+ *
+ * @param[in] p_saaym_config SAAYM configuration information.
+ * @param[in] p_options      Playback options.
+ *
+ * @return The register writes per tick before writes are deferred (0 for no limit).
+ */
+static uint16_t
+prepare_playback(saaym_config_t const * const p_saaym_config, pczsm_options_t const * const p_options)
+{
+    ym2151_initialize(p_saaym_config->base_io_port + SAAYM_PORT_OFFSET_YM2151, p_saaym_config->ym2151_clock);
+    saa1099_vera_psg_initialize(p_saaym_config->base_io_port, p_saaym_config->saa1099_clock);
+
+    zsm_set_write_order(p_options->write_order);
+    zsm_set_volume(p_options->volume);
+
+    uint16_t const write_budget = p_options->b_shed_writes ?
+                                  (timer_calibrate_calls_per_tick(&calibrate_write, zsm_get_header().tick_rate) / PCZSM_WRITE_BUDGET_SHARE) : 0;
+
+    zsm_set_write_budget(write_budget);
+
+    timer_select_ym2151_timer(p_options->ym2151_timer);
+    timer_set_irq_priority(p_options->b_irq_priority && p_options->b_resident); // play_zsm() measures the default first
+
+    return write_budget;
+} /* prepare_playback() */
 
 /*!
  * @brief Plays the ZSM file specified by the filename.
  * 
  * @param[in] p_saaym_config SAAYM configuration information.
  * @param[in] p_file_name    ZSM file name.
- * @param[in] zsm_repeat     ZSM repeat flags/information.
+ * @param[in] p_options      Playback options.
  */
 static void
-play_zsm(saaym_config_t const * const p_saaym_config, char const * const p_file_name, uint16_t const zsm_repeat)
+play_zsm(saaym_config_t const * const p_saaym_config, char const * const p_file_name, pczsm_options_t const * const p_options)
 {
-    ym2151_initialize(p_saaym_config->base_io_port + SAAYM_PORT_OFFSET_YM2151, p_saaym_config->ym2151_clock);
-    saa1099_vera_psg_initialize(p_saaym_config->base_io_port, p_saaym_config->saa1099_clock);
+    uint16_t     const write_budget = prepare_playback(p_saaym_config, p_options);
+    zsm_header_t const header       = zsm_get_header();
+
+    static status_info_t status_info;
+
+    if (p_options->b_status_screen)
+    {
+        // Walks the whole stream, so done before the timer starts (an 8088 takes a while on a large song).
+        status_info.length_ticks = zsm_get_length_in_ticks(&status_info.loop_tick);
+    }
+
+#if defined(PCZSM_PROFILE)
+    profile_initialize();
+#endif
+
+    timer_start(p_saaym_config->irq_number, header.tick_rate, &zsm_update);
+
+    uint16_t jitter_default  = 0;
+    uint16_t jitter_priority = 0;
+
+    if (p_options->b_irq_priority && (p_saaym_config->irq_number != 0))
+    {
+        // Measure the tick jitter (before playback starts) with the default and the raised IRQ priority.
+        timer_reset_jitter();
+        delay(PCZSM_JITTER_WINDOW_MS);
+        jitter_default = timer_get_jitter_in_microseconds();
+
+        timer_set_irq_priority(true);
+
+        timer_reset_jitter();
+        delay(PCZSM_JITTER_WINDOW_MS);
+        jitter_priority = timer_get_jitter_in_microseconds();
+    }
 
-    zsm_header_t const header = zsm_get_header();
+    char const * const p_timer_name = (p_saaym_config->irq_number == 0) ? "SYSTEM" :
+                                      (timer_get_ym2151_timer() == TIMER_YM2151_TIMER_A) ? "YM2151 A" : "YM2151 B";
 
     printf("\rPlaying %s\n", p_file_name);
     printf("Version   : %u\n", header.version);
-    printf("Tick Rate : %s timer @ %2uHz\n", (p_saaym_config->irq_number == 0) ? "SYSTEM" : "YM2151", header.tick_rate);
-    printf("Loop      : 0x%04X(0x%02X)\n\n", header.loop_point.address, header.loop_point.bank);
+    printf("Tick Rate : %s timer @ %2uHz\n", p_timer_name, header.tick_rate);
+    printf("Loop      : 0x%04X(0x%02X)\n", header.loop_point.address, header.loop_point.bank);
 
-    timer_start(p_saaym_config->irq_number, header.tick_rate, &zsm_update);
+    if (p_options->b_irq_priority && (p_saaym_config->irq_number != 0))
+    {
+        printf("Priority  : IRQ %u first (jitter %uus -> %uus, %+ldus)\n", p_saaym_config->irq_number, jitter_default, jitter_priority,
+               (long)jitter_priority - (long)jitter_default);
+    }
+    printf("Key Order : %s\n", (p_options->write_order == ZSM_WRITE_ORDER_KEY_BURST) ? "BURST" : "STREAM");
+
+    if (write_budget)
+    {
+        printf("Budget    : %u writes/tick\n\n", write_budget);
+    }
+    else
+    {
+        printf("Budget    : OFF\n\n");
+    }
 
-    zsm_start(zsm_repeat);
+    pczsm_tick_stats_t tick_stats = { 0 };
 
-    while (zsm_is_playing())
+    if (p_options->b_latency)
     {
-        if (keyboard_get_state_pcxt_bios(KEYBOARD_SCANCODE_ESC))
+        timer_enable_latency(true); // after the jitter measurement, so only playback ticks are counted
+    }
+
+    telemetry_reset();
+    zsm_start(p_options->zsm_repeat);
+
+    static zsm_snapshot_t snapshot;
+
+    bool b_paused = false;
+
+    bool   b_status    = p_options->b_status_screen && status_initialize();
+    int8_t status_slot = TIMER_INVALID_SLOT;
+
+    if (b_status)
+    {
+        status_slot = timer_add_callback(STATUS_UPDATE_HZ, &status_request_update, TIMER_PRIORITY_DEFERRED);
+
+        status_info.p_file_name  = p_file_name;
+        status_info.p_timer_name = p_timer_name;
+        status_info.tick_rate    = header.tick_rate;
+    }
+
+    keyboard_install();
+
+    while (zsm_is_playing() || b_paused)
+    {
+        timer_service_deferred();
+        collect_tick_stats(&tick_stats);
+
+        if (status_is_update_due())
+        {
+            update_status(&status_info, &tick_stats, b_paused);
+        }
+
+        uint8_t const volume   = zsm_get_volume();
+        uint8_t const scancode = keyboard_get_scancode();
+
+        pczsm_channel_key_t channel_key;
+
+        switch (scancode)
+        {
+            case KEYBOARD_SCANCODE_ESC:
+                if (b_paused || zsm_is_fading())
+                {
+                    zsm_stop(); // second ESC (or ESC while paused) stops immediately
+                    b_paused = false;
+                }
+                else
+                {
+                    zsm_fade_out(header.tick_rate); // fade out over one second
+                }
+                break;
+
+            case KEYBOARD_SCANCODE_MINUS:
+            case KEYBOARD_SCANCODE_KEYPAD_MINUS:
+                if (!zsm_is_fading())
+                {
+                    zsm_set_volume((volume > PCZSM_VOLUME_STEP) ? (volume - PCZSM_VOLUME_STEP) : 0);
+                }
+                break;
+
+            case KEYBOARD_SCANCODE_EQUALS:
+            case KEYBOARD_SCANCODE_KEYPAD_PLUS:
+                if (!zsm_is_fading())
+                {
+                    zsm_set_volume(volume + PCZSM_VOLUME_STEP);
+                }
+                break;
+
+            case KEYBOARD_SCANCODE_P:
+                if (b_paused)
+                {
+                    if (!b_status)
+                    {
+                        printf("\r      \r");
+                    }
+
+                    zsm_resume(&snapshot);
+                    timer_start(p_saaym_config->irq_number, header.tick_rate, &zsm_update);
+                }
+                else
+                {
+                    timer_stop();
+                    zsm_suspend(&snapshot);
+
+                    if (!b_status)
+                    {
+                        printf("\rPaused");
+                    }
+                }
+
+                b_paused = !b_paused;
+
+                if (b_status)
+                {
+                    update_status(&status_info, &tick_stats, b_paused); // the refresh slot stops with the timer
+                }
+                break;
+
+            case KEYBOARD_SCANCODE_0:
+                zsm_set_channel_mutes(0, 0);
+                break;
+
+            default:
+                if (decode_channel_key(scancode, &channel_key))
+                {
+                    update_channel_mutes(&channel_key);
+                }
+                break;
+        }
+
+        // Sleep until the next interrupt (tick, key or BIOS timer) unless one already left work behind.
+        _disable();
+
+        if (keyboard_has_scancode() || timer_is_deferred_pending())
         {
-            zsm_stop();
+            _enable();
         }
+        else
+        {
+            irq_wait_for_interrupt();
+        }
+    }
+
+    keyboard_uninstall();
+
+    if (b_status)
+    {
+        timer_remove_callback(status_slot);
+        status_terminate();
     }
 
+    uint32_t const average_rate = timer_get_average_rate_in_millihertz();
+
+    timer_overrun_stats_t overrun_stats;
+    timer_get_overrun_stats(&overrun_stats);
+
+    timer_latency_stats_t latency_stats;
+    timer_get_latency_stats(&latency_stats);
+    timer_enable_latency(false);
+
+    uint32_t deferred_writes   = 0;
+    uint32_t superseded_writes = 0;
+    zsm_get_write_budget_stats(&deferred_writes, &superseded_writes);
+
     timer_stop();
+    collect_tick_stats(&tick_stats);
 
-    saa1099_vera_psg_terminate();
-    ym2151_terminate();
+    if (average_rate)
+    {
+        printf("\rAverage tick rate: %lu.%03lu Hz\n", (unsigned long)(average_rate / 1000U), (unsigned long)(average_rate % 1000U));
+    }
+
+    if (overrun_stats.overruns || overrun_stats.reentries)
+    {
+        printf("Timer overruns: %lu, re-entries: %lu, decimations: %u, recoveries: %u, peak ticks/IRQ: %u\n",
+               (unsigned long)overrun_stats.overruns, (unsigned long)overrun_stats.reentries,
+               overrun_stats.decimations, overrun_stats.recoveries, overrun_stats.peak_ticks_per_irq);
+    }
+
+    if (latency_stats.samples)
+    {
+        printf("Tick start latency (%s): mean %uus, p99 %uus, max %uus over %lu ticks\n",
+               latency_stats.b_estimated ? "YM2151 timer, estimated" : "IRQ 0", latency_stats.mean_in_microseconds,
+               latency_stats.p99_in_microseconds, latency_stats.max_in_microseconds, (unsigned long)latency_stats.samples);
+    }
+
+    if (deferred_writes)
+    {
+        printf("Deferred writes: %lu, dropped as superseded: %lu\n", (unsigned long)deferred_writes, (unsigned long)superseded_writes);
+    }
+
+    if (tick_stats.ticks)
+    {
+        printf("Ticks: %lu, key ons: %lu, peak writes/tick: %u, late ticks: %lu, records lost: %u\n",
+               (unsigned long)tick_stats.ticks, (unsigned long)tick_stats.key_ons, tick_stats.peak_writes,
+               (unsigned long)tick_stats.late_ticks, telemetry_get_dropped());
+    }
+
+    char const * const p_lock_failure = irq_get_lock_failure();
+
+    if (p_lock_failure != NULL)
+    {
+        printf("Unable to lock the %s interrupt memory; a paging DPMI host may have delayed ticks\n", p_lock_failure);
+    }
+
+#if defined(PCZSM_PROFILE)
+    profile_print_report(stdout);
+
+    if (p_options->p_profile_file_name)
+    {
+        FILE * const p_profile_file = fopen(p_options->p_profile_file_name, "at");
+
+        if (p_profile_file)
+        {
+            fprintf(p_profile_file, "%s\n", p_file_name);
+            profile_print_report(p_profile_file);
+            fprintf(p_profile_file, "\n");
+            fclose(p_profile_file);
+        }
+        else
+        {
+            printf("Unable to write %s!\n", p_options->p_profile_file_name);
+        }
+    }
+#endif
+
+    terminate_chips();
 } /* play_zsm() */
 
+/*!
+ * @brief Plays the ZSM file in the background and stays resident.
+ *
+ * @param[in] p_saaym_config SAAYM configuration information.
+ * @param[in] p_file_name    ZSM file name.
+ * @param[in] p_options      Playback options.
+ * @param[in] p_ram_handle   The loaded ZSM file.
+ */
+static void
+install_resident(saaym_config_t const * const p_saaym_config, char const * const p_file_name, pczsm_options_t const * const p_options, ram_handle_t const p_ram_handle)
+{
+    tsr_config_t const config = { *p_saaym_config, &initialize_zsm, &terminate_chips, p_options->zsm_repeat, p_options->tsr_interrupt };
+
+    prepare_playback(p_saaym_config, p_options);
+
+    printf("\rPlaying %s in the background\n", p_file_name);
+
+    e_tsr_error_t const tsr_result = tsr_install(&config, p_ram_handle); // only returns on failure
+
+    terminate_chips();
+    print_tsr_error(tsr_result, p_options->tsr_interrupt);
+} /* install_resident() */
+
+/*!
+ * @brief Runs the decode benchmark on the ZSM file and prints the results.
+ *
+ * @param[in] p_file_name ZSM file name.
+ * @param[in] p_options   Playback options.
+ */
+static void
+benchmark_zsm(char const * const p_file_name, pczsm_options_t const * const p_options)
+{
+    static char const * const p_backend_names[] = { "null writers", "shadow only", "SAAYM ports" };
+
+    e_bench_backend_t const backend = p_options->bench_backend;
+
+#if defined(PCZSM_SAAYM_DIRECT)
+    if (backend != BENCH_BACKEND_PORTS)
+    {
+        printf("This build always writes to the SAAYM; use -b or -bP.\n");
+        return;
+    }
+#endif
+
+    if (backend == BENCH_BACKEND_PORTS)
+    {
+        if (p_options->b_redetect && p_options->p_cache_file_name)
+        {
+            remove(p_options->p_cache_file_name);
+        }
+
+        saaym_config_t const saaym_config = saaym_detect_cached(true, p_options->p_cache_file_name);
+
+        if (saaym_config.base_io_port == 0)
+        {
+            printf("TexElec SAAYM not found!\n");
+            return;
+        }
+
+        ym2151_initialize(saaym_config.base_io_port + SAAYM_PORT_OFFSET_YM2151, saaym_config.ym2151_clock);
+        saa1099_vera_psg_initialize(saaym_config.base_io_port, saaym_config.saa1099_clock);
+    }
+
+    ram_handle_t         zsm_ram_handle  = NULL;
+    e_ram_result_t const ram_load_result = ram_load_file(&zsm_ram_handle, p_file_name);
+
+    if (ram_load_result == RAM_LOAD_SUCCESS)
+    {
+        bench_result_t result;
+
+        zsm_set_write_order(p_options->write_order);
+        zsm_set_write_budget(0);
+
+        printf("Benchmarking %s (%s)\n", p_file_name, p_backend_names[backend]);
+
+        e_zsm_result_t const zsm_result = bench_run(zsm_ram_handle, backend, &result);
+
+        if (zsm_result == ZSM_SUCCESS)
+        {
+            printf("Passes    : %lu (%lu ticks, %lu bytes in %lu.%02lu s)\n", (unsigned long)result.passes, (unsigned long)result.ticks,
+                   (unsigned long)result.bytes, (unsigned long)(result.centiseconds / 100U), (unsigned long)(result.centiseconds % 100U));
+            printf("Ticks/s   : %lu\n", (unsigned long)result.ticks_per_second);
+            printf("Bytes/s   : %lu\n", (unsigned long)result.bytes_per_second);
+            printf("Speed-up  : %lu.%02lux realtime @ %uHz\n", (unsigned long)(result.speedup_percent / 100U),
+                   (unsigned long)(result.speedup_percent % 100U), zsm_get_header().tick_rate);
+        }
+        else
+        {
+            printf("Nothing to play in %s (error %d).\n", p_file_name, zsm_result);
+        }
+    }
+    else if (ram_load_result == RAM_LOAD_UNABLE_TO_OPEN_FILE)
+    {
+        printf("Unable to open %s!\n", p_file_name);
+    }
+    else
+    {
+        printf("Insufficient memory to load file!\n");
+    }
+
+    ram_free(&zsm_ram_handle);
+
+    if (backend == BENCH_BACKEND_PORTS)
+    {
+        terminate_chips();
+    }
+} /* benchmark_zsm() */
+
 /*!
  * @brief Main ZSM playback handler.
  * 
  * @param[in] p_file_name ZSM file name.
- * @param[in] zsm_repeat  ZSM repeat flags/information.
+ * @param[in] p_options   Playback options.
  */
 static void
-zsm_main(char const * const p_file_name, uint16_t const zsm_repeat)
+zsm_main(char const * const p_file_name, pczsm_options_t const * const p_options)
 {
-    saaym_config_t const saaym_config = saaym_detect(true);
+    if (p_options->b_benchmark)
+    {
+        benchmark_zsm(p_file_name, p_options);
+        return;
+    }
+
+    if (p_options->b_resident && tsr_is_installed(p_options->tsr_interrupt))
+    {
+        control_resident(p_file_name, p_options);
+        return;
+    }
+
+    if (p_options->b_redetect && p_options->p_cache_file_name)
+    {
+        remove(p_options->p_cache_file_name);
+    }
+
+    saaym_config_t const saaym_config = saaym_detect_cached(true, p_options->p_cache_file_name);
 
 #ifdef PCZSM_DEBUG
     printf("SAAYM at: 0x%X, IRQ: %d, F: %d, P: %d\n", saaym_config.base_io_port, saaym_config.irq_number, saaym_config.ym2151_clock, saaym_config.saa1099_clock);
@@ -95,11 +824,27 @@ zsm_main(char const * const p_file_name, uint16_t const zsm_repeat)
 
     if (saaym_config.base_io_port > 0)
     {
+        if (saaym_config.ym2151_clock_in_hz)
+        {
+            printf("YM2151 clock measured at %lu Hz.\n", (unsigned long)saaym_config.ym2151_clock_in_hz);
+        }
+
         printf("Loading %s", p_file_name);
 
         ram_handle_t zsm_ram_handle = NULL;
+
+        if (p_options->b_resident)
+        {
+            tsr_prefer_upper_memory(true); // the song stays resident
+        }
+
         e_ram_result_t const ram_load_result = ram_load_file(&zsm_ram_handle, p_file_name);
 
+        if (p_options->b_resident)
+        {
+            tsr_prefer_upper_memory(false);
+        }
+
         if (ram_load_result != RAM_LOAD_SUCCESS)
         {
             printf("\n");
@@ -109,10 +854,7 @@ zsm_main(char const * const p_file_name, uint16_t const zsm_repeat)
         {
             case RAM_LOAD_SUCCESS:
                 {
-                    ym2151_write_func_t   p_ym2151_write_func   = (saaym_config.ym2151_clock  == YM2151_CLOCK_INVALID)  ? NULL : &ym2151_write;
-                    vera_psg_write_func_t p_vera_psg_write_func = (saaym_config.saa1099_clock == SAA1099_CLOCK_INVALID) ? NULL : &saa1099_vera_psg_write;
-
-                    e_zsm_result_t const zsm_result = zsm_initialize(zsm_ram_handle, p_ym2151_write_func, p_vera_psg_write_func);
+                    e_zsm_result_t const zsm_result = initialize_zsm(&saaym_config, zsm_ram_handle);
 
                     if (zsm_result != ZSM_SUCCESS)
                     {
@@ -122,7 +864,14 @@ zsm_main(char const * const p_file_name, uint16_t const zsm_repeat)
                     switch (zsm_result)
                     {
                         case ZSM_SUCCESS:
-                            play_zsm(&saaym_config, p_file_name, zsm_repeat);
+                            if (p_options->b_resident)
+                            {
+                                install_resident(&saaym_config, p_file_name, p_options, zsm_ram_handle);
+                            }
+                            else
+                            {
+                                play_zsm(&saaym_config, p_file_name, p_options);
+                            }
                             break;
 
                         case ZSM_BAD_DATA_POINTER:
@@ -137,6 +886,10 @@ zsm_main(char const * const p_file_name, uint16_t const zsm_repeat)
                             printf("Nothing to play; no YM2151, VERA PSG data, or suitiable hardware to play on.\n");
                             break;
 
+                        case ZSM_MISSING_CHIP:
+                            printf("This build writes to both SAAYM chips directly; set the YM2151 (Y) and SAA1099 (S) clocks.\n");
+                            break;
+
                         default:
                             printf("Unknown error: %d\n", zsm_result);
                             break;
@@ -169,6 +922,41 @@ zsm_main(char const * const p_file_name, uint16_t const zsm_repeat)
     }
 } /* zsm_main() */
 
+/*!
+ * @brief Builds the detection cache file name next to the program.
+ *
+ * @param[in] p_program_path Program path (argv[0]).
+ *
+ * @return Cache file name, or NULL if the program path is unknown or too long.
+ */
+static char const *
+get_cache_file_name(char const * const p_program_path)
+{
+    static char cache_file_name[_MAX_PATH];
+
+    if ((p_program_path == NULL) || (*p_program_path == '\0'))
+    {
+        return NULL;
+    }
+
+    size_t directory_length = strlen(p_program_path);
+
+    while (directory_length && (p_program_path[directory_length - 1] != '\\') && (p_program_path[directory_length - 1] != ':'))
+    {
+        --directory_length;
+    }
+
+    if ((directory_length + sizeof(SAAYM_CACHE_FILE_NAME)) > sizeof(cache_file_name))
+    {
+        return NULL;
+    }
+
+    memcpy(cache_file_name, p_program_path, directory_length);
+    strcpy(&cache_file_name[directory_length], SAAYM_CACHE_FILE_NAME);
+
+    return cache_file_name;
+} /* get_cache_file_name() */
+
 int 
 main(int argc, char ** argv)
 {
@@ -180,15 +968,54 @@ main(int argc, char ** argv)
     {
         printf("%s %s by %s\n\n", PCZSM_APP_NAME, PCZSM_BUILD_VERSION, PCZSM_AUTHORS);
 
-        if (strncmp(argv[1], "-h", 2) == 0)
+        if (strncmp(argv[1], "-u", 2) == 0)
+        {
+            uint8_t const interrupt_number = argv[1][2] ? (uint8_t)strtoul(&argv[1][2], NULL, 16) : TSR_INTERRUPT_DEFAULT;
+
+            e_tsr_error_t const tsr_result = tsr_call(interrupt_number, TSR_FUNCTION_UNINSTALL, 0, NULL);
+
+            if (tsr_result == TSR_ERROR_NONE)
+            {
+                printf("Resident player removed.\n");
+            }
+            else
+            {
+                print_tsr_error(tsr_result, interrupt_number);
+            }
+        }
+        else if (strncmp(argv[1], "-h", 2) == 0)
         {
             printf("Usage: %s%d [options] %s\n\n", PCZSM_APP_NAME, PCZSM_ARCHITECTURE, PCZSM_FILENAME);
             printf("Where options can be:\n");
             printf("-rN\tRepeat N times (if the ZSM repeats). -r only to repeat forever.\n");
+            printf("-k\tIssue key on/off writes together at the start of each tick.\n");
+            printf("-vN\tMaster volume N (0-%u).\n", ZSM_VOLUME_MAX);
+            printf("-a\tUse YM2151 Timer A on the SAAYM IRQ (finer period, 55Hz and up).\n");
+            printf("-s\tDefer pitch and level writes when a tick overruns its write budget (slow PCs).\n");
+            printf("-p\tGive the SAAYM IRQ the highest interrupt priority while playing (implies -l).\n");
+            printf("-d\tDetect the SAAYM again instead of using the %s cache.\n", SAAYM_CACHE_FILE_NAME);
+            printf("-l\tReport how late the ticks start (mean, 99th percentile, maximum).\n");
+            printf("-n\tPrint the playback information only; no status screen while playing.\n");
+#if defined(PCZSM_SAAYM_DIRECT)
+            printf("-b\tBenchmark decoding as fast as possible; this build sends the writes to the\n");
+            printf("\tSAAYM (-bN and -bS need a build without direct=1/asm=1).\n");
+#else
+            printf("-b[X]\tBenchmark decoding as fast as possible; X = N drops the writes (default),\n");
+            printf("\tS keeps them in memory, P sends them to the SAAYM.\n");
+#endif
+#if defined(PCZSM_PROFILE)
+            printf("-fFILE\tAppend the tick cost profile to FILE.\n");
+#endif
+            printf("-t[NN]\tPlay in the background and stay resident; API on INT NNh (default %02Xh).\n", TSR_INTERRUPT_DEFAULT);
+            printf("\tWith the player resident, hands the file to it instead.\n");
+            printf("-u[NN]\tRemove the resident player (no file name).\n");
+            printf("\nDuring playback: -/+ change volume, P pauses, ESC fades out (ESC again stops).\n");
+            printf("1-8 mute FM channels, F1-F10 and Shift+F1-F6 mute PSG channels 1-16.\n");
+            printf("Alt+1-8, Alt+F1-F10 and Ctrl+F1-F6 solo a channel, 0 unmutes all.\n");
         }
         else
         {
-            uint16_t zsm_repeat = 0;
+            pczsm_options_t options = { 0, ZSM_WRITE_ORDER_STREAM, ZSM_VOLUME_MAX, TIMER_YM2151_AUTO, false, false, false, TSR_INTERRUPT_DEFAULT, false, false, false, PCZSM_BENCH_BACKEND_DEFAULT, true, get_cache_file_name(argv[0]), NULL };
 
             for (size_t argc_index = 1; argc_index < (size_t)argc-1; ++argc_index)
             {
@@ -196,23 +1023,80 @@ main(int argc, char ** argv)
 
                 if (p_argv)
                 {
-                    if ((zsm_repeat == 0) && (strncmp(p_argv, "-r", 2) == 0))
+                    if ((options.zsm_repeat == 0) && (strncmp(p_argv, "-r", 2) == 0))
                     {
                         char const * const p_count = &p_argv[2];
                         if (*p_count)
                         {
-                            zsm_repeat = (uint8_t)atoi(p_count); // get repeat count, default to 1 if no value was specified.
+                            options.zsm_repeat = (uint8_t)atoi(p_count); // get repeat count, default to 1 if no value was specified.
                         }
                         else
                         {
                             // No repeat count; repeat forever
-                            zsm_repeat = ZSM_REPEAT_FOREVER;
+                            options.zsm_repeat = ZSM_REPEAT_FOREVER;
+                        }
+                    }
+                    else if (strcmp(p_argv, "-k") == 0)
+                    {
+                        options.write_order = ZSM_WRITE_ORDER_KEY_BURST;
+                    }
+                    else if (strcmp(p_argv, "-a") == 0)
+                    {
+                        options.ym2151_timer = TIMER_YM2151_TIMER_A;
+                    }
+                    else if (strcmp(p_argv, "-s") == 0)
+                    {
+                        options.b_shed_writes = true;
+                    }
+                    else if (strcmp(p_argv, "-p") == 0)
+                    {
+                        options.b_irq_priority = true;
+                        options.b_latency      = true; // the effect shows in the tick start latency
+                    }
+                    else if (strcmp(p_argv, "-d") == 0)
+                    {
+                        options.b_redetect = true;
+                    }
+                    else if (strcmp(p_argv, "-l") == 0)
+                    {
+                        options.b_latency = true;
+                    }
+                    else if (strcmp(p_argv, "-n") == 0)
+                    {
+                        options.b_status_screen = false;
+                    }
+                    else if (strncmp(p_argv, "-b", 2) == 0)
+                    {
+                        options.b_benchmark   = true;
+                        options.bench_backend = (toupper(p_argv[2]) == 'S') ? BENCH_BACKEND_SHADOW :
+                                                (toupper(p_argv[2]) == 'N') ? BENCH_BACKEND_NULL :
+                                                (toupper(p_argv[2]) == 'P') ? BENCH_BACKEND_PORTS : PCZSM_BENCH_BACKEND_DEFAULT;
+                    }
+#if defined(PCZSM_PROFILE)
+                    else if ((strncmp(p_argv, "-f", 2) == 0) && p_argv[2])
+                    {
+                        options.p_profile_file_name = &p_argv[2];
+                    }
+#endif
+                    else if (strncmp(p_argv, "-t", 2) == 0)
+                    {
+                        options.b_resident = true;
+
+                        if (p_argv[2])
+                        {
+                            options.tsr_interrupt = (uint8_t)strtoul(&p_argv[2], NULL, 16);
                         }
                     }
+                    else if (strncmp(p_argv, "-v", 2) == 0)
+                    {
+                        int const volume = atoi(&p_argv[2]);
+
+                        options.volume = (uint8_t)((volume > (int)ZSM_VOLUME_MAX) ? ZSM_VOLUME_MAX : ((volume < 0) ? 0 : volume));
+                    }
                 }
             }
 
-            zsm_main(argv[argc - 1], zsm_repeat);
+            zsm_main(argv[argc - 1], &options);
         }
     }
 
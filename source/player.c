@@ -0,0 +1,341 @@
+/** @file player.c
+ *
+ * @brief Caller-driven ZSM player for programs that keep their own timer interrupt.
+ *
+ * @par
+ * The host's call rate is kept as a ratio (calls per second = host_numerator / host_denominator). Each call adds
+ * song_rate * host_denominator to an accumulator and a song tick is due for every host_numerator in it, which
+ * spreads the song ticks evenly over the host's calls without drifting.
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <conio.h>
+#include <i86.h>
+#include "irq.h"
+#include "i8253.h"
+#include "ram.h"
+#include "zsm.h"
+#include "ym2151.h"
+#include "saa1099.h"
+#include "saaym.h"
+#include "telemetry.h"
+#include "player.h"
+
+#pragma off (check_stack) // player_tick() runs in the host's interrupt, on the host's stack
+
+#define PLAYER_MILLIHERTZ_PER_HERTZ (1000UL)
+#define PLAYER_PIT_COUNT_0          (0x10000UL) // PIT count 0 divides by 65536
+
+static saaym_config_t   g_saaym_config;
+static ram_handle_t     g_p_ram_handle      = NULL;
+static volatile bool    g_b_playing         = false;
+static volatile bool    g_b_in_tick         = false;
+static volatile uint8_t g_calls_pending     = 0;     // host calls that arrived while player_tick() was running
+static uint32_t         g_host_numerator    = 18206UL; // BIOS timer rate in millihertz until the host sets its own
+static uint32_t         g_host_denominator  = PLAYER_MILLIHERTZ_PER_HERTZ;
+static uint32_t         g_step              = 0;     // added per host call: song rate * host denominator
+static uint32_t         g_accumulator       = 0;     // a song tick is due for every host numerator
+static zsm_snapshot_t   g_snapshot;                  // only used to silence the chips on stop
+static bool             g_b_locked          = false;
+
+static void player_lock_begin(void);
+static void player_lock_end(void);
+
+static irq_lock_region_t const g_lock_regions[] =
+{
+    IRQ_LOCK_REGION(g_b_playing),
+    IRQ_LOCK_REGION(g_b_in_tick),
+    IRQ_LOCK_REGION(g_calls_pending),
+    IRQ_LOCK_REGION(g_host_numerator),
+    IRQ_LOCK_REGION(g_step),
+    IRQ_LOCK_REGION(g_accumulator)
+};
+
+/*!
+ * @brief Start of the code reached at interrupt time (see irq_lock_code()).
+ */
+static void
+player_lock_begin(void)
+{
+} /* player_lock_begin() */
+
+/*!
+ * @brief Runs the song ticks that became due with one host call.
+ */
+static inline void
+player_run_call(void)
+{
+    g_accumulator += g_step;
+
+    uint8_t ticks = 0;
+
+    while ((g_accumulator >= g_host_numerator) && (ticks < PLAYER_MAX_TICKS_PER_CALL))
+    {
+        g_accumulator -= g_host_numerator;
+
+        if (ticks++)
+        {
+            telemetry_raise_flags(TELEMETRY_FLAG_CATCH_UP);
+        }
+
+        zsm_update();
+    }
+
+    if (g_accumulator >= g_host_numerator)
+    {
+        g_accumulator %= g_host_numerator; // the host calls too rarely for the song; drop what can not be caught up
+    }
+} /* player_run_call() */
+
+/*!
+ * @brief Advances playback by one call of the host's timer interrupt.
+ *
+ * @note Call from the host's interrupt at the rate given with player_set_host_rate_in_millihertz() or
+ *       player_set_host_pit_divisor(). Runs zero or more song ticks. A call arriving while the previous one still
+ *       runs is counted and run by the previous one.
+ */
+void
+player_tick(void)
+{
+    if (g_b_playing == false)
+    {
+        return;
+    }
+
+    if (g_b_in_tick)
+    {
+        if (g_calls_pending < UINT8_MAX)
+        {
+            ++g_calls_pending;
+        }
+
+        return;
+    }
+
+    g_b_in_tick = true;
+
+    player_run_call();
+
+    while (g_calls_pending)
+    {
+        --g_calls_pending;
+
+        telemetry_raise_flags(TELEMETRY_FLAG_LATE);
+        player_run_call();
+    }
+
+    g_b_in_tick = false;
+} /* player_tick() */
+
+/*!
+ * @brief End of the code reached at interrupt time.
+ */
+static void
+player_lock_end(void)
+{
+} /* player_lock_end() */
+
+/*!
+ * @brief Recomputes the accumulator step from the song and host rates.
+ */
+static void
+player_update_step(void)
+{
+    uint16_t const song_rate = g_p_ram_handle ? zsm_get_header().tick_rate : 0;
+
+    _disable();
+    g_step        = (uint32_t)song_rate * g_host_denominator;
+    g_accumulator = 0;
+    _enable();
+} /* player_update_step() */
+
+/*!
+ * @brief Sets the rate the host calls player_tick() at.
+ *
+ * @param[in] rate_in_millihertz Host calls per 1000 seconds (e.g. 18206 for the BIOS timer).
+ */
+void
+player_set_host_rate_in_millihertz(uint32_t const rate_in_millihertz)
+{
+    if (rate_in_millihertz)
+    {
+        g_host_numerator   = rate_in_millihertz;
+        g_host_denominator = PLAYER_MILLIHERTZ_PER_HERTZ;
+
+        player_update_step();
+    }
+} /* player_set_host_rate_in_millihertz() */
+
+/*!
+ * @brief Sets the rate the host calls player_tick() at from the host's PIT channel 0 divisor.
+ *
+ * @note Exact for any divisor, e.g. a host running IRQ 0 at a rate the PIT can not hit in whole Hertz.
+ *
+ * @param[in] divisor PIT count the host programmed (0 for 65536, the BIOS rate).
+ */
+void
+player_set_host_pit_divisor(uint16_t const divisor)
+{
+    g_host_numerator   = I8253_CLOCK_SPEED_IN_HZ;
+    g_host_denominator = divisor ? divisor : PLAYER_PIT_COUNT_0;
+
+    player_update_step();
+} /* player_set_host_pit_divisor() */
+
+/*!
+ * @brief Sets up the sound chips for playback.
+ *
+ * @param[in] p_saaym_config SAAYM configuration from saaym_detect().
+ *
+ * @return PLAYER_SUCCESS, or PLAYER_NO_HARDWARE if no SAAYM was detected.
+ */
+e_player_result_t
+player_initialize(saaym_config_t const * const p_saaym_config)
+{
+    if (p_saaym_config->base_io_port == 0)
+    {
+        return PLAYER_NO_HARDWARE;
+    }
+
+    if (g_b_locked == false)
+    {
+        irq_lock_module("player", &player_lock_begin, &player_lock_end, g_lock_regions, IRQ_LOCK_REGION_COUNT(g_lock_regions));
+        g_b_locked = true;
+    }
+
+    g_saaym_config = *p_saaym_config;
+
+    ym2151_initialize(g_saaym_config.base_io_port + SAAYM_PORT_OFFSET_YM2151, g_saaym_config.ym2151_clock);
+    saa1099_vera_psg_initialize(g_saaym_config.base_io_port, g_saaym_config.saa1099_clock);
+
+    return PLAYER_SUCCESS;
+} /* player_initialize() */
+
+/*!
+ * @brief Stops playback, frees the song and shuts both sound chips down.
+ */
+void
+player_terminate(void)
+{
+    player_stop();
+    ram_free(&g_p_ram_handle);
+
+    saa1099_vera_psg_terminate();
+    ym2151_terminate();
+} /* player_terminate() */
+
+/*!
+ * @brief Sets the player up for the loaded song, rewinding it.
+ *
+ * @return PLAYER_SUCCESS, or PLAYER_BAD_ZSM if the song can not be played.
+ */
+static e_player_result_t
+player_setup_zsm(void)
+{
+    ym2151_write_func_t   p_ym2151_write_func   = (g_saaym_config.ym2151_clock  == YM2151_CLOCK_INVALID)  ? NULL : &ym2151_write;
+    vera_psg_write_func_t p_vera_psg_write_func = (g_saaym_config.saa1099_clock == SAA1099_CLOCK_INVALID) ? NULL : &saa1099_vera_psg_write;
+
+    if (zsm_initialize(g_p_ram_handle, p_ym2151_write_func, p_vera_psg_write_func) != ZSM_SUCCESS)
+    {
+        return PLAYER_BAD_ZSM;
+    }
+
+    zsm_set_write_burst_funcs(&ym2151_write_burst, &saa1099_vera_psg_write_burst);
+    zsm_set_vera_psg_volume_func(&saa1099_vera_psg_set_volume);
+
+    return PLAYER_SUCCESS;
+} /* player_setup_zsm() */
+
+/*!
+ * @brief Loads a ZSM file, replacing the loaded song.
+ *
+ * @param[in] p_file_name ZSM file name.
+ *
+ * @return PLAYER_SUCCESS, or the reason the song was not loaded.
+ */
+e_player_result_t
+player_load(char const * const p_file_name)
+{
+    player_stop();
+    ram_free(&g_p_ram_handle);
+
+    e_ram_result_t const ram_result = ram_load_file(&g_p_ram_handle, p_file_name);
+
+    if (ram_result != RAM_LOAD_SUCCESS)
+    {
+        ram_free(&g_p_ram_handle);
+
+        return (ram_result == RAM_LOAD_UNABLE_TO_OPEN_FILE) ? PLAYER_UNABLE_TO_OPEN_FILE : PLAYER_INSUFFICIENT_MEMORY;
+    }
+
+    e_player_result_t const result = player_setup_zsm();
+
+    if (result != PLAYER_SUCCESS)
+    {
+        ram_free(&g_p_ram_handle);
+    }
+
+    player_update_step();
+
+    return result;
+} /* player_load() */
+
+/*!
+ * @brief Plays the loaded song from the start.
+ *
+ * @param[in] zsm_repeat Repeat control value (repeat count, or ZSM_REPEAT_FOREVER).
+ *
+ * @return PLAYER_SUCCESS, or the reason the song can not play.
+ */
+e_player_result_t
+player_play(uint16_t const zsm_repeat)
+{
+    player_stop();
+
+    if (g_p_ram_handle == NULL)
+    {
+        return PLAYER_NOTHING_LOADED;
+    }
+
+    e_player_result_t const result = player_setup_zsm();
+
+    if (result == PLAYER_SUCCESS)
+    {
+        player_update_step();
+        zsm_start(zsm_repeat);
+
+        g_b_playing = true;
+    }
+
+    return result;
+} /* player_play() */
+
+/*!
+ * @brief Stops playback and silences both sound chips.
+ */
+void
+player_stop(void)
+{
+    if (g_b_playing)
+    {
+        g_b_playing = false; // player_tick() runs no further ticks; one in progress has finished by now
+
+        zsm_suspend(&g_snapshot);
+    }
+} /* player_stop() */
+
+/*!
+ * @brief Checks if the song is still playing.
+ *
+ * @return true while playing, false once stopped or at the end of the song.
+ */
+bool
+player_is_playing(void)
+{
+    return g_b_playing && zsm_is_playing();
+} /* player_is_playing() */
+
+/*** end of file ***/
@@ -0,0 +1,52 @@
+/** @file player.h
+ *
+ * @brief Caller-driven ZSM player for programs that keep their own timer interrupt.
+ *
+ * @par
+ * Part of the PCZSM library (PCZSML16.LIB / PCZSML32.LIB). The host detects the SAAYM (saaym_detect()), calls
+ * player_initialize() and player_load(), tells the player how often its interrupt runs and then calls player_tick()
+ * from that interrupt. Ticks are spread over the host's calls with fractional accounting, so songs keep their own
+ * tick rate whatever the host's rate is. The player never hooks an interrupt or reprograms the PIT.
+ *
+ * @note saaym_detect(true) reprograms PIT channel 0 to the BIOS rate to time the YM2151 clock; call it before the
+ *       host takes over IRQ 0, or use saaym_detect(false) with the SAAYM environment variable.
+ *
+ */
+
+#pragma once
+
+#define PLAYER_MAX_TICKS_PER_CALL (8U) // song ticks one player_tick() may run to catch up
+
+typedef enum
+{
+    PLAYER_SUCCESS,
+    PLAYER_NO_HARDWARE,
+    PLAYER_UNABLE_TO_OPEN_FILE,
+    PLAYER_INSUFFICIENT_MEMORY,
+    PLAYER_BAD_ZSM,
+    PLAYER_NOTHING_LOADED
+} e_player_result_t;
+
+//--------------------------------------------------------------------
+#ifdef __cplusplus
+extern "C" {
+#endif
+//--------------------------------------------------------------------
+
+e_player_result_t player_initialize(saaym_config_t const * const p_saaym_config);
+void              player_terminate(void);
+e_player_result_t player_load(char const * const p_file_name);
+void              player_set_host_rate_in_millihertz(uint32_t const rate_in_millihertz);
+void              player_set_host_pit_divisor(uint16_t const divisor);
+e_player_result_t player_play(uint16_t const zsm_repeat);
+void              player_stop(void);
+bool              player_is_playing(void);
+void              player_tick(void);
+
+//--------------------------------------------------------------------
+#ifdef __cplusplus
+}
+#endif
+//--------------------------------------------------------------------
+
+/*** end of file ***/
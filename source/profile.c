@@ -0,0 +1,371 @@
+/** @file profile.c
+ *
+ * @brief Per-tick cost profiler for instrumented builds (PCZSM_PROFILE, built with profile=1).
+ *
+ * @par
+ * Costs are kept in clock units at interrupt time and only converted to microseconds for the report; the
+ * histogram bounds are converted to clock units once when the timer starts. The PIT count is read the way the
+ * timer reads it: while the PIT drives the ticks it counts down by one and reloads with the period the timer
+ * last wrote, otherwise it is taken to run the BIOS square wave (mode 3, count decremented by 2 per clock).
+ * Ticks run with interrupts enabled, so a tick's cost includes interrupts serviced during it.
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <conio.h>
+#include <i86.h>
+#include "irq.h"
+#include "i8253.h"
+#include "bios.h"
+#include "ram.h"
+#include "zsm.h"
+#include "profile.h"
+
+#pragma off (check_stack) // the tick hooks run inside the timer interrupt
+
+#define PROFILE_MICROSECONDS_PER_SECOND (1000000UL)
+#define PROFILE_PERMILLE                (1000U)
+#define PROFILE_CALIBRATION_BIOS_TICKS  (2U)          // time stamp counter calibration (about 110 ms)
+#define PROFILE_CPUID_ID_FLAG           (0x00200000UL) // EFLAGS.ID can be toggled when CPUID is supported
+#define PROFILE_CPUID_FEATURE_TSC       (0x00000010UL) // CPUID function 1, EDX: time stamp counter
+
+#if defined(__386__) && defined(__WATCOMC__)
+    #define PROFILE_TSC_SUPPORTED
+
+uint32_t profile_toggle_id_flag(void);
+#pragma aux profile_toggle_id_flag = \
+    "pushfd"                \
+    "pop    eax"            \
+    "mov    ecx, eax"       \
+    "xor    eax, 200000h"   \
+    "push   eax"            \
+    "popfd"                 \
+    "pushfd"                \
+    "pop    eax"            \
+    "push   ecx"            \
+    "popfd"                 \
+    "xor    eax, ecx"       \
+    value [eax]             \
+    modify exact [eax ecx];
+
+uint32_t profile_cpuid_features(void);
+#pragma aux profile_cpuid_features = \
+    "mov    eax, 1"         \
+    "db     0Fh, 0A2h"      \
+    value [edx]             \
+    modify exact [eax ebx ecx edx];
+
+uint32_t profile_read_tsc(void);
+#pragma aux profile_read_tsc = \
+    "db     0Fh, 31h"       \
+    value [eax]             \
+    modify exact [eax edx];
+#endif
+
+static bool              g_b_tsc             = false;
+static uint32_t          g_clock_in_hz       = I8253_CLOCK_SPEED_IN_HZ;
+static uint16_t          g_rate_in_hertz     = 0;
+static bool              g_b_pit_tick        = false;
+static uint32_t          g_bucket_limits[PROFILE_BUCKET_COUNT - 1U]; // clock units below which a tick lands in a bucket
+static uint32_t          g_start             = 0;   // clock reading at the start of the running tick
+static uint32_t          g_start_offset      = 0;   // stream offset at the start of the running tick
+static volatile uint32_t g_ticks             = 0;
+static volatile uint32_t g_buckets[PROFILE_BUCKET_COUNT];
+static volatile uint64_t g_total             = 0;   // clock units spent in ticks
+static volatile uint32_t g_worst             = 0;
+static volatile uint32_t g_worst_tick        = 0;
+static volatile uint32_t g_worst_offset      = 0;
+static bool              g_b_locked          = false;
+
+static void profile_lock_begin(void);
+static void profile_lock_end(void);
+
+static irq_lock_region_t const g_lock_regions[] =
+{
+    IRQ_LOCK_REGION(g_b_tsc),
+    IRQ_LOCK_REGION(g_b_pit_tick),
+    IRQ_LOCK_REGION(g_bucket_limits),
+    IRQ_LOCK_REGION(g_start),
+    IRQ_LOCK_REGION(g_start_offset),
+    IRQ_LOCK_REGION(g_ticks),
+    IRQ_LOCK_REGION(g_buckets),
+    IRQ_LOCK_REGION(g_total),
+    IRQ_LOCK_REGION(g_worst),
+    IRQ_LOCK_REGION(g_worst_tick),
+    IRQ_LOCK_REGION(g_worst_offset)
+};
+
+/*!
+ * @brief Start of the code reached at interrupt time (see irq_lock_code()).
+ */
+static void
+profile_lock_begin(void)
+{
+} /* profile_lock_begin() */
+
+/*!
+ * @brief Reads the profiling clock.
+ *
+ * @note Called with interrupts enabled (ticks run that way); the PIT latch and its two reads must not be split by
+ *       the timer interrupt, which latches the PIT too.
+ *
+ * @return Time stamp counter (low 32 bits) or PIT channel 0 count.
+ */
+static inline uint32_t
+profile_read_clock(void)
+{
+#if defined(PROFILE_TSC_SUPPORTED)
+    if (g_b_tsc)
+    {
+        return profile_read_tsc();
+    }
+#endif
+
+    _disable();
+    uint16_t const counter = i8253_read_counter();
+    _enable();
+
+    return counter;
+} /* profile_read_clock() */
+
+/*!
+ * @brief Marks the start of a tick.
+ */
+void
+profile_tick_begin(void)
+{
+    g_start_offset = zsm_get_stream_offset();
+    g_start        = profile_read_clock();
+} /* profile_tick_begin() */
+
+/*!
+ * @brief Marks the end of a tick and accounts for its cost.
+ *
+ * @param[in] pit_reload PIT count the timer last wrote (0 for 65536); used while the PIT drives the ticks.
+ */
+void
+profile_tick_end(uint16_t const pit_reload)
+{
+    uint32_t const end  = profile_read_clock();
+    uint32_t       cost = 0;
+
+    if (g_b_tsc)
+    {
+        cost = end - g_start;
+    }
+    else if (g_b_pit_tick)
+    {
+        uint16_t const pit_start = (uint16_t)g_start;
+        uint16_t const pit_end   = (uint16_t)end;
+
+        cost = (pit_end <= pit_start) ? (uint16_t)(pit_start - pit_end) : (uint16_t)(pit_start + pit_reload - pit_end);
+    }
+    else
+    {
+        cost = (uint16_t)((uint16_t)g_start - (uint16_t)end) >> 1U;
+    }
+
+    uint8_t bucket = 0;
+
+    while ((bucket < (PROFILE_BUCKET_COUNT - 1U)) && (cost >= g_bucket_limits[bucket]))
+    {
+        ++bucket;
+    }
+
+    ++g_buckets[bucket];
+    g_total += cost;
+
+    if (cost > g_worst)
+    {
+        g_worst        = cost;
+        g_worst_tick   = g_ticks;
+        g_worst_offset = g_start_offset;
+    }
+
+    ++g_ticks;
+} /* profile_tick_end() */
+
+/*!
+ * @brief End of the code reached at interrupt time.
+ */
+static void
+profile_lock_end(void)
+{
+} /* profile_lock_end() */
+
+/*!
+ * @brief Converts clock units to microseconds.
+ *
+ * @param[in] units Clock units.
+ *
+ * @return Microseconds.
+ */
+static uint32_t
+profile_units_to_microseconds(uint64_t const units)
+{
+    return (uint32_t)((units * PROFILE_MICROSECONDS_PER_SECOND) / g_clock_in_hz);
+} /* profile_units_to_microseconds() */
+
+/*!
+ * @brief Picks the profiling clock; on CPUs with a time stamp counter (32-bit build), calibrates it.
+ *
+ * @note Call once at startup with interrupts enabled; the calibration waits for the BIOS timer.
+ */
+void
+profile_initialize(void)
+{
+    if (g_b_locked == false)
+    {
+        irq_lock_module("profile", &profile_lock_begin, &profile_lock_end, g_lock_regions, IRQ_LOCK_REGION_COUNT(g_lock_regions));
+        g_b_locked = true;
+    }
+
+#if defined(PROFILE_TSC_SUPPORTED)
+    if (profile_toggle_id_flag() & PROFILE_CPUID_ID_FLAG)
+    {
+        if (profile_cpuid_features() & PROFILE_CPUID_FEATURE_TSC)
+        {
+            uint32_t bios_ticks = BIOS_TICK_COUNT;
+
+            while (BIOS_TICK_COUNT == bios_ticks)
+            {
+                // wait for the start of a BIOS tick
+            }
+
+            uint32_t const tsc_start = profile_read_tsc();
+
+            bios_ticks = BIOS_TICK_COUNT;
+
+            while ((uint32_t)(BIOS_TICK_COUNT - bios_ticks) < PROFILE_CALIBRATION_BIOS_TICKS)
+            {
+                // count cycles over whole BIOS ticks
+            }
+
+            uint64_t const cycles = profile_read_tsc() - tsc_start;
+
+            g_clock_in_hz = (uint32_t)((cycles * I8253_CLOCK_SPEED_IN_HZ) / (BIOS_TICK_PIT_CLOCKS * PROFILE_CALIBRATION_BIOS_TICKS));
+            g_b_tsc       = (g_clock_in_hz != 0);
+        }
+    }
+#endif
+
+    if (g_b_tsc == false)
+    {
+        g_clock_in_hz = I8253_CLOCK_SPEED_IN_HZ;
+    }
+} /* profile_initialize() */
+
+/*!
+ * @brief Clears the profile for a newly started timer.
+ *
+ * @note Called by timer_start() before its interrupt is installed.
+ *
+ * @param[in] rate_in_hertz The tick rate in Hertz.
+ * @param[in] b_pit_tick    The PIT drives the ticks.
+ */
+void
+profile_start(uint16_t const rate_in_hertz, bool const b_pit_tick)
+{
+    g_rate_in_hertz = rate_in_hertz;
+    g_b_pit_tick    = b_pit_tick;
+
+    for (uint8_t bucket = 0; bucket < (PROFILE_BUCKET_COUNT - 1U); ++bucket)
+    {
+        uint64_t const limit_in_microseconds = (uint64_t)PROFILE_BUCKET_FIRST_IN_US << bucket;
+
+        g_bucket_limits[bucket] = (uint32_t)((limit_in_microseconds * g_clock_in_hz) / PROFILE_MICROSECONDS_PER_SECOND);
+    }
+
+    for (uint8_t bucket = 0; bucket < PROFILE_BUCKET_COUNT; ++bucket)
+    {
+        g_buckets[bucket] = 0;
+    }
+
+    g_ticks        = 0;
+    g_total        = 0;
+    g_worst        = 0;
+    g_worst_tick   = 0;
+    g_worst_offset = 0;
+} /* profile_start() */
+
+/*!
+ * @brief Gets the profile collected since the timer started.
+ *
+ * @param[out] p_report Profile report.
+ */
+void
+profile_get_report(profile_report_t * const p_report)
+{
+    _disable();
+
+    uint32_t const ticks = g_ticks;
+    uint64_t const total = g_total;
+
+    for (uint8_t bucket = 0; bucket < PROFILE_BUCKET_COUNT; ++bucket)
+    {
+        p_report->buckets[bucket] = g_buckets[bucket];
+    }
+
+    p_report->worst_in_microseconds = g_worst;
+    p_report->worst_tick            = g_worst_tick;
+    p_report->worst_stream_offset   = g_worst_offset;
+
+    _enable();
+
+    p_report->ticks                 = ticks;
+    p_report->worst_in_microseconds = profile_units_to_microseconds(p_report->worst_in_microseconds);
+    p_report->mean_in_microseconds  = ticks ? profile_units_to_microseconds(total / ticks) : 0;
+    p_report->cpu_permille          = 0;
+    p_report->clock_in_hz           = g_clock_in_hz;
+    p_report->b_tsc                 = g_b_tsc;
+
+    if (ticks)
+    {
+        // spent / played = total / (ticks * clock / rate)
+        uint64_t const permille = (total * PROFILE_PERMILLE * g_rate_in_hertz) / ((uint64_t)ticks * g_clock_in_hz);
+
+        p_report->cpu_permille = (uint16_t)((permille > UINT16_MAX) ? UINT16_MAX : permille);
+    }
+} /* profile_get_report() */
+
+/*!
+ * @brief Prints the profile collected since the timer started.
+ *
+ * @param[in] p_file Stream to print to.
+ */
+void
+profile_print_report(FILE * const p_file)
+{
+    profile_report_t report;
+
+    profile_get_report(&report);
+
+    if (report.b_tsc)
+    {
+        fprintf(p_file, "Tick cost profile: %lu ticks timed with the time stamp counter (%lu MHz)\n",
+                (unsigned long)report.ticks, (unsigned long)(report.clock_in_hz / PROFILE_MICROSECONDS_PER_SECOND));
+    }
+    else
+    {
+        fprintf(p_file, "Tick cost profile: %lu ticks timed with the PIT (838 ns resolution)\n", (unsigned long)report.ticks);
+    }
+
+    fprintf(p_file, "Mean %lu us, worst %lu us (tick %lu, stream offset 0x%05lX), %u.%u%% of playback time\n",
+            (unsigned long)report.mean_in_microseconds, (unsigned long)report.worst_in_microseconds,
+            (unsigned long)report.worst_tick, (unsigned long)report.worst_stream_offset,
+            report.cpu_permille / 10U, report.cpu_permille % 10U);
+
+    for (uint8_t bucket = 0; bucket < PROFILE_BUCKET_COUNT; ++bucket)
+    {
+        unsigned long const bound    = (unsigned long)PROFILE_BUCKET_FIRST_IN_US << ((bucket < (PROFILE_BUCKET_COUNT - 1U)) ? bucket : (bucket - 1U));
+        unsigned long const permille = report.ticks ? (unsigned long)(((uint64_t)report.buckets[bucket] * PROFILE_PERMILLE) / report.ticks) : 0;
+
+        fprintf(p_file, "  %s %6lu us %10lu %3lu.%lu%%\n", (bucket < (PROFILE_BUCKET_COUNT - 1U)) ? "< " : ">=", bound,
+                (unsigned long)report.buckets[bucket], permille / 10U, permille % 10U);
+    }
+} /* profile_print_report() */
+
+/*** end of file ***/
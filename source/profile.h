@@ -0,0 +1,49 @@
+/** @file profile.h
+ *
+ * @brief Per-tick cost profiler for instrumented builds (PCZSM_PROFILE, built with profile=1).
+ *
+ * @par
+ * The timer brackets every run of the tick callback with profile_tick_begin() and profile_tick_end(). The cost of
+ * each tick is timed on PIT channel 0, or with the time stamp counter on Pentium class CPUs in the 32-bit build,
+ * and collected into a histogram together with the worst tick and the total time spent playing.
+ *
+ */
+
+#pragma once
+
+#define PROFILE_BUCKET_COUNT        (12U)  // histogram buckets
+#define PROFILE_BUCKET_FIRST_IN_US  (32U)  // upper bound of the first bucket; each further bucket doubles it
+
+typedef struct
+{
+    uint32_t ticks;
+    uint32_t buckets[PROFILE_BUCKET_COUNT];  // ticks per cost range; the last bucket holds everything above
+    uint32_t mean_in_microseconds;
+    uint32_t worst_in_microseconds;
+    uint32_t worst_tick;                     // tick number since the timer started
+    uint32_t worst_stream_offset;            // ZSM file offset the worst tick started decoding at
+    uint16_t cpu_permille;                   // share of the playback time spent in the tick callback
+    uint32_t clock_in_hz;                    // clock the ticks were timed with
+    bool     b_tsc;                          // timed with the time stamp counter
+} profile_report_t;
+
+//--------------------------------------------------------------------
+#ifdef __cplusplus
+extern "C" {
+#endif
+//--------------------------------------------------------------------
+
+void profile_initialize(void);
+void profile_start(uint16_t const rate_in_hertz, bool const b_pit_tick);
+void profile_tick_begin(void);
+void profile_tick_end(uint16_t const pit_reload);
+void profile_get_report(profile_report_t * const p_report);
+void profile_print_report(FILE * const p_file);
+
+//--------------------------------------------------------------------
+#ifdef __cplusplus
+}
+#endif
+//--------------------------------------------------------------------
+
+/*** end of file ***/
@@ -8,8 +8,11 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <malloc.h>
+#include "irq.h"
 #include "ram.h"
 
+#pragma off (check_stack) // bank lookups run inside zsm_update()
+
 #define RAM_DATA_DEBUG
 #undef RAM_DATA_DEBUG
 
@@ -27,9 +30,13 @@
 
     typedef uint16_t banksize_t;
 #else
+    #define RAM_BANK_MAX_BANKS   (1U)
+
     typedef uint32_t banksize_t;
 #endif
 
+#define RAM_LOCK_REGION_COUNT (RAM_BANK_MAX_BANKS + 3U) // banks, bank table, bank sizes and the handler
+
 typedef struct ram
 {
     uint8_t  ** pp_banks;
@@ -196,6 +203,14 @@ ram_free(ram_handle_t * const pp_ram_handle)
     }
 } /* ram_free() */
 
+/*!
+ * @brief Start of the code reached at interrupt time (see irq_lock_code()).
+ */
+static void
+ram_lock_begin(void)
+{
+} /* ram_lock_begin() */
+
 /*!
  * @brief Gets the RAM address and the specified absolute offset.
  * @param[in] p_ram_handle  The RAM bank handler.
@@ -340,4 +355,94 @@ ram_get_bank(ram_handle_t p_ram_handle, ram_bank_t * const p_ram_bank)
     p_ram_bank->p_current = p_start;
 } /* ram_get_bank() */
 
+/*!
+ * @brief Gets the absolute offset of a bank position.
+ *
+ * @param[in] p_ram_handle The RAM bank handler.
+ * @param[in] p_ram_bank   RAM bank information.
+ *
+ * @return Offset of the bank's current byte from the start of the data.
+ */
+uint32_t
+ram_get_offset(ram_handle_t p_ram_handle, ram_bank_t const * const p_ram_bank)
+{
+    ram_t const * const p_ram  = (ram_t const *)p_ram_handle;
+    uint32_t            offset = (uint32_t)(p_ram_bank->p_current - p_ram_bank->p_start);
+
+    for (uint8_t bank = 0; bank < p_ram_bank->bank; ++bank)
+    {
+        offset += p_ram->p_bank_sizes[bank];
+    }
+
+    return offset;
+} /* ram_get_offset() */
+
+/*!
+ * @brief Gets the memory held by the RAM banks.
+ *
+ * @param[in] p_ram_handle The RAM bank handler.
+ *
+ * @return Size of all banks in bytes.
+ */
+uint32_t
+ram_get_size(ram_handle_t p_ram_handle)
+{
+    ram_t const * const p_ram = (ram_t const *)p_ram_handle;
+    uint32_t            size  = 0;
+
+    for (uint8_t bank = 0; bank < p_ram->number_of_banks; ++bank)
+    {
+        size += p_ram->p_bank_sizes[bank];
+    }
+
+    return size;
+} /* ram_get_size() */
+
+/*!
+ * @brief End of the code reached at interrupt time.
+ */
+static void
+ram_lock_end(void)
+{
+} /* ram_lock_end() */
+
+/*!
+ * @brief Locks the RAM banks and the bank code so they can be read at interrupt time.
+ *
+ * @note Call after ram_load_file(); the banks stay locked after ram_free().
+ *
+ * @param[in] p_ram_handle The RAM bank handler.
+ *
+ * @return true if everything is locked, otherwise false.
+ */
+bool
+ram_lock(ram_handle_t p_ram_handle)
+{
+    ram_t const * const p_ram = (ram_t const *)p_ram_handle;
+
+    irq_lock_region_t regions[RAM_LOCK_REGION_COUNT];
+    uint8_t           count = 0;
+
+    regions[count].p_memory = p_ram;
+    regions[count].size     = sizeof(ram_t);
+    ++count;
+
+    regions[count].p_memory = p_ram->pp_banks;
+    regions[count].size     = sizeof(uint8_t *) * p_ram->number_of_banks;
+    ++count;
+
+    regions[count].p_memory = p_ram->p_bank_sizes;
+    regions[count].size     = sizeof(size_t) * p_ram->number_of_banks;
+    ++count;
+
+    for (uint8_t bank = 0; bank < p_ram->number_of_banks; ++bank)
+    {
+        regions[count].p_memory = p_ram->pp_banks[bank];
+        regions[count].size     = p_ram->p_bank_sizes[bank];
+        ++count;
+    }
+
+    return irq_lock_module("song", &ram_lock_begin, &ram_lock_end, regions, count);
+} /* ram_lock() */
+
 /*** end of file ***/
@@ -41,6 +41,9 @@ uint8_t     const * const ram_get_address(ram_handle_t const p_ram_handle, uint3
 void                      ram_seek_bank(ram_handle_t p_ram_handle, int32_t const offset, e_ram_seek_origin_t const seek_origin, ram_bank_t * const p_ram_bank);
 uint8_t                   ram_read_uint8(ram_handle_t p_ram_handle);
 void                      ram_get_bank(ram_handle_t p_ram_handle, ram_bank_t * const p_ram_bank);
+uint32_t                  ram_get_offset(ram_handle_t p_ram_handle, ram_bank_t const * const p_ram_bank);
+uint32_t                  ram_get_size(ram_handle_t p_ram_handle);
+bool                      ram_lock(ram_handle_t p_ram_handle);
 
 //--------------------------------------------------------------------
 #ifdef __cplusplus
@@ -9,12 +9,16 @@
  */
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <conio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "irq.h"
 #include "saa1099.h"
 #include "vera.h"
 
+#pragma off (check_stack) // called from the timer interrupt through zsm_update()
+
 #define FREQ_23_9_FIXED_POINT_SHIFT           (9U)
 #define FREQ_SAA1099_FREQUENCY_DIV_MAX_RANGE  (511U)
 #define FREQ_SAA1099_FREQUENCY_DIV_MAX_VALUE  (256U)
@@ -47,6 +51,10 @@
 #define SAA1099_MASK_OCTAVE_BITS                     (0x77U)
 #define SAA1099_MASK_OCTAVE_SELECT                   (0x07U)
 
+#define SAA1099_MASK_AMPLITUDE_NIBBLE                (0x0FU)
+#define SAA1099_AMPLITUDE_BOTH_NIBBLES               (0x11U)
+#define SAA1099_SHIFT_VOLUME                         (6U) // log2(SAA1099_VOLUME_MAX)
+
 #define SAA1099_MASK_PACKED_FREQUENCY_FREQUENCY      (0xFFU)
 #define SAA1099_MASK_PACKED_FREQUENCY_OCTAVE         (0x0700U)
 #define SAA1099_SHIFT_PACKED_FREQUENCY_OCTAVE        (8U)
@@ -69,7 +77,7 @@ static saa1099_verga_psg_range_t const g_saa1099_8mhz_vera_psg_range = { SAA1099
 static saa1099_verga_psg_range_t const g_saa1099_7mhz_vera_psg_range = { SAA1099_7MHZ_VERA_FREQ, SAA1099_7MHZ_VERA_FREQ_RANGE, SAA1099_7MHZ_VERA_MIN_FREQUENCY, SAA1099_7MHZ_VERA_MAX_FREQUENCY };
 static saa1099_verga_psg_range_t const * g_p_saa1099_vera_psg_range = &g_saa1099_8mhz_vera_psg_range;
 
-static uint8_t const g_vera_psg_volume_to_saa1099_volume[] =
+static uint8_t const g_vera_psg_volume_to_saa1099_volume_full[VERA_PSG_MAX_VOLUME_LEVELS] =
 { 
     0x00U, 0x00U, 0x00U, 0x00U, 0x00U, 0x00U, 0x00U, 0x00U, 0x00U, 0x00U, 0x00U, 0x00U, 0x00U, 0x00U, 0x00U, 0x00U,
     0x11U, 0x11U, 0x11U, 0x11U, 0x11U, 0x11U, 0x11U, 0x11U, 0x11U, 0x11U, 0x11U, 0x11U, 0x11U, 0x11U, 0x11U, 0x11U,
@@ -77,12 +85,32 @@ static uint8_t const g_vera_psg_volume_to_saa1099_volume[] =
     0x44U, 0x44U, 0x44U, 0x55U, 0x55U, 0x55U, 0x66U, 0x66U, 0x77U, 0x77U, 0x77U, 0x88U, 0x88U, 0x99U, 0x99U, 0xAAU
 };
 
+static uint8_t  g_vera_psg_volume_to_saa1099_volume[VERA_PSG_MAX_VOLUME_LEVELS]; // full scale table rescaled by master volume
 static uint16_t g_vera_psg_channel_frequency[SAA1099_VERA_PSG_CHANNELS];
 static uint8_t  g_vera_psg_channel_waveform[SAA1099_VERA_PSG_CHANNELS];
 static uint8_t g_cache[SAA1099_REGISTER_COUNT * SAA1099_MAX_CHIPS];
 static uint8_t const g_saa_amplitude_mask[4] = { 0x00U, 0x0FU, 0xF0U, 0xFFU };
 static uint16_t const * g_p_vera_psg_to_frequency_table = NULL;
 static uint16_t g_port_base_address = 0x210U;
+static bool     g_b_locked          = false;
+
+static void saa1099_lock_begin(void);
+static void saa1099_lock_end(void);
+
+static irq_lock_region_t const g_lock_regions[] =
+{
+    IRQ_LOCK_REGION(g_saa1099_8mhz_vera_psg_range),
+    IRQ_LOCK_REGION(g_saa1099_7mhz_vera_psg_range),
+    IRQ_LOCK_REGION(g_p_saa1099_vera_psg_range),
+    IRQ_LOCK_REGION(g_vera_psg_volume_to_saa1099_volume_full),
+    IRQ_LOCK_REGION(g_vera_psg_volume_to_saa1099_volume),
+    IRQ_LOCK_REGION(g_vera_psg_channel_frequency),
+    IRQ_LOCK_REGION(g_vera_psg_channel_waveform),
+    IRQ_LOCK_REGION(g_cache),
+    IRQ_LOCK_REGION(g_saa_amplitude_mask),
+    IRQ_LOCK_REGION(g_p_vera_psg_to_frequency_table),
+    IRQ_LOCK_REGION(g_port_base_address)
+};
 
 // Adapted from: http://www.hackersdelight.org/hdcodetxt/nlz.c.txt
 static uint16_t const
@@ -209,6 +237,14 @@ saa1099_generate_vera_psg_frequency_table(saa1099_verga_psg_range_t const * cons
     return p_vera_psg_to_frequency_table;
 }
 
+/*!
+ * @brief Start of the code reached at interrupt time (see irq_lock_code()).
+ */
+static void
+saa1099_lock_begin(void)
+{
+} /* saa1099_lock_begin() */
+
 /*!
  * @brief Writes data to specified SAA1099 address.
  *
@@ -290,6 +326,12 @@ saa1099_clear(void)
 void
 saa1099_vera_psg_initialize(uint16_t const port_base_address, e_saa1099_clock_t const clock)
 {
+    if (g_b_locked == false)
+    {
+        irq_lock_module("SAA1099", &saa1099_lock_begin, &saa1099_lock_end, g_lock_regions, IRQ_LOCK_REGION_COUNT(g_lock_regions));
+        g_b_locked = true;
+    }
+
     switch (clock)
     {
         case SAA1099_CLOCK_7159090_HZ:
@@ -311,10 +353,16 @@ saa1099_vera_psg_initialize(uint16_t const port_base_address, e_saa1099_clock_t
 
         if (g_p_vera_psg_to_frequency_table != NULL)
         {
+            irq_lock_region_t const table_region = { g_p_vera_psg_to_frequency_table, sizeof(uint16_t) * g_p_saa1099_vera_psg_range->range };
+
+            irq_lock_module("SAA1099", NULL, NULL, &table_region, 1);
+
             g_port_base_address = port_base_address;
 
             saa1099_clear();
 
+            saa1099_vera_psg_set_volume(SAA1099_VOLUME_MAX);
+
             memset(g_vera_psg_channel_frequency, 0, sizeof(g_vera_psg_channel_frequency));
             memset(g_vera_psg_channel_waveform, 0, sizeof(g_vera_psg_channel_waveform));
 
@@ -328,6 +376,24 @@ saa1099_vera_psg_initialize(uint16_t const port_base_address, e_saa1099_clock_t
     }
 } /* saa1099_vera_psg_initialize() */
 
+/*!
+ * @brief Rebuilds the VERA PSG to SAA1099 volume table for a master volume.
+ *
+ * @note Only affects subsequent volume writes; the caller rewrites active volume registers.
+ *
+ * @param[in] volume Master volume (0 to SAA1099_VOLUME_MAX).
+ */
+void
+saa1099_vera_psg_set_volume(uint8_t const volume)
+{
+    for (uint8_t index = 0; index < VERA_PSG_MAX_VOLUME_LEVELS; ++index)
+    {
+        uint8_t const amplitude = ((g_vera_psg_volume_to_saa1099_volume_full[index] & SAA1099_MASK_AMPLITUDE_NIBBLE) * volume) >> SAA1099_SHIFT_VOLUME;
+
+        g_vera_psg_volume_to_saa1099_volume[index] = amplitude * SAA1099_AMPLITUDE_BOTH_NIBBLES;
+    }
+} /* saa1099_vera_psg_set_volume() */
+
 /*!
  * @brief Silences SAA1099s and clears internal states.
  */
@@ -350,8 +416,8 @@ void saa1099_vera_psg_terminate(void)
  * @param[in] address VERA PSG address.
  * @param[in] data    VERA PSG data.
  */
-void
-saa1099_vera_psg_write(uint8_t const address, uint8_t const data)
+static inline void
+saa1099_vera_psg_translate(uint8_t const address, uint8_t const data)
 {
     uint8_t const vera_psg_channel = VERA_PSG_ADDRESS_TO_CHANNEL(address);
 
@@ -417,6 +483,45 @@ saa1099_vera_psg_write(uint8_t const address, uint8_t const data)
                 break;
         }
     }
+} /* saa1099_vera_psg_translate() */
+
+/*!
+ * @brief Translates VERA PSG writes to SAA1099.
+ * 
+ * @note Currently only handles VERA PSG channels 0 through 11.
+ * 
+ * @param[in] address VERA PSG address.
+ * @param[in] data    VERA PSG data.
+ */
+void
+saa1099_vera_psg_write(uint8_t const address, uint8_t const data)
+{
+    saa1099_vera_psg_translate(address, data);
 } /* saa1099_vera_psg_write() */
 
+/*!
+ * @brief Translates a burst of VERA PSG writes to SAA1099.
+ *
+ * @param[in] p_pairs VERA PSG address/data pairs (address first).
+ * @param[in] count   Number of pairs.
+ */
+void
+saa1099_vera_psg_write_burst(uint8_t const * const p_pairs, uint8_t const count)
+{
+    uint8_t const * p_pair = p_pairs;
+
+    for (uint8_t pair = 0; pair < count; ++pair, p_pair += 2)
+    {
+        saa1099_vera_psg_translate(p_pair[0], p_pair[1]);
+    }
+} /* saa1099_vera_psg_write_burst() */
+
+/*!
+ * @brief End of the code reached at interrupt time.
+ */
+static void
+saa1099_lock_end(void)
+{
+} /* saa1099_lock_end() */
+
 /*** end of file ***/
@@ -18,6 +18,8 @@ typedef enum
     SAA1099_CLOCK_INVALID     = -1
 } e_saa1099_clock_t;
 
+#define SAA1099_VOLUME_MAX (64U)
+
 //--------------------------------------------------------------------
 #ifdef __cplusplus
 extern "C" {
@@ -27,6 +29,8 @@ extern "C" {
 void saa1099_vera_psg_initialize(uint16_t const port_base_address, e_saa1099_clock_t const clock);
 void saa1099_vera_psg_terminate(void);
 void saa1099_vera_psg_write(uint8_t const address, uint8_t const data);
+void saa1099_vera_psg_write_burst(uint8_t const * const p_pairs, uint8_t const count);
+void saa1099_vera_psg_set_volume(uint8_t const volume);
 
 //--------------------------------------------------------------------
 #ifdef __cplusplus
@@ -6,6 +6,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <conio.h>
 #include <i86.h>
@@ -13,92 +14,32 @@
 #include "ym2151.h"
 #include "saa1099.h"
 #include "saaym.h"
-#include "timer.h"
 #include "irq.h"
+#include "i8253.h"
 #include "i8259a.h"
 
-#define SAAYM_BASE_IO_START  (0x200U)
-#define SAAYM_BASE_IO_END    (0x270U)
-#define SAAYM_BASE_IO_OFFSET (0x10U)
+#if defined(_M_I86)
+    #pragma code_seg("saaym_TRANSIENT_TEXT", "TRANSIENT") // not kept by the resident player (see tsr.c)
+#endif
 
-typedef enum
-{
-    YM_TIMER_STATE_START,
-    YM_TIMER_STATE_WAIT_OVERFLOW,
-    YM_TIMER_STATE_OVERFLOWED
-} ym_timer_state_t;
+#define SAAYM_BASE_IO_START                 (0x200U)
+#define SAAYM_BASE_IO_END                   (0x270U)
+#define SAAYM_BASE_IO_OFFSET                (0x10U)
+#define SAAYM_CACHE_LINE_SIZE               (32U)
 
-typedef struct
-{
-    ym_timer_state_t ym_timer_state;
-    uint32_t         counter;
-    uint32_t         ticks;
-    uint32_t         count_at_overflow;
-    e_ym2151_clock_t ym2151_clock;
-    uint8_t          interrupt_number;
-} saaym_detect_ym2151_clock_t;
+#define SAAYM_CLOCK_TIMER_A_PERIOD          (56U)       // Timer A counts per overflow (~1 ms), long enough to poll on an 8088
+#define SAAYM_CLOCK_OVERFLOWS               (4U)        // overflows timed; ~4 ms, within half a BIOS tick
+#define SAAYM_CLOCK_POLL_LIMIT              (4096U)     // status reads (4 ms or more of ISA reads) before Timer A is given up on
+#define SAAYM_CLOCK_4000000_THRESHOLD_IN_HZ (3789772UL) // half way between 3.579545 MHz and 4 MHz
+#define SAAYM_IRQ_2_REQUESTS                ((1U << 2) | (1U << (8 + 1))) // IRQ 2, or IRQ 9 of the slave PIC on an AT
 
-static saaym_detect_ym2151_clock_t volatile g_saaym_detect_ym2151_clock;
+static uint8_t g_saaym_detect_interrupt_number = 0;
 
 static inline int saaym_clamp_value(int const min_value, int const value, int const max_value)
 {
     return (value < min_value ? min_value : (value > max_value ? max_value : value));
 }
 
-static void
-saaym_stopwatch_handler(void)
-{
-    switch (g_saaym_detect_ym2151_clock.ym_timer_state)
-    {
-        case YM_TIMER_STATE_START:
-            {
-                g_saaym_detect_ym2151_clock.counter        = 0;
-                g_saaym_detect_ym2151_clock.ym_timer_state = YM_TIMER_STATE_WAIT_OVERFLOW;
-
-                ym2151_enable_timer_b(true);
-            }
-            break;
-
-        case YM_TIMER_STATE_WAIT_OVERFLOW:
-            {
-                ++g_saaym_detect_ym2151_clock.counter; // increment
-            }
-            break;
-
-        default:
-            // Does nothing
-            break;
-    }
-    ++g_saaym_detect_ym2151_clock.ticks;
-}
-
-static void IRQ_FAR_INTERRUPT
-saaym_ym2151_timer_handler(void)
-{
-    switch (g_saaym_detect_ym2151_clock.ym_timer_state)
-    {
-        case YM_TIMER_STATE_WAIT_OVERFLOW:
-            {
-                g_saaym_detect_ym2151_clock.ym_timer_state    = YM_TIMER_STATE_OVERFLOWED;
-                g_saaym_detect_ym2151_clock.count_at_overflow = g_saaym_detect_ym2151_clock.counter;
-
-                ym2151_enable_timer_b(false);
-            }
-            break;
-
-        default:
-            // Does nothing
-            break;
-    }
-
-    outp(PIC1_COMMAND, PIC_EOI);
-
-    if (g_saaym_detect_ym2151_clock.interrupt_number == INT10H_IRQ2)
-    {
-        outp(PIC2_COMMAND, PIC_EOI);
-    }
-}
-
 /*!
  * @brief Generic detection routine for TexElec SAAYM or Creative Music System/Gameblaster base address at the specified base address.
  *
@@ -175,7 +116,7 @@ saaym_detect_base_io_port(uint16_t const base_io_port)
 {
     if (saaym_detect_game_blaster_generic(base_io_port, 0x08, 0x0C))
     {
-        ym2151_initialize(base_io_port + SAAYM_PORT_OFFSET_YM2151, YM2151_CLOCK_INVALID);
+        ym2151_select_port(base_io_port + SAAYM_PORT_OFFSET_YM2151); // the player resets the chip once it is set up
 
         return saaym_detect_ym2151();
     }
@@ -201,53 +142,170 @@ saaym_detect_irq(void)
     ym2151_enable_timer_b(false);
 
     // 2. Find the IRQ number (if any)
-    g_saaym_detect_ym2151_clock.interrupt_number = irq_sense();
+    g_saaym_detect_interrupt_number = irq_sense();
+
+    irq_uninstall_detect_handlers();
+} /* saaym_detect_irq() */
+
+/*!
+ * @brief Polls the YM2151 status until Timer A overflows, then clears the overflow flag.
+ *
+ * @retval true Timer A overflowed.
+ * @retval false Timer A did not overflow within SAAYM_CLOCK_POLL_LIMIT status reads.
+ */
+static bool
+saaym_wait_timer_a_overflow(void)
+{
+    for (uint16_t poll = 0; poll != SAAYM_CLOCK_POLL_LIMIT; ++poll)
+    {
+        if (ym2151_read_status() & YM2151_STATUS_TIMER_A_FLAG)
+        {
+            ym2151_enable_timer_a(true); // clear the flag; Timer A keeps running
+
+            return true;
+        }
+    }
+
+    return false;
+} /* saaym_wait_timer_a_overflow() */
+
+/*!
+ * @brief Measures the YM2151's master clock against the PIT.
+ *
+ * @note Timer A runs free with interrupts disabled while its overflow flag is polled. PIT channel 0 is latched at one
+ *       overflow and again SAAYM_CLOCK_OVERFLOWS overflows later, so the latency of starting the timer drops out
+ *       and each reading is good to one PIT clock (838 ns). Takes about 5 ms. PIT channel 0
+ *       is reprogrammed to the BIOS square wave (mode 3, count decremented by 2 per clock) first, as the YM2151
+ *       timer handlers expect it, whatever mode a previous program left it in.
+ *
+ * @return The master clock in Hertz, or 0 if Timer A did not run.
+ */
+static uint32_t
+saaym_measure_ym2151_clock(void)
+{
+    uint16_t const timer_a_counts = SAAYM_CLOCK_TIMER_A_PERIOD * SAAYM_CLOCK_OVERFLOWS;
+
+    ym2151_write(YM2151_ADDRESS_TIMER, (YM2151_RESET_TIMER_B | YM2151_RESET_TIMER_A)); // stop both timers
+    ym2151_set_timer_a_period(SAAYM_CLOCK_TIMER_A_PERIOD);
+
+    _disable();
+
+    outp(I8253_CONTROL_WORD_PORT, I8253_COUNTER_0 | I8253_ACCESS_MODE_LATCH_LOHI_BYTE | I8253_MODE_3 | I8253_BCD_0);
+    outp(I8253_COUNTER_0_DATA_PORT, 0);
+    outp(I8253_COUNTER_0_DATA_PORT, 0);
+
+    ym2151_enable_timer_a(true);
+
+    bool           b_overflowed = saaym_wait_timer_a_overflow();
+    uint16_t const pit_start    = i8253_read_counter();
+
+    for (uint8_t overflow = 0; b_overflowed && (overflow < SAAYM_CLOCK_OVERFLOWS); ++overflow)
+    {
+        b_overflowed = saaym_wait_timer_a_overflow();
+    }
+
+    uint16_t const pit_clocks = (uint16_t)(pit_start - i8253_read_counter()) >> 1U; // counts down by 2; wraps at most once
 
-    // 3. Attempt to ascertain the speed of the YM2151's master clock.
-    if (g_saaym_detect_ym2151_clock.interrupt_number != 0)
+    ym2151_enable_timer_a(false);
+
+    _enable();
+
+    if ((b_overflowed == false) || (pit_clocks == 0))
     {
-        _disable();
-        _dos_setvect(g_saaym_detect_ym2151_clock.interrupt_number, &saaym_ym2151_timer_handler);
-        _enable();
+        return 0;
+    }
+
+    // master clocks = timer_a_counts * YM2151_TIMER_A_CLOCK_DIVIDER; kept apart so the product fits 32 bits.
+    uint32_t const pit_product = (uint32_t)I8253_CLOCK_SPEED_IN_HZ * timer_a_counts;
+    uint32_t const quotient    = pit_product / pit_clocks;
+    uint32_t const remainder   = pit_product % pit_clocks;
+
+    return (quotient * YM2151_TIMER_A_CLOCK_DIVIDER) + ((remainder * YM2151_TIMER_A_CLOCK_DIVIDER) / pit_clocks);
+} /* saaym_measure_ym2151_clock() */
+
+/*!
+ * @brief Reads the interrupt request registers of both PICs.
+ *
+ * @return Master PIC requests in the low byte, slave PIC requests in the high byte.
+ */
+static uint16_t
+saaym_read_irq_requests(void)
+{
+    outp(PIC1_COMMAND, PIC_OCW3_READ_IRR);
+    outp(PIC2_COMMAND, PIC_OCW3_READ_IRR);
+
+    uint8_t const master = inp(PIC1_COMMAND);
+    uint8_t const slave  = inp(PIC2_COMMAND);
 
-        ym2151_set_timer_b(0x00U); // set Timer B overflow to be at ~73.23 ms (at 3.579545 MHz) or 65.536 ms (at 4 MHz).
+    return ((uint16_t)slave << 8U) | master;
+} /* saaym_read_irq_requests() */
 
-        timer_start(0, 1000U, &saaym_stopwatch_handler); // stopwatch_handler will start Timer B
+/*!
+ * @brief Finds the IRQ the YM2151 timer raises without installing interrupt handlers.
+ *
+ * @note With interrupts disabled, Timer A overflows once (~1 ms) and the PIC request registers are compared
+ *       before and after; the request stays pending until the overflow flag is reset. Much quicker than
+ *       saaym_detect_irq(), which waits for Timer B and for spurious interrupts.
+ *
+ * @return The IRQ number (2, 3, 5 or 7), or 0 if none was raised.
+ */
+static uint8_t
+saaym_sense_irq_quick(void)
+{
+    ym2151_write(YM2151_ADDRESS_TIMER, (YM2151_RESET_TIMER_B | YM2151_RESET_TIMER_A)); // stop both timers
+    ym2151_set_timer_a_period(SAAYM_CLOCK_TIMER_A_PERIOD);
+
+    _disable();
 
-        //delay(1000); // wait 1000 ms for Timer B to overflow
+    uint16_t const idle = saaym_read_irq_requests(); // an XT has no slave PIC; its bus reads stay the same
 
-        while (g_saaym_detect_ym2151_clock.ticks < 1000U && g_saaym_detect_ym2151_clock.ym_timer_state != YM_TIMER_STATE_OVERFLOWED)
+    ym2151_enable_timer_a(true);
+
+    for (uint16_t poll = 0; poll != SAAYM_CLOCK_POLL_LIMIT; ++poll)
+    {
+        if (ym2151_read_status() & YM2151_STATUS_TIMER_A_FLAG)
         {
-            // Wait for 1000 ms to pass and YM2151 timer not yet overflowed
+            break;
         }
+    }
 
-        timer_stop();
+    uint16_t const raised = saaym_read_irq_requests() & ~idle;
 
-#ifdef PCZSM_DEBUG
-        printf("Timer State[%02d] | Counter[%lu] | Overflow[%lu]\n", g_saaym_detect_ym2151_clock.ym_timer_state, g_saaym_detect_ym2151_clock.counter, g_saaym_detect_ym2151_clock.count_at_overflow);
-#endif
+    ym2151_enable_timer_a(false); // resets the flag, which drops the request
+
+    _enable();
+
+    if (raised & SAAYM_IRQ_2_REQUESTS)
+    {
+        return 2;
     }
 
-    irq_uninstall_detect_handlers();
+    for (uint8_t irq_number = 3; irq_number <= 7; irq_number += 2)
+    {
+        if (raised & (1U << irq_number))
+        {
+            return irq_number;
+        }
+    }
 
-    g_saaym_detect_ym2151_clock.ym2151_clock = g_saaym_detect_ym2151_clock.count_at_overflow < 68 ? YM2151_CLOCK_4000000_HZ : YM2151_CLOCK_3579545_HZ;
-} /* saaym_detect_irq() */
+    return 0;
+} /* saaym_sense_irq_quick() */
 
 /*!
- * @brief Gets the SAAYM configuration from the SAAYM environment variable.
+ * @brief Parses SAAYM settings in the SAAYM environment variable format (e.g. "A220 I5 Y0 S0").
  * 
- * @return saaym configuration (if environment variable exists)
+ * @param[in] p_settings Settings text (NULL for none).
+ *
+ * @return saaym configuration (base_io_port is 0 if no address was given)
  */
 static saaym_config_t
-saaym_get_config_from_environment(void)
+saaym_parse_config(char const * const p_settings)
 {
-    saaym_config_t config = { YM2151_CLOCK_INVALID, SAA1099_CLOCK_INVALID, 0, 0 };
-
-    char const * const p_saaym_var = getenv("SAAYM");
+    saaym_config_t config = { YM2151_CLOCK_INVALID, SAA1099_CLOCK_INVALID, 0, 0, 0 };
 
-    if (p_saaym_var)
+    if (p_settings)
     {
-        char const * p_token = p_saaym_var;
+        char const * p_token = p_settings;
         while (*p_token)
         {
             char const parameter = *p_token++;
@@ -270,6 +328,10 @@ saaym_get_config_from_environment(void)
                     config.saa1099_clock = (e_saa1099_clock_t)saaym_clamp_value(SAA1099_CLOCK_FIRST_VALID, atoi(p_token), SAA1099_CLOCK_LAST_VALID);
                     break;
 
+                case 'c':
+                    config.ym2151_clock_in_hz = strtoul(p_token, NULL, 10);
+                    break;
+
                 default:
                     break;
             }
@@ -277,7 +339,71 @@ saaym_get_config_from_environment(void)
     }
 
     return config;
-}
+} /* saaym_parse_config() */
+
+/*!
+ * @brief Gets the SAAYM configuration from the SAAYM environment variable.
+ * 
+ * @return saaym configuration (if environment variable exists)
+ */
+static saaym_config_t
+saaym_get_config_from_environment(void)
+{
+    return saaym_parse_config(getenv("SAAYM"));
+} /* saaym_get_config_from_environment() */
+
+/*!
+ * @brief Reads a configuration saved by saaym_save_config().
+ * 
+ * @param[in] p_file_name Cache file name.
+ *
+ * @return saaym configuration (base_io_port is 0 if the file is missing or unusable)
+ */
+static saaym_config_t
+saaym_load_config(char const * const p_file_name)
+{
+    char   settings[SAAYM_CACHE_LINE_SIZE] = { 0 };
+    FILE * p_file                          = fopen(p_file_name, "rt");
+
+    if (p_file)
+    {
+        if (fgets(settings, sizeof(settings), p_file) == NULL)
+        {
+            settings[0] = '\0';
+        }
+
+        fclose(p_file);
+    }
+
+    saaym_config_t config = saaym_parse_config(settings);
+
+    if ((config.ym2151_clock == YM2151_CLOCK_INVALID) || (config.saa1099_clock == SAA1099_CLOCK_INVALID) ||
+        (config.ym2151_clock_in_hz == 0))
+    {
+        config.base_io_port = 0; // not written by saaym_save_config()
+    }
+
+    return config;
+} /* saaym_load_config() */
+
+/*!
+ * @brief Saves a detected configuration in the SAAYM environment variable format.
+ * 
+ * @param[in] p_file_name Cache file name.
+ * @param[in] p_config    Detected saaym configuration.
+ */
+static void
+saaym_save_config(char const * const p_file_name, saaym_config_t const * const p_config)
+{
+    FILE * const p_file = fopen(p_file_name, "wt");
+
+    if (p_file)
+    {
+        fprintf(p_file, "A%X I%u Y%d S%d C%lu\n", p_config->base_io_port, p_config->irq_number, p_config->ym2151_clock,
+                p_config->saa1099_clock, (unsigned long)p_config->ym2151_clock_in_hz);
+        fclose(p_file);
+    }
+} /* saaym_save_config() */
 
 /*!
  * @brief Detected whether the SAAYM exists.
@@ -311,10 +437,16 @@ saaym_detect(bool const b_detect_irq)
                 {
                     saaym_detect_irq();
 
-                    if (g_saaym_detect_ym2151_clock.interrupt_number)
+                    if (g_saaym_detect_interrupt_number)
+                    {
+                        config.irq_number = g_saaym_detect_interrupt_number - INT08H_IRQ0;
+                    }
+
+                    config.ym2151_clock_in_hz = saaym_measure_ym2151_clock();
+
+                    if (config.ym2151_clock_in_hz >= SAAYM_CLOCK_4000000_THRESHOLD_IN_HZ)
                     {
-                        config.irq_number   = g_saaym_detect_ym2151_clock.interrupt_number ? g_saaym_detect_ym2151_clock.interrupt_number - INT08H_IRQ0 : 0;
-                        config.ym2151_clock = g_saaym_detect_ym2151_clock.ym2151_clock;
+                        config.ym2151_clock = YM2151_CLOCK_4000000_HZ;
                     }
                 }
 
@@ -326,4 +458,57 @@ saaym_detect(bool const b_detect_irq)
     return config; // No TexElect SAAYM found!
 } /* saaym_detect() */
 
+/*!
+ * @brief Detects the SAAYM like saaym_detect(), reusing the result of an earlier detection when possible.
+ * 
+ * @note Full detection takes over a second (address scan, IRQ sensing and YM2151 clock timing). A cached
+ *       configuration is only confirmed with one probe at its address and a quick check of its IRQ; the measured
+ *       YM2151 clock is taken from the cache. If the card is not found there or raises another IRQ, detection
+ *       runs in full and the cache is rewritten. The SAAYM environment variable still takes precedence.
+ *
+ * @param[in] b_detect_irq      If true, attempts to detect the IRQ the SAAYM is installed at.  Otherwise, false.
+ * @param[in] p_cache_file_name File holding the cached configuration (NULL for none).
+ *
+ * @return saaym configuration.
+ */
+saaym_config_t
+saaym_detect_cached(bool const b_detect_irq, char const * const p_cache_file_name)
+{
+    if ((p_cache_file_name == NULL) || getenv("SAAYM"))
+    {
+        return saaym_detect(b_detect_irq);
+    }
+
+    saaym_config_t config = saaym_load_config(p_cache_file_name);
+
+    if (config.base_io_port && saaym_detect_base_io_port(config.base_io_port))
+    {
+        if (b_detect_irq == false)
+        {
+            config.irq_number = 0;
+
+            return config;
+        }
+
+        if (saaym_sense_irq_quick() == config.irq_number)
+        {
+            return config;
+        }
+        // The IRQ jumper changed (or the quick check does not work on this machine); detect in full.
+    }
+
+    config = saaym_detect(b_detect_irq);
+
+    if (config.base_io_port == 0)
+    {
+        remove(p_cache_file_name);
+    }
+    else if (b_detect_irq)
+    {
+        saaym_save_config(p_cache_file_name, &config); // only complete detections are cached
+    }
+
+    return config;
+} /* saaym_detect_cached() */
+
 /*** end of file ***/
@@ -9,6 +9,7 @@
 //--------------------------------------------------------------------
 
 #define SAAYM_PORT_OFFSET_YM2151 (0x0EU)
+#define SAAYM_CACHE_FILE_NAME    "SAAYM.CFG" // detection cache, kept next to the program
 
 typedef struct
 {
@@ -16,6 +17,7 @@ typedef struct
     e_saa1099_clock_t saa1099_clock;
     uint16_t          base_io_port;
     uint8_t           irq_number;
+    uint32_t          ym2151_clock_in_hz; // measured master clock (0 if not measured)
 } saaym_config_t;
 
 //--------------------------------------------------------------------
@@ -33,6 +35,16 @@ extern "C" {
  */
 saaym_config_t saaym_detect(bool const b_detect_irq);
 
+/*!
+ * @brief Detect the SAAYM, confirming a cached configuration with a single probe instead of a full detection.
+ * 
+ * @param[in] b_detect_irq      detect IRQ
+ * @param[in] p_cache_file_name cache file (NULL to always detect)
+ *
+ * @return The saaym_config_t structure.  If the SAAYM exists, base_io_port will be a non-zero value.
+ */
+saaym_config_t saaym_detect_cached(bool const b_detect_irq, char const * const p_cache_file_name);
+
 //--------------------------------------------------------------------
 #ifdef __cplusplus
 }
@@ -0,0 +1,412 @@
+/** @file status.c
+ *
+ * @brief Playback status screen written straight to text mode video memory.
+ *
+ * @par
+ * The screen is composed in a memory copy and compared with what was last written to video memory; only the
+ * cells that changed are written. On CGA each write waits for the horizontal retrace so the display does not
+ * snow. Runs in the 80 column text modes (2, 3 and 7) only.
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <conio.h>
+#include <i86.h>
+#include "ram.h"
+#include "zsm.h"
+#include "status.h"
+
+#if defined(_M_I86)
+    #pragma code_seg("status_TRANSIENT_TEXT", "TRANSIENT") // not kept by the resident player (see tsr.c)
+#endif
+
+#define STATUS_COLUMNS          (80U)
+#define STATUS_ROWS             (25U)
+#define STATUS_CELLS            (STATUS_COLUMNS * STATUS_ROWS)
+#define STATUS_SEGMENT_COLOR    (0xB800U)
+#define STATUS_SEGMENT_MONO     (0xB000U)
+#define STATUS_MODE_BW80        (2U)
+#define STATUS_MODE_CO80        (3U)
+#define STATUS_MODE_MONO        (7U)
+#define STATUS_INT10H           (0x10U)
+#define STATUS_CURSOR_HIDDEN    (0x2000U)      // cursor start line with the "invisible" bit
+#define STATUS_CGA_STATUS_PORT  (0x3DAU)
+#define STATUS_CGA_RETRACE      (0x01U)        // horizontal (or vertical) retrace; video memory is free
+#define STATUS_BLANK            (0x0720U)      // space, light grey on black
+#define STATUS_ATTR_TEXT        (0x07U)
+#define STATUS_ATTR_BRIGHT      (0x0FU)
+#define STATUS_ATTR_TITLE       (0x70U)
+#define STATUS_ATTR_FM          (0x0AU)
+#define STATUS_ATTR_PSG         (0x0BU)
+#define STATUS_ATTR_MUTED       (0x04U)
+#define STATUS_ATTR_DIM_COLOR   (0x08U)
+#define STATUS_CHAR_LIT         (0xDBU)        // full block
+#define STATUS_CHAR_UNLIT       (0xFAU)        // middle dot
+#define STATUS_METER_WIDTH      (32U)
+#define STATUS_LEFT_COLUMN      (1U)
+#define STATUS_RIGHT_COLUMN     (41U)
+#define STATUS_ROW_POSITION     (2U)
+#define STATUS_ROW_VOLUME       (3U)
+#define STATUS_ROW_CHIPS        (5U)
+#define STATUS_ROW_CHANNELS     (6U)
+#define STATUS_ROW_HELP         (STATUS_ROWS - 1U)
+#define STATUS_TEXT_SIZE        (STATUS_COLUMNS + 1U)
+#define STATUS_SECONDS_PER_MIN  (60U)
+
+#if defined(__386__)
+    typedef uint16_t volatile * status_video_t;
+
+    #define STATUS_BIOS_VIDEO_MODE       (*(uint8_t volatile *)0x0449UL)  // flat model: low memory at its linear address
+    #define STATUS_BIOS_VIDEO_COLUMNS    (*(uint16_t volatile *)0x044AUL)
+    #define STATUS_VIDEO_MEMORY(segment) ((status_video_t)((uint32_t)(segment) << 4U))
+#else
+    typedef uint16_t volatile __far * status_video_t;
+
+    #define STATUS_BIOS_VIDEO_MODE       (*(uint8_t volatile __far *)MK_FP(0x0040U, 0x0049U))
+    #define STATUS_BIOS_VIDEO_COLUMNS    (*(uint16_t volatile __far *)MK_FP(0x0040U, 0x004AU))
+    #define STATUS_VIDEO_MEMORY(segment) ((status_video_t)MK_FP((segment), 0))
+#endif
+
+static uint16_t       g_screen[STATUS_CELLS];  // screen being composed
+static uint16_t       g_shown[STATUS_CELLS];   // what video memory holds
+static status_video_t g_p_video         = NULL;
+static bool           g_b_active        = false;
+static bool           g_b_snow          = false; // CGA: write during retrace only
+static uint8_t        g_attr_dim        = STATUS_ATTR_DIM_COLOR;
+static uint16_t       g_cursor_shape    = 0;
+static volatile bool  g_b_update_due    = false;
+
+/*!
+ * @brief Checks for a CGA, the adapter that snows when video memory is written during the display.
+ *
+ * @return true if neither a VGA/MCGA nor an EGA answers, otherwise false.
+ */
+static bool
+status_is_cga(void)
+{
+    union REGPACK regs;
+
+    memset(&regs, 0, sizeof(union REGPACK));
+    regs.w.ax = 0x1A00U; // read display combination (VGA/MCGA)
+
+    intr(STATUS_INT10H, &regs);
+
+    if (regs.h.al == 0x1AU)
+    {
+        return false;
+    }
+
+    memset(&regs, 0, sizeof(union REGPACK));
+    regs.h.ah = 0x12U;   // alternate select: EGA information
+    regs.h.bl = 0x10U;
+
+    intr(STATUS_INT10H, &regs);
+
+    return (regs.h.bl == 0x10U);
+} /* status_is_cga() */
+
+/*!
+ * @brief Sets the text mode cursor shape.
+ *
+ * @param[in] shape Start line (high byte) and end line (low byte).
+ */
+static void
+status_set_cursor_shape(uint16_t const shape)
+{
+    union REGPACK regs;
+
+    memset(&regs, 0, sizeof(union REGPACK));
+    regs.h.ah = 0x01U;
+    regs.w.cx = shape;
+
+    intr(STATUS_INT10H, &regs);
+} /* status_set_cursor_shape() */
+
+/*!
+ * @brief Writes one cell to video memory.
+ *
+ * @param[in] cell  Cell index (row * STATUS_COLUMNS + column).
+ * @param[in] value Character (low byte) and attribute (high byte).
+ */
+static void
+status_write_cell(uint16_t const cell, uint16_t const value)
+{
+    if (g_b_snow)
+    {
+        _disable();
+
+        while (inp(STATUS_CGA_STATUS_PORT) & STATUS_CGA_RETRACE)
+        {
+            // wait for the display period, so the write starts at the beginning of a retrace
+        }
+
+        while ((inp(STATUS_CGA_STATUS_PORT) & STATUS_CGA_RETRACE) == 0)
+        {
+            // wait for the retrace
+        }
+
+        g_p_video[cell] = value;
+
+        _enable();
+    }
+    else
+    {
+        g_p_video[cell] = value;
+    }
+} /* status_write_cell() */
+
+/*!
+ * @brief Writes the cells that changed since the last flush to video memory.
+ */
+static void
+status_flush(void)
+{
+    for (uint16_t cell = 0; cell < STATUS_CELLS; ++cell)
+    {
+        if (g_screen[cell] != g_shown[cell])
+        {
+            g_shown[cell] = g_screen[cell];
+
+            status_write_cell(cell, g_screen[cell]);
+        }
+    }
+} /* status_flush() */
+
+/*!
+ * @brief Puts text on the composed screen, padded with spaces to a width.
+ *
+ * @param[in] row       Row.
+ * @param[in] column    First column.
+ * @param[in] width     Cells to fill (text beyond is cut off).
+ * @param[in] attribute Text attribute.
+ * @param[in] p_text    Text.
+ */
+static void
+status_put_text(uint8_t const row, uint8_t const column, uint8_t const width, uint8_t const attribute, char const * p_text)
+{
+    uint16_t * p_cell = &g_screen[(row * STATUS_COLUMNS) + column];
+
+    for (uint8_t index = 0; (index < width) && ((column + index) < STATUS_COLUMNS); ++index)
+    {
+        uint8_t const character = *p_text ? (uint8_t)*p_text++ : ' ';
+
+        *p_cell++ = ((uint16_t)attribute << 8U) | character;
+    }
+} /* status_put_text() */
+
+/*!
+ * @brief Puts a channel's number, mute mark and activity meter on the composed screen.
+ *
+ * @param[in] row       Row.
+ * @param[in] column    First column.
+ * @param[in] channel   Channel number shown (from 1).
+ * @param[in] level     Channel level (0 to ZSM_CHANNEL_LEVEL_MAX).
+ * @param[in] attribute Attribute of the lit meter cells.
+ * @param[in] b_muted   The channel is muted.
+ */
+static void
+status_put_meter(uint8_t const row, uint8_t const column, uint8_t const channel, uint8_t const level, uint8_t const attribute, bool const b_muted)
+{
+    char text[STATUS_TEXT_SIZE];
+
+    sprintf(text, "%2u%c", channel, b_muted ? 'M' : ' ');
+    status_put_text(row, column, 4U, b_muted ? STATUS_ATTR_MUTED : STATUS_ATTR_TEXT, text);
+
+    uint8_t    const lit    = (uint8_t)(((uint16_t)level * STATUS_METER_WIDTH + ZSM_CHANNEL_LEVEL_MAX - 1U) / ZSM_CHANNEL_LEVEL_MAX);
+    uint16_t * const p_cell = &g_screen[(row * STATUS_COLUMNS) + column + 4U];
+
+    for (uint8_t index = 0; index < STATUS_METER_WIDTH; ++index)
+    {
+        p_cell[index] = (index < lit) ? (((uint16_t)(b_muted ? STATUS_ATTR_MUTED : attribute) << 8U) | STATUS_CHAR_LIT) :
+                                        (((uint16_t)g_attr_dim << 8U) | STATUS_CHAR_UNLIT);
+    }
+} /* status_put_meter() */
+
+/*!
+ * @brief Formats a tick count as minutes and seconds.
+ *
+ * @param[out] p_text    Text (at least 12 characters).
+ * @param[in]  ticks     Tick count.
+ * @param[in]  tick_rate Ticks per second.
+ */
+static void
+status_format_time(char * const p_text, uint32_t const ticks, uint16_t const tick_rate)
+{
+    uint32_t const seconds = tick_rate ? (ticks / tick_rate) : 0;
+
+    sprintf(p_text, "%02lu:%02lu", (unsigned long)(seconds / STATUS_SECONDS_PER_MIN), (unsigned long)(seconds % STATUS_SECONDS_PER_MIN));
+} /* status_format_time() */
+
+/*!
+ * @brief Takes over the screen for the status display.
+ *
+ * @note The screen is cleared and the cursor hidden. Fails (leaving the screen alone) outside the 80 column text
+ *       modes.
+ *
+ * @return true if the status screen is shown, otherwise false.
+ */
+bool
+status_initialize(void)
+{
+    uint8_t const mode = STATUS_BIOS_VIDEO_MODE & 0x7FU;
+
+    if (((mode != STATUS_MODE_BW80) && (mode != STATUS_MODE_CO80) && (mode != STATUS_MODE_MONO)) || (STATUS_BIOS_VIDEO_COLUMNS != STATUS_COLUMNS))
+    {
+        return false;
+    }
+
+    bool const b_mono = (mode == STATUS_MODE_MONO);
+
+    g_p_video  = STATUS_VIDEO_MEMORY(b_mono ? STATUS_SEGMENT_MONO : STATUS_SEGMENT_COLOR);
+    g_b_snow   = (b_mono == false) && status_is_cga();
+    g_attr_dim = b_mono ? STATUS_ATTR_TEXT : STATUS_ATTR_DIM_COLOR; // MDA shows dark grey as black
+
+    union REGPACK regs;
+
+    memset(&regs, 0, sizeof(union REGPACK));
+    regs.h.ah = 0x03U; // read cursor position and shape (page 0)
+
+    intr(STATUS_INT10H, &regs);
+
+    g_cursor_shape = regs.w.cx;
+    status_set_cursor_shape(STATUS_CURSOR_HIDDEN);
+
+    for (uint16_t cell = 0; cell < STATUS_CELLS; ++cell)
+    {
+        g_screen[cell] = STATUS_BLANK;
+        g_shown[cell]  = 0; // forces every cell out on the first flush
+    }
+
+    status_flush();
+
+    g_b_update_due = true;
+    g_b_active     = true;
+
+    return true;
+} /* status_initialize() */
+
+/*!
+ * @brief Hands the screen back, leaving the last status on it and the cursor on the bottom line.
+ */
+void
+status_terminate(void)
+{
+    if (g_b_active)
+    {
+        g_b_active = false;
+
+        status_put_text(STATUS_ROW_HELP, 0, STATUS_COLUMNS, STATUS_ATTR_TEXT, "");
+        status_flush();
+
+        union REGPACK regs;
+
+        memset(&regs, 0, sizeof(union REGPACK));
+        regs.h.ah = 0x02U; // set cursor position (page 0)
+        regs.h.dh = STATUS_ROW_HELP;
+        regs.h.dl = 0;
+
+        intr(STATUS_INT10H, &regs);
+
+        status_set_cursor_shape(g_cursor_shape);
+    }
+} /* status_terminate() */
+
+/*!
+ * @brief Asks for the status to be redrawn; use as a TIMER_PRIORITY_DEFERRED timer callback at STATUS_UPDATE_HZ.
+ */
+void
+status_request_update(void)
+{
+    g_b_update_due = true;
+} /* status_request_update() */
+
+/*!
+ * @brief Checks if the status is due to be redrawn.
+ *
+ * @return true if status_draw() should be called, otherwise false.
+ */
+bool
+status_is_update_due(void)
+{
+    return g_b_active && g_b_update_due;
+} /* status_is_update_due() */
+
+/*!
+ * @brief Redraws the status screen, writing only the cells that changed.
+ *
+ * @param[in] p_info Playback status.
+ */
+void
+status_draw(status_info_t const * const p_info)
+{
+    if (g_b_active == false)
+    {
+        return;
+    }
+
+    g_b_update_due = false;
+
+    char text[STATUS_TEXT_SIZE];
+    char position[12];
+    char length[12];
+
+    status_put_text(0, 0, 8U, STATUS_ATTR_TITLE, " PCZSM");
+    status_put_text(0, 8U, STATUS_COLUMNS - 16U, STATUS_ATTR_TITLE, p_info->p_file_name); // long paths are cut off
+    status_put_text(0, STATUS_COLUMNS - 8U, 8U, STATUS_ATTR_TITLE, p_info->b_paused ? "PAUSED  " : "");
+
+    uint32_t position_ticks = p_info->position_ticks;
+
+    if ((position_ticks >= p_info->length_ticks) && (p_info->loop_tick < p_info->length_ticks))
+    {
+        position_ticks = p_info->loop_tick + ((position_ticks - p_info->loop_tick) % (p_info->length_ticks - p_info->loop_tick));
+    }
+
+    status_format_time(position, position_ticks, p_info->tick_rate);
+
+    if (p_info->length_ticks)
+    {
+        status_format_time(length, p_info->length_ticks, p_info->tick_rate);
+    }
+    else
+    {
+        strcpy(length, "--:--");
+    }
+
+    sprintf(text, "Position  %s / %s", position, length);
+    status_put_text(STATUS_ROW_POSITION, STATUS_LEFT_COLUMN, STATUS_RIGHT_COLUMN - STATUS_LEFT_COLUMN, STATUS_ATTR_BRIGHT, text);
+
+    sprintf(text, "Timer     %s @ %uHz", p_info->p_timer_name, p_info->tick_rate);
+    status_put_text(STATUS_ROW_POSITION, STATUS_RIGHT_COLUMN, STATUS_COLUMNS - STATUS_RIGHT_COLUMN, STATUS_ATTR_TEXT, text);
+
+    sprintf(text, "Volume    %u", p_info->volume);
+    status_put_text(STATUS_ROW_VOLUME, STATUS_LEFT_COLUMN, STATUS_RIGHT_COLUMN - STATUS_LEFT_COLUMN, STATUS_ATTR_TEXT, text);
+
+    sprintf(text, "ISR load  %u.%u%%   Late ticks %lu", p_info->load_permille / 10U, p_info->load_permille % 10U, (unsigned long)p_info->late_ticks);
+    status_put_text(STATUS_ROW_VOLUME, STATUS_RIGHT_COLUMN, STATUS_COLUMNS - STATUS_RIGHT_COLUMN, STATUS_ATTR_TEXT, text);
+
+    status_put_text(STATUS_ROW_CHIPS, STATUS_LEFT_COLUMN, 8U, STATUS_ATTR_BRIGHT, "FM");
+    status_put_text(STATUS_ROW_CHIPS, STATUS_RIGHT_COLUMN, 8U, STATUS_ATTR_BRIGHT, "PSG");
+
+    for (uint8_t channel = 0; channel < ZSM_YM2151_CHANNEL_COUNT; ++channel)
+    {
+        status_put_meter(STATUS_ROW_CHANNELS + channel, STATUS_LEFT_COLUMN, channel + 1U, p_info->fm_levels[channel], STATUS_ATTR_FM,
+                         (p_info->fm_mutes & (1U << channel)) != 0);
+    }
+
+    for (uint8_t channel = 0; channel < ZSM_VERA_PSG_CHANNEL_COUNT; ++channel)
+    {
+        status_put_meter(STATUS_ROW_CHANNELS + channel, STATUS_RIGHT_COLUMN, channel + 1U, p_info->psg_levels[channel], STATUS_ATTR_PSG,
+                         (p_info->psg_mutes & (1U << channel)) != 0);
+    }
+
+    status_put_text(STATUS_ROW_HELP, 0, STATUS_COLUMNS, STATUS_ATTR_TEXT,
+                    " -/+ Volume  P Pause  ESC Fade/Stop  1-8 F1-F10 Mute  Alt Solo  0 Unmute");
+
+    status_flush();
+} /* status_draw() */
+
+/*** end of file ***/
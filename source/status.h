@@ -0,0 +1,47 @@
+/** @file status.h
+ *
+ * @brief Playback status screen written straight to text mode video memory.
+ *
+ */
+
+#pragma once
+
+#define STATUS_UPDATE_HZ (10U) // redraw rate while playing
+
+typedef struct
+{
+    char const * p_file_name;
+    char const * p_timer_name;
+    uint16_t     tick_rate;
+    uint32_t     position_ticks;                          // ticks played since the start, loops included
+    uint32_t     length_ticks;                            // 0 if unknown
+    uint32_t     loop_tick;                               // tick the loop restarts at (length_ticks without a loop)
+    uint8_t      volume;
+    uint16_t     load_permille;                           // share of the time spent in the timer interrupt
+    uint32_t     late_ticks;
+    uint8_t      fm_mutes;
+    uint16_t     psg_mutes;
+    uint8_t      fm_levels[ZSM_YM2151_CHANNEL_COUNT];     // 0 to ZSM_CHANNEL_LEVEL_MAX
+    uint8_t      psg_levels[ZSM_VERA_PSG_CHANNEL_COUNT];
+    bool         b_paused;
+} status_info_t;
+
+//--------------------------------------------------------------------
+#ifdef __cplusplus
+extern "C" {
+#endif
+//--------------------------------------------------------------------
+
+bool status_initialize(void);
+void status_terminate(void);
+void status_request_update(void);
+bool status_is_update_due(void);
+void status_draw(status_info_t const * const p_info);
+
+//--------------------------------------------------------------------
+#ifdef __cplusplus
+}
+#endif
+//--------------------------------------------------------------------
+
+/*** end of file ***/
@@ -0,0 +1,164 @@
+/** @file telemetry.c
+ *
+ * @brief Per-tick playback records passed from the interrupt to the main loop.
+ *
+ * @par
+ * A single producer/single consumer ring: only the interrupt (telemetry_publish()) writes the head and only the
+ * main loop (telemetry_read()) writes the tail. Both are 16-bit words, which the 8086 reads and writes in one
+ * instruction, so neither side ever disables interrupts. The indices run free and are masked on access; the ring
+ * size divides 65536 so the difference of the two is the fill level even across the wrap.
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "irq.h"
+#include "telemetry.h"
+
+#pragma off (check_stack) // published from the timer interrupt
+
+#define TELEMETRY_RING_SIZE (64U) // power of two; about a second of ticks at 60 Hz
+#define TELEMETRY_RING_MASK (TELEMETRY_RING_SIZE - 1U)
+
+static volatile telemetry_record_t g_ring[TELEMETRY_RING_SIZE];
+static volatile uint16_t           g_ring_head  = 0; // written by the interrupt only
+static volatile uint16_t           g_ring_tail  = 0; // written by the main loop only
+static volatile uint16_t           g_dropped    = 0; // records lost to a full ring (written by the interrupt only)
+static uint8_t                     g_tick_flags = 0; // raised for the next record (interrupt only)
+static bool                        g_b_locked   = false;
+
+static void telemetry_lock_begin(void);
+static void telemetry_lock_end(void);
+
+static irq_lock_region_t const g_lock_regions[] =
+{
+    IRQ_LOCK_REGION(g_ring),
+    IRQ_LOCK_REGION(g_ring_head),
+    IRQ_LOCK_REGION(g_ring_tail),
+    IRQ_LOCK_REGION(g_dropped),
+    IRQ_LOCK_REGION(g_tick_flags)
+};
+
+/*!
+ * @brief Start of the code reached at interrupt time (see irq_lock_code()).
+ */
+static void
+telemetry_lock_begin(void)
+{
+} /* telemetry_lock_begin() */
+
+/*!
+ * @brief Raises flags for the next published record.
+ *
+ * @note Interrupt time only (the timer raises them before running a tick).
+ *
+ * @param[in] flags TELEMETRY_FLAG_* to add.
+ */
+void
+telemetry_raise_flags(uint8_t const flags)
+{
+    g_tick_flags |= flags;
+} /* telemetry_raise_flags() */
+
+/*!
+ * @brief Publishes the record of a tick.
+ *
+ * @note Interrupt time only. The record is complete before the head moves, so the main loop never sees a partial
+ *       record. A full ring drops the record and counts it.
+ *
+ * @param[in] tick    Playback tick number.
+ * @param[in] writes  Register writes issued during the tick.
+ * @param[in] key_ons Key on events during the tick.
+ * @param[in] flags   TELEMETRY_FLAG_* seen by the caller; raised flags are added and cleared.
+ */
+void
+telemetry_publish(uint16_t const tick, uint16_t const writes, uint8_t const key_ons, uint8_t const flags)
+{
+    uint16_t const head = g_ring_head;
+
+    if ((uint16_t)(head - g_ring_tail) >= TELEMETRY_RING_SIZE)
+    {
+        ++g_dropped;
+        return;
+    }
+
+    volatile telemetry_record_t * const p_record = &g_ring[head & TELEMETRY_RING_MASK];
+
+    p_record->tick    = tick;
+    p_record->writes  = writes;
+    p_record->key_ons = key_ons;
+    p_record->flags   = flags | g_tick_flags;
+
+    g_tick_flags = 0;
+    g_ring_head  = head + 1U;
+} /* telemetry_publish() */
+
+/*!
+ * @brief End of the code reached at interrupt time.
+ */
+static void
+telemetry_lock_end(void)
+{
+} /* telemetry_lock_end() */
+
+/*!
+ * @brief Empties the ring; call while no records are being published.
+ */
+void
+telemetry_reset(void)
+{
+    if (g_b_locked == false)
+    {
+        irq_lock_module("telemetry", &telemetry_lock_begin, &telemetry_lock_end, g_lock_regions, IRQ_LOCK_REGION_COUNT(g_lock_regions));
+        g_b_locked = true;
+    }
+
+    g_ring_tail  = g_ring_head;
+    g_dropped    = 0;
+    g_tick_flags = 0;
+} /* telemetry_reset() */
+
+/*!
+ * @brief Takes the oldest record from the ring.
+ *
+ * @note Main loop only.
+ *
+ * @param[out] p_record The record.
+ *
+ * @return true if a record was taken, otherwise false (ring empty).
+ */
+bool
+telemetry_read(telemetry_record_t * const p_record)
+{
+    uint16_t const tail = g_ring_tail;
+
+    if (tail == g_ring_head)
+    {
+        return false;
+    }
+
+    volatile telemetry_record_t const * const p_source = &g_ring[tail & TELEMETRY_RING_MASK];
+
+    p_record->tick    = p_source->tick;
+    p_record->writes  = p_source->writes;
+    p_record->key_ons = p_source->key_ons;
+    p_record->flags   = p_source->flags;
+
+    g_ring_tail = tail + 1U; // hands the slot back to the interrupt
+
+    return true;
+} /* telemetry_read() */
+
+/*!
+ * @brief Gets the number of records dropped because the main loop fell behind.
+ *
+ * @return Dropped records since telemetry_reset().
+ */
+uint16_t
+telemetry_get_dropped(void)
+{
+    return g_dropped;
+} /* telemetry_get_dropped() */
+
+/*** end of file ***/
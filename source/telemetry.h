@@ -0,0 +1,40 @@
+/** @file telemetry.h
+ *
+ * @brief Per-tick playback records passed from the interrupt to the main loop.
+ *
+ */
+
+#pragma once
+
+#define TELEMETRY_FLAG_SHEDDING (0x01U) // writes were deferred to keep the tick inside its write budget
+#define TELEMETRY_FLAG_CATCH_UP (0x02U) // tick ran as one of several ticks per interrupt (decimated)
+#define TELEMETRY_FLAG_LATE     (0x04U) // tick ran for an interrupt that arrived while the handler was busy
+#define TELEMETRY_FLAG_OVERRUN  (0x08U) // the previous interrupt ran past the time of its ticks
+
+typedef struct
+{
+    uint16_t tick;    // playback tick number (wraps)
+    uint16_t writes;  // register writes issued during the tick
+    uint8_t  key_ons; // YM2151 key on events decoded during the tick
+    uint8_t  flags;   // TELEMETRY_FLAG_*
+} telemetry_record_t;
+
+//--------------------------------------------------------------------
+#ifdef __cplusplus
+extern "C" {
+#endif
+//--------------------------------------------------------------------
+
+void     telemetry_reset(void);
+void     telemetry_raise_flags(uint8_t const flags);
+void     telemetry_publish(uint16_t const tick, uint16_t const writes, uint8_t const key_ons, uint8_t const flags);
+bool     telemetry_read(telemetry_record_t * const p_record);
+uint16_t telemetry_get_dropped(void);
+
+//--------------------------------------------------------------------
+#ifdef __cplusplus
+}
+#endif
+//--------------------------------------------------------------------
+
+/*** end of file ***/
@@ -10,90 +10,1023 @@
 #include <dos.h>
 #include <conio.h>
 #include <i86.h>
-#include "timer.h"
 #include "irq.h"
+#include "timer.h"
 #include "i8253.h"
+#include "bios.h"
 #include "i8259a.h"
 #include "ym2151.h"
+#include "telemetry.h"
+
+#pragma off (check_stack) // the handlers run on the interrupted stack or on a private one (see timer_set_stack())
+
+#if defined(PCZSM_PROFILE)
+    #include <stdio.h>
+    #include "profile.h"
+#endif
+
+#define MILLIHERTZ_PER_HERTZ  (1000U)
+#define AVERAGE_UNITS_LIMIT   (0x80000000UL) // halve the average accounting before it overflows
+#define AUTO_TIMER_A_HZ       (100U)         // above this Timer B's 1024 clock steps exceed ~3% of the period
+#define SLOT_TICK_SHIFT       (16U)          // slot deadlines are in 16.16 fixed point ticks
+#define SLOT_TICK_ONE         (1UL << SLOT_TICK_SHIFT)
+#define SLOT_LIST_END         (0xFFU)
+#define MAX_TICKS_PER_IRQ     (8U)           // deepest decimation
+#define LOAD_WINDOW           (64U)          // interrupts between decimation step-down checks
+#define CALIBRATE_BATCHES     (8U)
+#define CALIBRATE_BATCH_CALLS (8U)           // calls timed per PIT reading (keeps a batch well inside one PIT cycle)
+#define PIT_CLOCKS_PER_MS     (1193U)
+#define MICROSECONDS_PER_MS   (1000U)
+#define LATENCY_BUCKET_COUNT  (256U)
+#define LATENCY_BUCKET_CLOCKS (19U)           // PIT clocks per latency histogram bucket (~16 us)
+#define LATENCY_PERCENTILE    (99U)
+#define LATENCY_WINDOW        (64U)           // YM2151 estimates between re-baselines and clock ratio updates
+#define SQUARE_WAVE_HALF      (0x8000UL)      // PIT clocks per half of the BIOS square wave (mode 3, count 0)
+#define LATENCY_UNIT_SHIFT    (12U)           // PIT clocks per YM2151 period unit are in 20.12 fixed point
+
+typedef struct
+{
+    uint16_t base;        // whole period units per tick
+    uint32_t remainder;   // fractional units per tick, in 1/denominator
+    uint32_t denominator;
+    uint32_t error;       // accumulated fractional units
+    uint16_t written;     // period last programmed into the hardware
+} timer_period_t;
 
-#define INTERRUPT_FIXED_POINT (8U)
-#define FIXED_POINT_ONE       (1U << INTERRUPT_FIXED_POINT)
-#define FIXED_POINT_PRECISION (1000U)
-#define FIXED_POINT_INV_18_2  (14065U) // fixed point representation of 1000.0f/18.2f; 1000 is multiplied to get more precision
+typedef struct
+{
+    timer_callback_t p_callback;
+    uint32_t         interval;      // ticks between calls (16.16)
+    uint32_t         deadline;      // tick of the next call (16.16)
+    uint16_t         rate_in_hertz;
+    uint8_t          priority;
+    uint8_t          next;          // next slot in deadline order
+    volatile bool    b_pending;     // deferred call waiting for timer_service_deferred()
+} timer_slot_t;
 
 static interrupt_handler_t g_p_old_interrupt_handler = NULL;
 static timer_callback_t    g_p_timer_callback        = NULL;
 static uint8_t             g_interrupt_number        = 0;
+static irq_stack_t *       g_p_stack                 = NULL; // private stack for the handlers (see timer_set_stack())
 
-static volatile uint32_t g_interrupt_counter = 0;
-static volatile uint32_t g_interrupt_total   = 0;
-static volatile bool     g_timer_b_stop_requested    = false;
-static volatile bool     g_timer_b_stop_acknowledged = false;
+static volatile uint32_t g_bios_clocks              = 0; // PIT clocks not yet passed on to the BIOS handler
+static volatile bool     g_ym2151_stop_requested    = false;
+static volatile bool     g_ym2151_stop_acknowledged = false;
 
-static void IRQ_FAR_INTERRUPT
-timer_irq_0_handler(void)
+static e_timer_ym2151_t  g_ym2151_timer_selected = TIMER_YM2151_AUTO;
+static e_timer_ym2151_t  g_ym2151_timer          = TIMER_YM2151_TIMER_B; // timer driving the IRQ
+static uint8_t           g_ym2151_status_flag    = YM2151_STATUS_TIMER_B_FLAG;
+static void           (* g_p_ym2151_set_period)(uint16_t const period) = &ym2151_set_timer_b_period;
+static void           (* g_p_ym2151_enable)(bool const b_enable)      = &ym2151_enable_timer_b;
+
+static timer_period_t    g_period            = { 0 };
+static uint32_t          g_unit_clock_in_hz  = 0;
+static uint16_t          g_unit_divider      = 1;
+static volatile uint32_t g_average_ticks     = 0;             // ticks run since the BIOS tick count g_average_start
+static volatile uint32_t g_average_start     = 0;
+static volatile bool     g_b_average_synced  = false;         // counting from a BIOS tick edge
+
+static timer_slot_t      g_slots[TIMER_SLOT_COUNT];
+static uint8_t           g_slot_head         = SLOT_LIST_END; // earliest deadline first
+static uint32_t          g_slot_now          = 0;
+static uint16_t          g_slot_base_rate    = 0;             // tick rate of the running timer
+
+static uint16_t          g_period_rate       = 0;
+static uint16_t          g_period_max        = 0;
+static uint8_t           g_ticks_per_irq     = 1;             // decimation: ticks processed per interrupt
+static uint8_t           g_max_ticks_per_irq = 1;
+static uint16_t          g_tick_pit_clocks   = 0;             // PIT clocks per tick (load budget)
+static uint32_t          g_load_peak         = 0;             // longest handler run in the window, PIT clocks
+static uint8_t           g_load_irqs         = 0;
+static volatile bool     g_b_in_handler      = false;
+static volatile bool     g_b_reentered       = false;
+static volatile uint8_t  g_irqs_pending      = 0;             // interrupts that arrived while the handler was running
+
+static bool              g_b_priority_selected = false;         // rank the YM2151 IRQ highest on the master PIC
+static bool              g_b_priority_raised   = false;
+static volatile bool     g_b_jitter_reset_requested = true;
+static bool              g_b_jitter_primed     = false;
+static uint16_t          g_jitter_last         = 0;             // PIT count at the previous handler entry
+static uint32_t          g_jitter_min          = 0;             // shortest / longest interval between entries, PIT clocks
+static uint32_t          g_jitter_max          = 0;
+static uint32_t          g_cost_clocks         = 0;             // handler run time since timer_start(), PIT clocks
+static uint32_t          g_cost_ticks          = 0;             // ticks run in that time
+static timer_overrun_stats_t g_overrun_stats = { 0 };
+static bool              g_b_locked            = false;
+
+static volatile bool     g_b_latency_enabled      = false;
+static uint32_t          g_latency_buckets[LATENCY_BUCKET_COUNT]; // tick start latency histogram
+static uint32_t          g_latency_samples        = 0;
+static uint64_t          g_latency_clocks         = 0;       // sum of the latencies, PIT clocks
+static uint32_t          g_latency_max            = 0;
+static uint32_t          g_latency_reentries      = 0;       // re-entries counted at the previous YM2151 estimate
+static uint8_t           g_latency_history        = 0;       // consecutive YM2151 handlers without deferred interrupts
+static uint16_t          g_latency_entry_last     = 0;       // PIT count at the previous YM2151 handler entry
+static uint16_t          g_latency_units[2]       = { 0 };   // periods programmed by the previous two handlers
+static uint32_t          g_latency_estimate       = 0;       // overflow to handler entry delay, PIT clocks (20.12)
+static uint32_t          g_latency_window_min     = 0;
+static uint8_t           g_latency_window_count   = 0;
+static uint32_t          g_latency_unit_clocks    = 0;       // PIT clocks per YM2151 period unit (20.12)
+static bool              g_b_latency_calibrated   = false;   // the unit clocks were learned over one window
+static uint32_t          g_latency_sum_intervals  = 0;       // measured entry intervals, PIT clocks
+static uint32_t          g_latency_sum_units      = 0;       // programmed periods over the same intervals
+
+static void timer_lock_begin(void);
+static void timer_lock_end(void);
+
+static irq_lock_region_t const g_lock_regions[] =
+{
+    IRQ_LOCK_REGION(g_p_old_interrupt_handler),
+    IRQ_LOCK_REGION(g_p_timer_callback),
+    IRQ_LOCK_REGION(g_interrupt_number),
+    IRQ_LOCK_REGION(g_p_stack),
+    IRQ_LOCK_REGION(g_bios_clocks),
+    IRQ_LOCK_REGION(g_ym2151_stop_requested),
+    IRQ_LOCK_REGION(g_ym2151_stop_acknowledged),
+    IRQ_LOCK_REGION(g_ym2151_status_flag),
+    IRQ_LOCK_REGION(g_p_ym2151_set_period),
+    IRQ_LOCK_REGION(g_p_ym2151_enable),
+    IRQ_LOCK_REGION(g_period),
+    IRQ_LOCK_REGION(g_unit_clock_in_hz),
+    IRQ_LOCK_REGION(g_unit_divider),
+    IRQ_LOCK_REGION(g_average_ticks),
+    IRQ_LOCK_REGION(g_average_start),
+    IRQ_LOCK_REGION(g_b_average_synced),
+    IRQ_LOCK_REGION(g_slots),
+    IRQ_LOCK_REGION(g_slot_head),
+    IRQ_LOCK_REGION(g_slot_now),
+    IRQ_LOCK_REGION(g_period_rate),
+    IRQ_LOCK_REGION(g_period_max),
+    IRQ_LOCK_REGION(g_ticks_per_irq),
+    IRQ_LOCK_REGION(g_max_ticks_per_irq),
+    IRQ_LOCK_REGION(g_tick_pit_clocks),
+    IRQ_LOCK_REGION(g_load_peak),
+    IRQ_LOCK_REGION(g_load_irqs),
+    IRQ_LOCK_REGION(g_b_in_handler),
+    IRQ_LOCK_REGION(g_b_reentered),
+    IRQ_LOCK_REGION(g_irqs_pending),
+    IRQ_LOCK_REGION(g_b_jitter_reset_requested),
+    IRQ_LOCK_REGION(g_b_jitter_primed),
+    IRQ_LOCK_REGION(g_jitter_last),
+    IRQ_LOCK_REGION(g_jitter_min),
+    IRQ_LOCK_REGION(g_jitter_max),
+    IRQ_LOCK_REGION(g_cost_clocks),
+    IRQ_LOCK_REGION(g_cost_ticks),
+    IRQ_LOCK_REGION(g_overrun_stats),
+    IRQ_LOCK_REGION(g_b_latency_enabled),
+    IRQ_LOCK_REGION(g_latency_buckets),
+    IRQ_LOCK_REGION(g_latency_samples),
+    IRQ_LOCK_REGION(g_latency_clocks),
+    IRQ_LOCK_REGION(g_latency_max),
+    IRQ_LOCK_REGION(g_latency_reentries),
+    IRQ_LOCK_REGION(g_latency_history),
+    IRQ_LOCK_REGION(g_latency_entry_last),
+    IRQ_LOCK_REGION(g_latency_units),
+    IRQ_LOCK_REGION(g_latency_estimate),
+    IRQ_LOCK_REGION(g_latency_window_min),
+    IRQ_LOCK_REGION(g_latency_window_count),
+    IRQ_LOCK_REGION(g_latency_unit_clocks),
+    IRQ_LOCK_REGION(g_b_latency_calibrated),
+    IRQ_LOCK_REGION(g_latency_sum_intervals),
+    IRQ_LOCK_REGION(g_latency_sum_units)
+};
+
+/*!
+ * @brief Start of the code reached at interrupt time (see irq_lock_code()).
+ */
+static void
+timer_lock_begin(void)
+{
+} /* timer_lock_begin() */
+
+/*!
+ * @brief Computes the period of one interrupt (g_ticks_per_irq ticks) from the timer set up by timer_period_setup().
+ */
+static void
+timer_period_compute(void)
 {
-    if (g_p_timer_callback)
+    uint32_t const numerator   = g_unit_clock_in_hz * g_ticks_per_irq;
+    uint32_t const denominator = (uint32_t)g_period_rate * g_unit_divider;
+    uint32_t const base        = numerator / denominator;
+
+    g_period.denominator = denominator;
+    g_period.error       = 0;
+
+    if (base >= g_period_max)
+    {
+        g_period.base      = g_period_max; // too slow for the timer; run at its slowest rate
+        g_period.remainder = 0;
+    }
+    else if (base == 0)
     {
+        g_period.base      = 1;            // too fast for the timer; run at its fastest rate
+        g_period.remainder = 0;
+    }
+    else
+    {
+        g_period.base      = (uint16_t)base;
+        g_period.remainder = numerator % denominator;
+    }
+} /* timer_period_compute() */
+
+/*!
+ * @brief Sets up a tick period of clock_in_hz / (rate_in_hertz * clock_divider) units of clock_divider clocks.
+ *
+ * @note Also sets how far the interrupt rate may be decimated: up to MAX_TICKS_PER_IRQ ticks per interrupt,
+ *       as long as the longer period still fits the timer.
+ *
+ * @param[in] clock_in_hz   Clock driving the timer.
+ * @param[in] clock_divider Clocks per period unit.
+ * @param[in] rate_in_hertz The tick rate in Hertz.
+ * @param[in] max_period    Longest period (in units) the timer supports.
+ */
+static void
+timer_period_setup(uint32_t const clock_in_hz, uint16_t const clock_divider, uint16_t const rate_in_hertz, uint16_t const max_period)
+{
+    uint32_t const max_ticks = ((uint32_t)max_period * rate_in_hertz * clock_divider) / clock_in_hz;
+
+    g_unit_clock_in_hz  = clock_in_hz;
+    g_unit_divider      = clock_divider;
+    g_period_rate       = rate_in_hertz;
+    g_period_max        = max_period;
+    g_ticks_per_irq     = 1;
+    g_max_ticks_per_irq = (max_ticks > MAX_TICKS_PER_IRQ) ? MAX_TICKS_PER_IRQ : ((max_ticks == 0) ? 1 : (uint8_t)max_ticks);
+
+    timer_period_compute();
+} /* timer_period_setup() */
+
+/*!
+ * @brief Gets the next tick period, diffusing the fractional part of the exact period over the ticks.
+ *
+ * @note Alternating between the two adjacent whole periods keeps the long-term rate exact.
+ *
+ * @return The period for the next tick.
+ */
+static inline uint16_t
+timer_period_next(void)
+{
+    uint16_t period = g_period.base;
+
+    g_period.error += g_period.remainder;
+
+    if (g_period.error >= g_period.denominator)
+    {
+        g_period.error -= g_period.denominator;
+        ++period;
+    }
+
+    return period;
+} /* timer_period_next() */
+
+/*!
+ * @brief Inserts a slot into the deadline list, after slots with the same deadline.
+ *
+ * @param[in] slot Slot index.
+ */
+static void
+timer_slot_insert(uint8_t const slot)
+{
+    uint8_t * p_link = &g_slot_head;
+
+    while ((*p_link != SLOT_LIST_END) && ((int32_t)(g_slots[*p_link].deadline - g_slots[slot].deadline) <= 0))
+    {
+        p_link = &g_slots[*p_link].next;
+    }
+
+    g_slots[slot].next = *p_link;
+    *p_link            = slot;
+} /* timer_slot_insert() */
+
+/*!
+ * @brief Removes a slot from the deadline list.
+ *
+ * @param[in] slot Slot index.
+ */
+static void
+timer_slot_unlink(uint8_t const slot)
+{
+    uint8_t * p_link = &g_slot_head;
+
+    while (*p_link != SLOT_LIST_END)
+    {
+        if (*p_link == slot)
+        {
+            *p_link = g_slots[slot].next;
+            break;
+        }
+
+        p_link = &g_slots[*p_link].next;
+    }
+} /* timer_slot_unlink() */
+
+/*!
+ * @brief Sets a slot's interval from the running tick rate and schedules its first call.
+ *
+ * @param[in] slot Slot index.
+ */
+static void
+timer_slot_schedule(uint8_t const slot)
+{
+    timer_slot_t * const p_slot   = &g_slots[slot];
+    uint32_t       const interval = ((uint32_t)g_slot_base_rate << SLOT_TICK_SHIFT) / p_slot->rate_in_hertz;
+
+    p_slot->interval = (interval < SLOT_TICK_ONE) ? SLOT_TICK_ONE : interval; // at most once per tick
+    p_slot->deadline = g_slot_now + p_slot->interval;
+
+    timer_slot_insert(slot);
+} /* timer_slot_schedule() */
+
+/*!
+ * @brief Calls (or defers) the slot callbacks that are due; run once per tick after the music callback.
+ *
+ * @note Only the head of the deadline list is checked when nothing is due.
+ */
+static inline void
+timer_slot_dispatch(void)
+{
+    g_slot_now += SLOT_TICK_ONE;
+
+    while ((g_slot_head != SLOT_LIST_END) && ((int32_t)(g_slots[g_slot_head].deadline - g_slot_now) <= 0))
+    {
+        uint8_t        const slot   = g_slot_head;
+        timer_slot_t * const p_slot = &g_slots[slot];
+
+        g_slot_head       = p_slot->next;
+        p_slot->deadline += p_slot->interval;
+
+        timer_slot_insert(slot);
+
+        if (p_slot->priority == TIMER_PRIORITY_INTERRUPT)
+        {
+            p_slot->p_callback();
+        }
+        else
+        {
+            p_slot->b_pending = true;
+        }
+    }
+} /* timer_slot_dispatch() */
+
+/*!
+ * @brief Reschedules every slot for a newly started timer.
+ *
+ * @param[in] rate_in_hertz The tick rate of the timer.
+ */
+static void
+timer_slot_restart(uint16_t const rate_in_hertz)
+{
+    g_slot_head      = SLOT_LIST_END;
+    g_slot_now       = 0;
+    g_slot_base_rate = rate_in_hertz;
+
+    for (uint8_t slot = 0; slot < TIMER_SLOT_COUNT; ++slot)
+    {
+        if (g_slots[slot].p_callback)
+        {
+            timer_slot_schedule(slot);
+        }
+    }
+} /* timer_slot_restart() */
+
+/*!
+ * @brief Programs the next PIT channel 0 period.
+ *
+ * @note Only the count is rewritten (no control word); in mode 2 the PIT loads it at the end of the current
+ *       period, so the running period is not disturbed.
+ */
+static inline void
+timer_pit_next_period(void)
+{
+    uint16_t const pit_counter = timer_period_next();
+
+    if (pit_counter != g_period.written)
+    {
+        outp(I8253_COUNTER_0_DATA_PORT, pit_counter & 0xFFU);
+        outp(I8253_COUNTER_0_DATA_PORT, pit_counter >> 8U);
+
+        g_period.written = pit_counter;
+    }
+} /* timer_pit_next_period() */
+
+/*!
+ * @brief Programs the next YM2151 Timer A/B period.
+ *
+ * @note The timer reloads its latch on overflow, so the new value applies from the next overflow on.
+ */
+static inline void
+timer_ym2151_next_period(void)
+{
+    uint16_t const period = timer_period_next();
+
+    if (period != g_period.written)
+    {
+        g_p_ym2151_set_period(period);
+
+        g_period.written = period;
+    }
+} /* timer_ym2151_next_period() */
+
+/*!
+ * @brief Runs the music callback and the slot callbacks once for every tick the interrupt covers.
+ *
+ * @param[in] telemetry_flags TELEMETRY_FLAG_* raised for the record of each tick.
+ */
+static inline void
+timer_run_ticks(uint8_t const telemetry_flags)
+{
+    uint8_t const flags = (g_ticks_per_irq > 1) ? (telemetry_flags | TELEMETRY_FLAG_CATCH_UP) : telemetry_flags;
+
+    for (uint8_t tick = 0; tick < g_ticks_per_irq; ++tick)
+    {
+        if (flags)
+        {
+            telemetry_raise_flags(flags);
+        }
+
+#if defined(PCZSM_PROFILE)
+        profile_tick_begin();
+        g_p_timer_callback();
+        profile_tick_end(g_period.written);
+#else
         g_p_timer_callback();
+#endif
+
+        timer_slot_dispatch();
+    }
+
+    g_average_ticks += g_ticks_per_irq;
+} /* timer_run_ticks() */
+
+/*!
+ * @brief Starts counting the ticks for the average rate at the first BIOS tick edge after timer_start().
+ *
+ * @note Called with interrupts disabled; the BIOS tick count is read only until the edge has been seen.
+ */
+static inline void
+timer_average_sync(void)
+{
+    uint32_t const bios_ticks = BIOS_TICK_COUNT;
+
+    if (bios_ticks != g_average_start)
+    {
+        g_average_start    = bios_ticks;
+        g_average_ticks    = 0;
+        g_b_average_synced = true;
     }
+} /* timer_average_sync() */
+
+/*!
+ * @brief Measures the handler's run time and adjusts the decimation.
+ *
+ * @note The run time is measured on PIT channel 0. When the PIT drives the ticks, the handler overran if the
+ *       count was reloaded while it ran. When a YM2151 timer drives them, the PIT is assumed to still run the
+ *       BIOS square wave (mode 3, count decremented by 2 per clock) and the run time must stay below the
+ *       ticks' share of PIT clocks. An overrun (or a re-entered handler) raises the ticks per interrupt by one;
+ *       once the busiest handler run in LOAD_WINDOW interrupts would fit half of one tick less, it steps back.
+ *
+ * @param[in] pit_start  PIT count read when the handler started.
+ * @param[in] b_pit_tick The PIT drives the ticks.
+ */
+static void
+timer_check_load(uint16_t const pit_start, bool const b_pit_tick)
+{
+    uint16_t const pit_end = i8253_read_counter();
+    uint32_t const budget  = (uint32_t)g_tick_pit_clocks * g_ticks_per_irq;
 
-    /* Update old interrupt handler.*/
-    if (g_p_old_interrupt_handler && (g_interrupt_counter >= g_interrupt_total))
+    bool     b_overrun = g_b_reentered;
+    uint32_t work      = 0;
+
+    if (b_pit_tick)
     {
-        g_p_old_interrupt_handler();
-        g_interrupt_counter -= g_interrupt_total;
+        if (pit_end > pit_start)
+        {
+            b_overrun = true;
+            work      = budget;
+        }
+        else
+        {
+            work = pit_start - pit_end;
+        }
+    }
+    else
+    {
+        work = (uint16_t)(pit_start - pit_end) >> 1U;
+    }
+
+    g_b_reentered = false;
+
+    if (work > g_load_peak)
+    {
+        g_load_peak = work;
+    }
+
+    if (g_cost_clocks >= AVERAGE_UNITS_LIMIT)
+    {
+        g_cost_clocks >>= 1;
+        g_cost_ticks  >>= 1;
+    }
+
+    g_cost_clocks += work;
+    g_cost_ticks  += g_ticks_per_irq;
+
+    if (b_overrun || (work >= budget))
+    {
+        ++g_overrun_stats.overruns;
+        telemetry_raise_flags(TELEMETRY_FLAG_OVERRUN); // lands on the next tick's record
+
+        if (g_ticks_per_irq < g_max_ticks_per_irq)
+        {
+            ++g_ticks_per_irq;
+            ++g_overrun_stats.decimations;
+
+            if (g_ticks_per_irq > g_overrun_stats.peak_ticks_per_irq)
+            {
+                g_overrun_stats.peak_ticks_per_irq = g_ticks_per_irq;
+            }
+
+            timer_period_compute();
+
+            g_load_irqs = 0;
+            g_load_peak = 0;
+        }
+    }
+    else if (++g_load_irqs >= LOAD_WINDOW)
+    {
+        if ((g_ticks_per_irq > 1) && ((g_load_peak * 2U) < ((uint32_t)g_tick_pit_clocks * (g_ticks_per_irq - 1U))))
+        {
+            --g_ticks_per_irq;
+            ++g_overrun_stats.recoveries;
+
+            timer_period_compute();
+        }
+
+        g_load_irqs = 0;
+        g_load_peak = 0;
+    }
+} /* timer_check_load() */
+
+/*!
+ * @brief Resets the decimation for a newly started timer.
+ *
+ * @param[in] rate_in_hertz The tick rate in Hertz.
+ */
+static void
+timer_load_reset(uint16_t const rate_in_hertz)
+{
+    g_ticks_per_irq     = 1;
+    g_max_ticks_per_irq = 1;
+    g_tick_pit_clocks   = (uint16_t)(I8253_CLOCK_SPEED_IN_HZ / rate_in_hertz);
+    g_load_peak         = 0;
+    g_load_irqs         = 0;
+    g_cost_clocks       = 0;
+    g_cost_ticks        = 0;
+    g_b_in_handler      = false;
+    g_b_reentered       = false;
+    g_irqs_pending      = 0;
+
+    if (g_overrun_stats.peak_ticks_per_irq == 0)
+    {
+        g_overrun_stats.peak_ticks_per_irq = 1;
+    }
+} /* timer_load_reset() */
+
+/*!
+ * @brief Notes an interrupt that arrived while the handler was still running; the running handler processes it.
+ */
+static inline void
+timer_defer_irq(void)
+{
+    ++g_overrun_stats.reentries;
+    g_b_reentered = true;
+
+    if (g_irqs_pending < UINT8_MAX)
+    {
+        ++g_irqs_pending;
+    }
+} /* timer_defer_irq() */
+
+/*!
+ * @brief Runs the ticks of the interrupt (and of any interrupt arriving meanwhile) with interrupts enabled.
+ *
+ * @note Called and returns with interrupts disabled, after the interrupt has been acknowledged.
+ *
+ * @param[in] p_next_irq Called (with interrupts disabled) before the ticks of each deferred interrupt, or NULL.
+ */
+static void
+timer_run_ticks_enabled(void (* const p_next_irq)(void))
+{
+    if (g_b_average_synced == false)
+    {
+        timer_average_sync();
+    }
+
+    _enable();
+    timer_run_ticks(0);
+    _disable();
+
+    while (g_irqs_pending)
+    {
+        --g_irqs_pending;
+
+        if (p_next_irq)
+        {
+            p_next_irq();
+        }
+
+        _enable();
+        timer_run_ticks(TELEMETRY_FLAG_LATE);
+        _disable();
+    }
+} /* timer_run_ticks_enabled() */
+
+/*!
+ * @brief Acknowledges the YM2151 timer (clearing its IRQ) and programs its next period.
+ *
+ * @note Also hands the stop request over to timer_stop(); the timer is only restarted if no stop is requested.
+ */
+static void
+timer_ym2151_acknowledge(void)
+{
+    g_p_ym2151_enable(!g_ym2151_stop_requested); // restart (if no request to stop)
+    g_ym2151_stop_acknowledged = g_ym2151_stop_requested;
+
+    timer_ym2151_next_period();
+} /* timer_ym2151_acknowledge() */
+
+/*!
+ * @brief Adds the latency of one tick start to the histogram.
+ *
+ * @param[in] clocks Time from the ideal tick boundary to the start of the tick, PIT clocks.
+ */
+static inline void
+timer_record_latency(uint32_t const clocks)
+{
+    uint32_t const bucket = clocks / LATENCY_BUCKET_CLOCKS;
+
+    ++g_latency_buckets[(bucket < LATENCY_BUCKET_COUNT) ? bucket : (LATENCY_BUCKET_COUNT - 1U)];
+    ++g_latency_samples;
+
+    g_latency_clocks += clocks;
+
+    if (clocks > g_latency_max)
+    {
+        g_latency_max = clocks;
+    }
+} /* timer_record_latency() */
+
+/*!
+ * @brief Measures how late the first tick of an IRQ 0 starts.
+ *
+ * @note Called with interrupts disabled right before the music callback makes its first port write. The ideal
+ *       boundary is the PIT reload that raised the interrupt; the count has run down from the period it reloaded
+ *       since (count 0 is 65536 clocks, which the 16-bit difference handles).
+ *
+ * @param[in] pit_running Period running since the reload (programmed before the handler started).
+ */
+static inline void
+timer_track_pit_latency(uint16_t const pit_running)
+{
+    timer_record_latency((uint16_t)(pit_running - i8253_read_counter()));
+} /* timer_track_pit_latency() */
+
+/*!
+ * @brief Runs the work of an interrupt handler, on the private stack if one is set (see timer_set_stack()).
+ *
+ * @param[in] p_service The work of the handler.
+ */
+static inline void
+timer_run_service(void (* const p_service)(void))
+{
+    if (g_p_stack != NULL)
+    {
+        irq_run_on_stack(g_p_stack, p_service);
+    }
+    else
+    {
+        p_service();
+    }
+} /* timer_run_service() */
+
+/*!
+ * @brief IRQ 0 (PIT) handler work.
+ *
+ * @note The BIOS handler is chained every BIOS_TICK_PIT_CLOCKS PIT clocks, counted from the periods actually
+ *       programmed, so DOS time does not drift. It sends the EOI when it runs; otherwise the EOI is sent here.
+ *       Either way the interrupt is acknowledged before the ticks run with interrupts enabled. An IRQ 0 arriving
+ *       meanwhile still chains the BIOS and programs the PIT, then leaves its ticks to the running handler.
+ */
+static void
+timer_irq_0_service(void)
+{
+    uint16_t const pit_running = g_period.written;
+
+    g_bios_clocks += pit_running ? pit_running : BIOS_TICK_PIT_CLOCKS; // count 0 is 65536 clocks
+
+    bool const b_chain = (g_p_old_interrupt_handler != NULL) && (g_bios_clocks >= BIOS_TICK_PIT_CLOCKS);
+    bool const b_run   = (g_p_timer_callback != NULL) && (g_b_in_handler == false);
+
+    if (b_chain)
+    {
+        g_bios_clocks -= BIOS_TICK_PIT_CLOCKS;
+    }
+
+    if (g_period.denominator)
+    {
+        timer_pit_next_period();
+    }
+
+    uint16_t pit_start = 0;
+
+    if (b_run)
+    {
+        g_b_in_handler = true;
+        pit_start      = i8253_read_counter();
+    }
+    else if (g_p_timer_callback)
+    {
+        timer_defer_irq();
+    }
+
+    if (b_chain)
+    {
+        g_p_old_interrupt_handler(); // sends the EOI
     }
     else
     {
         outp(PIC1_COMMAND, PIC_EOI);
     }
 
-    g_interrupt_counter += FIXED_POINT_ONE;
-} /* timer_irq_0_handler() */
+    if (b_run)
+    {
+        if (g_b_latency_enabled)
+        {
+            timer_track_pit_latency(pit_running);
+        }
+
+        timer_run_ticks_enabled(NULL);
+
+        timer_check_load(pit_start, g_period.denominator != 0);
+
+        g_b_in_handler = false;
+    }
+} /* timer_irq_0_service() */
 
 static void IRQ_FAR_INTERRUPT
-timer_irq_2_handler(void)
+timer_irq_0_handler(void)
+{
+    timer_run_service(&timer_irq_0_service);
+} /* timer_irq_0_handler() */
+
+/*!
+ * @brief Gets the PIT clocks between two reads of the BIOS square wave, unfolded around the expected interval.
+ *
+ * @note In mode 3 the count runs down by 2 per clock and reloads every half wave, so two counts only give the
+ *       interval modulo SQUARE_WAVE_HALF clocks. The whole half waves are taken from the expected interval, which
+ *       must be within a quarter wave (~14 ms) of the actual one.
+ *
+ * @param[in] pit_last Earlier PIT count.
+ * @param[in] pit_now  Later PIT count.
+ * @param[in] expected Expected interval, PIT clocks.
+ *
+ * @return The interval in PIT clocks.
+ */
+static inline uint32_t
+timer_square_wave_interval(uint16_t const pit_last, uint16_t const pit_now, uint32_t const expected)
 {
-    bool const ym2151_timer_b = (ym2151_read_status() & YM2151_STATUS_TIMER_B_FLAG) != 0;
+    uint32_t interval = (uint16_t)(pit_last - pit_now) >> 1U;
 
-    if (ym2151_timer_b && g_p_timer_callback)
+    while ((interval + (SQUARE_WAVE_HALF >> 1U)) < expected)
     {
-        g_p_timer_callback();
+        interval += SQUARE_WAVE_HALF;
+    }
+
+    return interval;
+} /* timer_square_wave_interval() */
+
+/*!
+ * @brief Tracks the spread of the intervals between YM2151 handler entries.
+ *
+ * @note Uses the BIOS square wave on PIT channel 0; intervals are unfolded around the ticks the interrupt covers
+ *       (see timer_square_wave_interval()).
+ *
+ * @param[in] pit_start PIT count read when the handler started.
+ */
+static inline void
+timer_track_jitter(uint16_t const pit_start)
+{
+    if (g_b_jitter_reset_requested)
+    {
+        g_b_jitter_reset_requested = false;
+        g_b_jitter_primed          = false;
+        g_jitter_min               = UINT32_MAX;
+        g_jitter_max               = 0;
+    }
+    else if (g_b_jitter_primed)
+    {
+        uint32_t const interval = timer_square_wave_interval(g_jitter_last, pit_start, (uint32_t)g_tick_pit_clocks * g_ticks_per_irq);
+
+        if (interval < g_jitter_min)
+        {
+            g_jitter_min = interval;
+        }
+
+        if (interval > g_jitter_max)
+        {
+            g_jitter_max = interval;
+        }
+    }
+
+    g_b_jitter_primed = (g_irqs_pending == 0); // an interval holding a deferred interrupt is not a tick interval
+    g_jitter_last     = pit_start;
+} /* timer_track_jitter() */
+
+/*!
+ * @brief Estimates how late the first tick of a YM2151 timer interrupt starts.
+ *
+ * @note The YM2151 count can not be read, so the delay from the overflow to the handler entry is reconstructed
+ *       from the entry times on the BIOS square wave: each entry interval longer than the period that ran adds
+ *       to the delay, each shorter one takes from it (never below zero). The period running is the one programmed
+ *       two handlers earlier, as the timer reloads its latch on overflow; it also restores the whole half waves
+ *       of the interval (see timer_square_wave_interval()), so slow tick rates are measured too. The PIT clocks
+ *       per period unit are learned from the measured intervals (nothing is sampled before the first
+ *       LATENCY_WINDOW), and the estimate is re-based on its minimum every LATENCY_WINDOW ticks so the remaining
+ *       error can not build up. The time from the handler entry to the start of the tick is added as measured.
+ *       Intervals holding a deferred interrupt are not sampled.
+ *
+ * @param[in] pit_start PIT count read when the handler started.
+ */
+static inline void
+timer_track_ym2151_latency(uint16_t const pit_start)
+{
+    uint16_t const pit_now   = i8253_read_counter();
+    uint32_t const reentries = g_overrun_stats.reentries;
+
+    if (reentries != g_latency_reentries)
+    {
+        g_latency_reentries = reentries;
+        g_latency_history   = 0;
+    }
+
+    if (g_latency_history >= 2U)
+    {
+        uint32_t const period   = (uint32_t)g_latency_units[1] * g_latency_unit_clocks;
+        uint32_t const interval = timer_square_wave_interval(g_latency_entry_last, pit_start, period >> LATENCY_UNIT_SHIFT);
+
+        int32_t const estimate = (int32_t)g_latency_estimate + (int32_t)(interval << LATENCY_UNIT_SHIFT) - (int32_t)period;
+
+        g_latency_estimate = (estimate > 0) ? (uint32_t)estimate : 0;
+
+        if (g_latency_sum_intervals >= AVERAGE_UNITS_LIMIT)
+        {
+            g_latency_sum_intervals >>= 1;
+            g_latency_sum_units     >>= 1;
+        }
+
+        g_latency_sum_intervals += interval;
+        g_latency_sum_units     += g_latency_units[1];
+
+        if (g_latency_estimate < g_latency_window_min)
+        {
+            g_latency_window_min = g_latency_estimate;
+        }
+
+        if (++g_latency_window_count >= LATENCY_WINDOW)
+        {
+            g_latency_estimate     -= g_latency_window_min;
+            g_latency_window_min    = UINT32_MAX;
+            g_latency_window_count  = 0;
+            g_latency_unit_clocks   = (uint32_t)(((uint64_t)g_latency_sum_intervals << LATENCY_UNIT_SHIFT) / g_latency_sum_units);
+            g_b_latency_calibrated  = true;
+        }
+
+        if (g_b_latency_calibrated)
+        {
+            timer_record_latency((g_latency_estimate >> LATENCY_UNIT_SHIFT) + ((uint16_t)(pit_start - pit_now) >> 1U));
+        }
+    }
+    else
+    {
+        ++g_latency_history;
+    }
+
+    g_latency_entry_last = pit_start;
+    g_latency_units[1]   = g_latency_units[0];
+    g_latency_units[0]   = g_period.written;
+} /* timer_track_ym2151_latency() */
+
+/*!
+ * @brief YM2151 timer handler shared by the IRQ 2 and IRQ 3/5/7 handlers.
+ *
+ * @note The timer is acknowledged and the EOI sent before the ticks run with interrupts enabled. A timer IRQ
+ *       arriving meanwhile leaves the YM2151 alone (the running handler may be between an address and a data
+ *       write); the running handler acknowledges it before processing that interrupt's ticks.
+ *
+ * @param[in] b_cascaded The IRQ arrives through the slave PIC.
+ */
+static inline void
+timer_ym2151_handler(bool const b_cascaded)
+{
+    bool const ym2151_timer = (ym2151_read_status() & g_ym2151_status_flag) != 0;
+
+    if (ym2151_timer && g_p_timer_callback)
+    {
+        bool const b_run     = (g_b_in_handler == false);
+        uint16_t   pit_start = 0;
+
+        if (b_run)
+        {
+            g_b_in_handler = true;
+            pit_start      = i8253_read_counter();
+
+            timer_track_jitter(pit_start);
+            timer_ym2151_acknowledge();
+        }
+        else
+        {
+            timer_defer_irq();
+        }
 
         outp(PIC1_COMMAND, PIC_EOI);
-        outp(PIC2_COMMAND, PIC_EOI);
 
-        ym2151_enable_timer_b(!g_timer_b_stop_requested); // restart (if not request to stop)
-        g_timer_b_stop_acknowledged = g_timer_b_stop_requested;
+        if (b_cascaded)
+        {
+            outp(PIC2_COMMAND, PIC_EOI);
+        }
+
+        if (b_run)
+        {
+            if (g_b_latency_enabled)
+            {
+                timer_track_ym2151_latency(pit_start);
+            }
+
+            timer_run_ticks_enabled(&timer_ym2151_acknowledge);
+
+            timer_check_load(pit_start, false);
+
+            g_b_in_handler = false;
+        }
     }
+} /* timer_ym2151_handler() */
+
+static void
+timer_irq_2_service(void)
+{
+    timer_ym2151_handler(true);
+} /* timer_irq_2_service() */
+
+static void
+timer_irq_357_service(void)
+{
+    timer_ym2151_handler(false);
+} /* timer_irq_357_service() */
+
+static void IRQ_FAR_INTERRUPT
+timer_irq_2_handler(void)
+{
+    timer_run_service(&timer_irq_2_service);
 } /* timer_irq_2_handler() */
 
 static void IRQ_FAR_INTERRUPT
 timer_irq_357_handler(void)
 {
-    bool const ym2151_timer_b = (ym2151_read_status() & YM2151_STATUS_TIMER_B_FLAG) != 0;
+    timer_run_service(&timer_irq_357_service);
+} /* timer_irq_357_handler() */
 
-    if (ym2151_timer_b && g_p_timer_callback)
-    {
-        g_p_timer_callback();
+/*!
+ * @brief End of the code reached at interrupt time.
+ */
+static void
+timer_lock_end(void)
+{
+} /* timer_lock_end() */
 
-        outp(PIC1_COMMAND, PIC_EOI);
+/*!
+ * @brief Locks the interrupt time code and data of the timer (once).
+ */
+static void
+timer_lock(void)
+{
+    if (g_b_locked == false)
+    {
+        irq_lock_module("timer", &timer_lock_begin, &timer_lock_end, g_lock_regions, IRQ_LOCK_REGION_COUNT(g_lock_regions));
 
-        ym2151_enable_timer_b(!g_timer_b_stop_requested); // restart (if no request to stop)
-        g_timer_b_stop_acknowledged = g_timer_b_stop_requested;
+        g_b_locked = true;
     }
-} /* timer_irq_357_handler() */
+} /* timer_lock() */
 
 static void
 timer_setup_pit_channel_0(uint16_t const rate_in_hertz)
 {
-    uint16_t const pit_counter  = (uint16_t)(I8253_CLOCK_SPEED_IN_HZ / rate_in_hertz);
+    timer_period_setup(I8253_CLOCK_SPEED_IN_HZ, 1, rate_in_hertz, UINT16_MAX);
+
+    uint16_t const pit_counter  = timer_period_next();
     uint8_t  const counter_low  = pit_counter & 0xFFU;
     uint8_t  const counter_high = (pit_counter >> 8U);
 
-    g_interrupt_total = ((uint32_t)rate_in_hertz * FIXED_POINT_INV_18_2) / FIXED_POINT_PRECISION;
-    g_interrupt_counter = g_interrupt_total;
+    g_period.written = pit_counter;
+
+    g_bios_clocks = 0;
 
     _disable();
 
@@ -109,6 +1042,9 @@ timer_restore_pit_channel_0(void)
 {
     _disable();
 
+    g_period.denominator = 0; // the IRQ 0 handler must not reprogram the count any more
+    g_period.written     = 0; // count 0 (65536 clocks, the BIOS rate)
+
     outp(I8253_CONTROL_WORD_PORT, I8253_COUNTER_0 | I8253_ACCESS_MODE_LATCH_LOHI_BYTE | I8253_MODE_2 | I8253_BCD_0);
     outp(I8253_COUNTER_0_DATA_PORT, 0);
     outp(I8253_COUNTER_0_DATA_PORT, 0);
@@ -116,6 +1052,91 @@ timer_restore_pit_channel_0(void)
     _enable();
 } /* timer_restore_pit_channel_0() */
 
+/*!
+ * @brief Selects Timer A or Timer B for the YM2151 IRQ and sets up its period.
+ *
+ * @note Timer A counts in 64 master clocks (16 times finer than Timer B) but cannot run slower than
+ *       about 55 Hz; Timer B is used whenever Timer A cannot reach the rate.
+ *
+ * @param[in] rate_in_hertz The tick rate in Hertz.
+ */
+static void
+timer_setup_ym2151(uint16_t const rate_in_hertz)
+{
+    uint32_t const clock_in_hz      = ym2151_get_clock_in_hz();
+    bool     const b_timer_a_usable = (clock_in_hz / ((uint32_t)rate_in_hertz * YM2151_TIMER_A_CLOCK_DIVIDER)) < YM2151_TIMER_A_MAX_PERIOD;
+
+    bool b_timer_a = false;
+
+    switch (g_ym2151_timer_selected)
+    {
+        case TIMER_YM2151_TIMER_A:
+            b_timer_a = b_timer_a_usable;
+            break;
+
+        case TIMER_YM2151_AUTO:
+            b_timer_a = b_timer_a_usable && (rate_in_hertz > AUTO_TIMER_A_HZ);
+            break;
+
+        default:
+            break;
+    }
+
+    if (b_timer_a)
+    {
+        g_ym2151_timer        = TIMER_YM2151_TIMER_A;
+        g_ym2151_status_flag  = YM2151_STATUS_TIMER_A_FLAG;
+        g_p_ym2151_set_period = &ym2151_set_timer_a_period;
+        g_p_ym2151_enable     = &ym2151_enable_timer_a;
+
+        timer_period_setup(clock_in_hz, YM2151_TIMER_A_CLOCK_DIVIDER, rate_in_hertz, YM2151_TIMER_A_MAX_PERIOD);
+    }
+    else
+    {
+        g_ym2151_timer        = TIMER_YM2151_TIMER_B;
+        g_ym2151_status_flag  = YM2151_STATUS_TIMER_B_FLAG;
+        g_p_ym2151_set_period = &ym2151_set_timer_b_period;
+        g_p_ym2151_enable     = &ym2151_enable_timer_b;
+
+        timer_period_setup(clock_in_hz, YM2151_TIMER_B_CLOCK_DIVIDER, rate_in_hertz, YM2151_TIMER_B_MAX_PERIOD);
+    }
+
+    g_period.written = timer_period_next();
+
+    g_latency_unit_clocks   = (uint32_t)((((uint64_t)g_unit_divider * I8253_CLOCK_SPEED_IN_HZ) << LATENCY_UNIT_SHIFT) / clock_in_hz);
+    g_latency_sum_intervals = 0;
+    g_latency_sum_units     = 0;
+    g_latency_history       = 0;
+    g_b_latency_calibrated  = false;
+
+    g_p_ym2151_set_period(g_period.written);
+    g_p_ym2151_enable(true);
+} /* timer_setup_ym2151() */
+
+/*!
+ * @brief Raises the YM2151 IRQ to the highest master PIC priority (or restores the default) as selected.
+ */
+static void
+timer_apply_irq_priority(void)
+{
+    bool const b_raise = g_b_priority_selected && (g_p_timer_callback != NULL) && (g_interrupt_number != INT08H_IRQ0);
+
+    _disable();
+
+    if (b_raise)
+    {
+        irq_set_highest_priority(g_interrupt_number - INT08H_IRQ0);
+    }
+    else if (g_b_priority_raised)
+    {
+        irq_restore_priority();
+    }
+
+    _enable();
+
+    g_b_priority_raised = b_raise;
+} /* timer_apply_irq_priority() */
+
 int
 timer_start(uint8_t const irq_number, uint16_t const rate_in_hertz, timer_callback_t const p_timer_callback)
 {
@@ -143,12 +1164,28 @@ timer_start(uint8_t const irq_number, uint16_t const rate_in_hertz, timer_callba
 
     if ((irq_handler != NULL) && (p_timer_callback != NULL))
     {
-        g_interrupt_number        = INT08H_IRQ0 + irq_number;
-        g_p_timer_callback        = p_timer_callback;
-        g_p_old_interrupt_handler = _dos_getvect(g_interrupt_number);
+        g_interrupt_number         = INT08H_IRQ0 + irq_number;
+        g_p_timer_callback         = p_timer_callback;
+        g_ym2151_stop_requested    = false; // a previous timer_stop() leaves these set
+        g_ym2151_stop_acknowledged = false;
+        g_p_old_interrupt_handler  = irq_get_vector(g_interrupt_number);
+
+        timer_lock();
+        timer_slot_restart(rate_in_hertz);
+        timer_load_reset(rate_in_hertz);
+
+        _disable();
+        g_average_start    = BIOS_TICK_COUNT;
+        g_average_ticks    = 0;
+        g_b_average_synced = false;
+        _enable();
+
+#if defined(PCZSM_PROFILE)
+        profile_start(rate_in_hertz, (g_interrupt_number == INT08H_IRQ0));
+#endif
 
         _disable();
-        _dos_setvect(g_interrupt_number, irq_handler);
+        irq_set_vector(g_interrupt_number, irq_handler);
         _enable();
 
         if (g_interrupt_number == INT08H_IRQ0)
@@ -168,8 +1205,8 @@ timer_start(uint8_t const irq_number, uint16_t const rate_in_hertz, timer_callba
             irq_clear_mask(irq_number);
             _enable();
 
-            ym2151_set_timer_b_hz(rate_in_hertz);
-            ym2151_enable_timer_b(true);
+            timer_apply_irq_priority();
+            timer_setup_ym2151(rate_in_hertz);
         }
 
         return 0;
@@ -190,8 +1227,8 @@ timer_stop(void)
         else
         {
             uint16_t wait_delay = 0;
-            g_timer_b_stop_requested = true;
-            while ( (g_timer_b_stop_acknowledged == false) || (wait_delay++ < 255 ) )
+            g_ym2151_stop_requested = true;
+            while ( (g_ym2151_stop_acknowledged == false) || (wait_delay++ < 255 ) )
             {
                 // wait
             }
@@ -201,9 +1238,412 @@ timer_stop(void)
             _enable();
         }
 
-        _dos_setvect(g_interrupt_number, g_p_old_interrupt_handler);  /* restore */
+        irq_set_vector(g_interrupt_number, g_p_old_interrupt_handler);  /* restore */
         g_p_timer_callback = NULL;
+
+        timer_apply_irq_priority(); // back to the default priority
     }
 } /* timer_stop() */
 
+/*!
+ * @brief Adds a callback called at its own rate from the running timer.
+ *
+ * @note The music callback passed to timer_start() always runs first on every tick. TIMER_PRIORITY_INTERRUPT
+ *       callbacks run next, inside the interrupt; TIMER_PRIORITY_DEFERRED callbacks are only flagged there and
+ *       run from the main loop by timer_service_deferred(). Rates above the timer's tick rate run once per tick.
+ *       Callbacks stay registered across timer_stop()/timer_start().
+ *
+ * @param[in] rate_in_hertz The callback rate in Hertz.
+ * @param[in] p_callback    Callback function.
+ * @param[in] priority      Where the callback runs.
+ *
+ * @return Slot of the callback (for timer_remove_callback()), or TIMER_INVALID_SLOT if none is free.
+ */
+int8_t
+timer_add_callback(uint16_t const rate_in_hertz, timer_callback_t const p_callback, e_timer_priority_t const priority)
+{
+    if ((rate_in_hertz == 0) || (p_callback == NULL))
+    {
+        return TIMER_INVALID_SLOT;
+    }
+
+    for (uint8_t slot = 0; slot < TIMER_SLOT_COUNT; ++slot)
+    {
+        timer_slot_t * const p_slot = &g_slots[slot];
+
+        if (p_slot->p_callback == NULL)
+        {
+            _disable();
+
+            p_slot->rate_in_hertz = rate_in_hertz;
+            p_slot->priority      = (uint8_t)priority;
+            p_slot->b_pending     = false;
+            p_slot->p_callback    = p_callback;
+
+            if (g_p_timer_callback)
+            {
+                timer_slot_schedule(slot);
+            }
+
+            _enable();
+
+            return (int8_t)slot;
+        }
+    }
+
+    return TIMER_INVALID_SLOT;
+} /* timer_add_callback() */
+
+/*!
+ * @brief Removes a callback added by timer_add_callback().
+ *
+ * @param[in] slot Slot of the callback.
+ */
+void
+timer_remove_callback(int8_t const slot)
+{
+    if ((slot >= 0) && (slot < (int8_t)TIMER_SLOT_COUNT))
+    {
+        _disable();
+
+        timer_slot_unlink((uint8_t)slot);
+
+        g_slots[slot].p_callback = NULL;
+        g_slots[slot].b_pending  = false;
+
+        _enable();
+    }
+} /* timer_remove_callback() */
+
+/*!
+ * @brief Runs the deferred callbacks that became due; call from the main loop.
+ *
+ * @note Calls that became due more than once since the last service are coalesced into one.
+ */
+void
+timer_service_deferred(void)
+{
+    for (uint8_t slot = 0; slot < TIMER_SLOT_COUNT; ++slot)
+    {
+        timer_slot_t * const p_slot = &g_slots[slot];
+
+        if (p_slot->b_pending)
+        {
+            p_slot->b_pending = false;
+
+            if (p_slot->p_callback)
+            {
+                p_slot->p_callback();
+            }
+        }
+    }
+} /* timer_service_deferred() */
+
+/*!
+ * @brief Checks if a deferred callback is waiting for timer_service_deferred().
+ *
+ * @note Lets the main loop check for work with interrupts disabled before it halts.
+ *
+ * @return true if a deferred callback is due, otherwise false.
+ */
+bool
+timer_is_deferred_pending(void)
+{
+    for (uint8_t slot = 0; slot < TIMER_SLOT_COUNT; ++slot)
+    {
+        if (g_slots[slot].b_pending)
+        {
+            return true;
+        }
+    }
+
+    return false;
+} /* timer_is_deferred_pending() */
+
+/*!
+ * @brief Selects which YM2151 timer drives playback on the SAAYM IRQ.
+ *
+ * @note Takes effect at the next timer_start().
+ *
+ * @param[in] ym2151_timer The YM2151 timer to use.
+ */
+void
+timer_select_ym2151_timer(e_timer_ym2151_t const ym2151_timer)
+{
+    g_ym2151_timer_selected = ym2151_timer;
+} /* timer_select_ym2151_timer() */
+
+/*!
+ * @brief Runs the interrupt handlers on a private stack instead of the interrupted program's stack.
+ *
+ * @note For the resident player, which interrupts programs with stacks of any size. Call while the timer is
+ *       stopped; see irq_run_on_stack().
+ *
+ * @param[in] p_stack The stack, or NULL to stay on the interrupted program's stack.
+ */
+void
+timer_set_stack(irq_stack_t * const p_stack)
+{
+    g_p_stack = p_stack;
+} /* timer_set_stack() */
+
+/*!
+ * @brief Gets the YM2151 timer driving the SAAYM IRQ.
+ *
+ * @return TIMER_YM2151_TIMER_A or TIMER_YM2151_TIMER_B (as chosen by the last timer_start() on the SAAYM IRQ).
+ */
+e_timer_ym2151_t
+timer_get_ym2151_timer(void)
+{
+    return g_ym2151_timer;
+} /* timer_get_ym2151_timer() */
+
+/*!
+ * @brief Gets the average tick rate since the timer was started.
+ *
+ * @note Measured: the ticks the music callback actually ran, divided by the time elapsed on the BIOS tick count
+ *       (the PIT). Counting starts at the first BIOS tick edge after timer_start() and ends at the next edge,
+ *       which this waits for (up to ~55 ms), so any drift of the PIT or YM2151 clock, lost interrupts and
+ *       decimation all show. Call while the timer is running.
+ *
+ * @return The average tick rate in millihertz, or 0 if less than one BIOS tick has elapsed.
+ */
+uint32_t
+timer_get_average_rate_in_millihertz(void)
+{
+    _disable();
+    uint32_t const edge = BIOS_TICK_COUNT;
+    _enable();
+
+    uint32_t now = edge;
+
+    while (now == edge)
+    {
+        _disable();
+        now = BIOS_TICK_COUNT;
+        _enable();
+    }
+
+    _disable();
+    uint32_t const ticks    = g_average_ticks;
+    uint32_t const start    = g_average_start;
+    bool     const b_synced = g_b_average_synced;
+    _enable();
+
+    uint32_t const elapsed = bios_ticks_elapsed(start, now);
+
+    if ((b_synced == false) || (elapsed == 0))
+    {
+        return 0;
+    }
+
+    return (uint32_t)(((uint64_t)ticks * I8253_CLOCK_SPEED_IN_HZ * MILLIHERTZ_PER_HERTZ) / ((uint64_t)elapsed * BIOS_TICK_PIT_CLOCKS));
+} /* timer_get_average_rate_in_millihertz() */
+
+/*!
+ * @brief Measures how many calls of a function fit in one tick.
+ *
+ * @note Times the calls on PIT channel 0, which must still run the BIOS square wave (mode 3); call before
+ *       timer_start() or after timer_stop(). Interrupts are disabled while a batch of calls is timed.
+ *
+ * @param[in] p_work        Function to time.
+ * @param[in] rate_in_hertz The tick rate in Hertz.
+ *
+ * @return Calls per tick (at least 1).
+ */
+uint16_t
+timer_calibrate_calls_per_tick(timer_callback_t const p_work, uint16_t const rate_in_hertz)
+{
+    uint32_t clocks = 0;
+
+    for (uint8_t batch = 0; batch < CALIBRATE_BATCHES; ++batch)
+    {
+        _disable();
+
+        uint16_t const pit_start = i8253_read_counter();
+
+        for (uint8_t call = 0; call < CALIBRATE_BATCH_CALLS; ++call)
+        {
+            p_work();
+        }
+
+        uint16_t const pit_end = i8253_read_counter();
+
+        _enable();
+
+        clocks += (uint16_t)(pit_start - pit_end) >> 1U; // mode 3 counts down by 2 per clock
+    }
+
+    uint32_t const clocks_per_call = (clocks / (CALIBRATE_BATCHES * CALIBRATE_BATCH_CALLS)) + 1U;
+    uint32_t const calls_per_tick  = (I8253_CLOCK_SPEED_IN_HZ / rate_in_hertz) / clocks_per_call;
+
+    return (calls_per_tick > UINT16_MAX) ? UINT16_MAX : ((calls_per_tick == 0) ? 1 : (uint16_t)calls_per_tick);
+} /* timer_calibrate_calls_per_tick() */
+
+/*!
+ * @brief Selects whether the YM2151 IRQ ranks highest on the master PIC while the timer runs.
+ *
+ * @note Uses the 8259A specific rotate command, so IRQ 3/5/7 (or the slave PIC on IRQ 2) preempt the system timer,
+ *       keyboard and serial IRQs. Applied at once if the timer runs on the SAAYM IRQ; timer_stop() restores the
+ *       default priority. No effect with IRQ 0.
+ *
+ * @param[in] b_highest Rank the YM2151 IRQ highest (true), default priority (false).
+ */
+void
+timer_set_irq_priority(bool const b_highest)
+{
+    g_b_priority_selected = b_highest;
+
+    timer_apply_irq_priority();
+} /* timer_set_irq_priority() */
+
+/*!
+ * @brief Restarts the tick jitter measurement.
+ */
+void
+timer_reset_jitter(void)
+{
+    g_b_jitter_reset_requested = true;
+} /* timer_reset_jitter() */
+
+/*!
+ * @brief Gets the tick jitter measured since timer_reset_jitter().
+ *
+ * @note Only measured on the SAAYM IRQ: the difference between the longest and the shortest interval between two
+ *       handler entries (decimation changes in between widen it).
+ *
+ * @return The jitter in microseconds, or 0 if fewer than two intervals were measured.
+ */
+uint16_t
+timer_get_jitter_in_microseconds(void)
+{
+    _disable();
+    uint32_t const jitter_min = g_jitter_min;
+    uint32_t const jitter_max = g_jitter_max;
+    bool     const b_reset    = g_b_jitter_reset_requested;
+    _enable();
+
+    if (b_reset || (jitter_max < jitter_min))
+    {
+        return 0;
+    }
+
+    uint32_t const jitter = ((jitter_max - jitter_min) * MICROSECONDS_PER_MS) / PIT_CLOCKS_PER_MS;
+
+    return (jitter > UINT16_MAX) ? UINT16_MAX : (uint16_t)jitter;
+} /* timer_get_jitter_in_microseconds() */
+
+/*!
+ * @brief Gets the average time the timer interrupt spends per tick since timer_start().
+ *
+ * @note Covers the music callback, the slot callbacks and the handler itself (see timer_check_load()).
+ *
+ * @return The time in microseconds, or 0 if no tick ran yet.
+ */
+uint16_t
+timer_get_tick_cost_in_microseconds(void)
+{
+    _disable();
+    uint32_t const cost_clocks = g_cost_clocks;
+    uint32_t const cost_ticks  = g_cost_ticks;
+    _enable();
+
+    if (cost_ticks == 0)
+    {
+        return 0;
+    }
+
+    uint32_t const tick_clocks = cost_clocks / cost_ticks;
+
+    return (uint16_t)((tick_clocks * MICROSECONDS_PER_MS) / PIT_CLOCKS_PER_MS);
+} /* timer_get_tick_cost_in_microseconds() */
+
+/*!
+ * @brief Starts (clearing the statistics) or stops the tick start latency measurement.
+ *
+ * @note The latency is the time from the ideal tick boundary to the start of the music callback, right before
+ *       its first port write; only the first tick of each interrupt is measured. Exact on IRQ 0, estimated on
+ *       the SAAYM IRQ (see timer_track_ym2151_latency()). Costs one PIT read per interrupt while enabled.
+ *
+ * @param[in] b_enable Measure (true), stop (false).
+ */
+void
+timer_enable_latency(bool const b_enable)
+{
+    _disable();
+
+    for (uint16_t bucket = 0; bucket < LATENCY_BUCKET_COUNT; ++bucket)
+    {
+        g_latency_buckets[bucket] = 0;
+    }
+
+    g_latency_samples      = 0;
+    g_latency_clocks       = 0;
+    g_latency_max          = 0;
+    g_latency_history      = 0;
+    g_latency_estimate     = 0;
+    g_latency_window_min   = UINT32_MAX;
+    g_latency_window_count = 0;
+    g_b_latency_enabled    = b_enable;
+
+    _enable();
+} /* timer_enable_latency() */
+
+/*!
+ * @brief Gets the tick start latency measured since timer_enable_latency().
+ *
+ * @note The 99th percentile is the upper edge of its histogram bucket (LATENCY_BUCKET_CLOCKS PIT clocks wide),
+ *       or the maximum if it lies beyond the last bucket.
+ *
+ * @param[out] p_stats Latency statistics.
+ */
+void
+timer_get_latency_stats(timer_latency_stats_t * const p_stats)
+{
+    _disable();
+    uint32_t const samples = g_latency_samples;
+    uint64_t const clocks  = g_latency_clocks;
+    uint32_t const max     = g_latency_max;
+    _enable();
+
+    p_stats->samples              = samples;
+    p_stats->mean_in_microseconds = 0;
+    p_stats->p99_in_microseconds  = 0;
+    p_stats->max_in_microseconds  = (uint16_t)((max * MICROSECONDS_PER_MS) / PIT_CLOCKS_PER_MS);
+    p_stats->b_estimated          = (g_interrupt_number != INT08H_IRQ0);
+
+    if (samples)
+    {
+        uint32_t const target = samples - ((samples * (100U - LATENCY_PERCENTILE)) / 100U);
+        uint32_t       count  = 0;
+        uint16_t       bucket = 0;
+
+        while ((bucket < (LATENCY_BUCKET_COUNT - 1U)) && ((count += g_latency_buckets[bucket]) < target))
+        {
+            ++bucket;
+        }
+
+        uint32_t const p99 = (bucket < (LATENCY_BUCKET_COUNT - 1U)) ? ((bucket + 1U) * LATENCY_BUCKET_CLOCKS) : max;
+
+        p_stats->mean_in_microseconds = (uint16_t)(((clocks / samples) * MICROSECONDS_PER_MS) / PIT_CLOCKS_PER_MS);
+        p_stats->p99_in_microseconds  = (uint16_t)((((p99 < max) ? p99 : max) * MICROSECONDS_PER_MS) / PIT_CLOCKS_PER_MS);
+    }
+} /* timer_get_latency_stats() */
+
+/*!
+ * @brief Gets the overrun and decimation counters.
+ *
+ * @note The counters accumulate over every timer_start() since the program started.
+ *
+ * @param[out] p_stats Counters.
+ */
+void
+timer_get_overrun_stats(timer_overrun_stats_t * const p_stats)
+{
+    _disable();
+    *p_stats = g_overrun_stats;
+    p_stats->ticks_per_irq = g_ticks_per_irq;
+    _enable();
+} /* timer_get_overrun_stats() */
+
 /*** end of file ***/
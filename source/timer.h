@@ -6,6 +6,41 @@
 
 #pragma once
 
+#define TIMER_SLOT_COUNT   (4U)  // callbacks besides the music callback
+#define TIMER_INVALID_SLOT (-1)
+
+typedef enum
+{
+    TIMER_PRIORITY_INTERRUPT, // called from the interrupt, right after the music callback
+    TIMER_PRIORITY_DEFERRED   // flagged in the interrupt, called from timer_service_deferred()
+} e_timer_priority_t;
+
+typedef enum
+{
+    TIMER_YM2151_AUTO,    // Timer A for high tick rates, otherwise Timer B
+    TIMER_YM2151_TIMER_A, // 64 master clock resolution (rates of ~55 Hz and up)
+    TIMER_YM2151_TIMER_B  // 1024 master clock resolution
+} e_timer_ym2151_t;
+
+typedef struct
+{
+    uint32_t overruns;           // interrupts whose handler ran past its ticks' time
+    uint32_t reentries;          // interrupts that arrived while the handler was still running
+    uint16_t decimations;        // steps to more ticks per interrupt
+    uint16_t recoveries;         // steps back to fewer ticks per interrupt
+    uint8_t  ticks_per_irq;      // current ticks per interrupt
+    uint8_t  peak_ticks_per_irq; // most ticks per interrupt reached
+} timer_overrun_stats_t;
+
+typedef struct
+{
+    uint32_t samples;              // ticks measured
+    uint16_t mean_in_microseconds;
+    uint16_t p99_in_microseconds;
+    uint16_t max_in_microseconds;
+    bool     b_estimated;          // YM2151 timer: reconstructed from the intervals between handler entries
+} timer_latency_stats_t;
+
 //--------------------------------------------------------------------
 typedef void (*timer_callback_t)(void);
 //--------------------------------------------------------------------
@@ -16,6 +51,22 @@ extern "C" {
 
 int  timer_start(uint8_t const irq_number, uint16_t const rate_in_hertz, timer_callback_t const p_timer_callback);
 void timer_stop(void);
+uint32_t timer_get_average_rate_in_millihertz(void);
+void timer_select_ym2151_timer(e_timer_ym2151_t const ym2151_timer);
+void timer_set_stack(irq_stack_t * const p_stack);
+e_timer_ym2151_t timer_get_ym2151_timer(void);
+int8_t timer_add_callback(uint16_t const rate_in_hertz, timer_callback_t const p_callback, e_timer_priority_t const priority);
+void timer_remove_callback(int8_t const slot);
+void timer_service_deferred(void);
+bool timer_is_deferred_pending(void);
+void timer_get_overrun_stats(timer_overrun_stats_t * const p_stats);
+uint16_t timer_calibrate_calls_per_tick(timer_callback_t const p_work, uint16_t const rate_in_hertz);
+void timer_set_irq_priority(bool const b_highest);
+void timer_reset_jitter(void);
+uint16_t timer_get_jitter_in_microseconds(void);
+uint16_t timer_get_tick_cost_in_microseconds(void);
+void timer_enable_latency(bool const b_enable);
+void timer_get_latency_stats(timer_latency_stats_t * const p_stats);
 
 //--------------------------------------------------------------------
 #ifdef __cplusplus
@@ -0,0 +1,599 @@
+/** @file tsr.c
+ *
+ * @brief Resident (TSR) background player and its software interrupt API.
+ *
+ * @par
+ * Only the 16-bit build can stay resident. The command line player, status screen, benchmark and detection code
+ * (code class TRANSIENT) are linked first in the image and the resident part after them (see the ORDER directive
+ * in MAKEFILE), starting with g_resident_begin. At install the program block is split there: the resident part
+ * becomes a block of its own, and only the PSP is kept of the original block. The song is loaded with the DOS 5
+ * "high memory first" allocation strategy, so it lands in upper memory blocks when there are any. Loading PCZSM
+ * itself with LOADHIGH moves the rest there too.
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <conio.h>
+#include <dos.h>
+#include <i86.h>
+#include "irq.h"
+#include "ram.h"
+#include "zsm.h"
+#include "ym2151.h"
+#include "saa1099.h"
+#include "saaym.h"
+#include "timer.h"
+#include "tsr.h"
+
+#pragma off (check_stack) // API calls run on the resident stack
+
+#define TSR_COST_WINDOW_MS          (500U)    // playback measured before going resident
+#define TSR_PARAGRAPH_SHIFT         (4U)
+#define TSR_PARAGRAPH_MASK          (0x0FU)
+#define TSR_PSP_PARAGRAPHS          (0x10U)   // the PSP alone (256 bytes)
+#define TSR_PSP_ENVIRONMENT         (0x2CU)   // PSP offset of the environment segment
+#define TSR_MCB_OWNER               (1U)      // MCB offsets (words at byte offsets)
+#define TSR_MCB_SIZE                (3U)
+#define TSR_MCB_NAME                (8U)      // program name (DOS 4 and later)
+#define TSR_MCB_NAME_SIZE           (8U)
+#define TSR_MCB_LAST                ('Z')
+#define TSR_OPCODE_IRET             (0xCFU)
+#define TSR_DOS_SET_PSP             (0x50U)
+#define TSR_DOS_GET_PSP             (0x51U)
+#define TSR_DOS_GET_LIST_OF_LISTS   (0x52U)
+#define TSR_DOS_ALLOCATION          (0x58U)
+#define TSR_ALLOCATION_GET_STRATEGY (0x00U)
+#define TSR_ALLOCATION_SET_STRATEGY (0x01U)
+#define TSR_ALLOCATION_GET_UMB_LINK (0x02U)
+#define TSR_ALLOCATION_SET_UMB_LINK (0x03U)
+#define TSR_STRATEGY_HIGH_FIRST     (0x80U)   // first fit, upper memory first, then conventional memory
+#define TSR_PERMILLE_SCALE          (1000UL)
+#define TSR_DECIMAL                 (10U)
+#define TSR_STACK_SIZE              (2048U)   // API calls (file I/O on Load) and playback interrupts
+#define TSR_SPLIT_PAD_SIZE          (32U)     // holds one whole paragraph for the MCB of the resident block
+
+#if defined(_M_I86)
+
+#pragma data_seg("RESIDENT_BEGIN", "RESIDENT_BEGIN")
+static uint8_t             g_resident_begin[TSR_SPLIT_PAD_SIZE] = { 0 }; // between the transient and resident code
+#pragma data_seg()
+
+static tsr_config_t        g_config;
+static ram_handle_t        g_ram_handle         = NULL;
+static interrupt_handler_t g_p_old_api_handler  = NULL;
+static uint16_t            g_resident_psp       = 0;
+static bool                g_b_playing          = false;
+static zsm_snapshot_t      g_snapshot;                  // only used to silence the chips on stop
+static uint16_t            g_saved_strategy     = 0;
+static uint8_t             g_saved_umb_link     = 0;
+static union INTPACK *     g_p_api_registers    = NULL;     // caller registers of the running API call
+static uint8_t             g_stack_memory[TSR_STACK_SIZE];  // in DGROUP, so SS equals DS on the resident stack
+static irq_stack_t         g_stack              = { g_stack_memory, sizeof(g_stack_memory), 0 };
+
+/*!
+ * @brief Sets the current DOS PSP.
+ *
+ * @param[in] psp PSP segment to make current.
+ *
+ * @return The PSP segment that was current.
+ */
+static uint16_t
+tsr_swap_psp(uint16_t const psp)
+{
+    union REGS regs;
+
+    regs.h.ah = TSR_DOS_GET_PSP;
+    intdos(&regs, &regs);
+
+    uint16_t const previous_psp = regs.w.bx;
+
+    regs.h.ah = TSR_DOS_SET_PSP;
+    regs.w.bx = psp;
+    intdos(&regs, &regs);
+
+    return previous_psp;
+} /* tsr_swap_psp() */
+
+/*!
+ * @brief Stops playback and silences both chips.
+ */
+static void
+tsr_stop(void)
+{
+    if (g_b_playing)
+    {
+        timer_stop();
+        zsm_suspend(&g_snapshot);
+
+        g_b_playing = false;
+    }
+} /* tsr_stop() */
+
+/*!
+ * @brief Plays the loaded song from the start.
+ *
+ * @param[in] zsm_repeat Repeat control value.
+ *
+ * @return TSR_ERROR_NONE, or the reason the song can not play.
+ */
+static e_tsr_error_t
+tsr_play(uint16_t const zsm_repeat)
+{
+    tsr_stop();
+
+    if (g_ram_handle == NULL)
+    {
+        return TSR_ERROR_NOTHING_LOADED;
+    }
+
+    if (g_config.p_initialize(&g_config.saaym_config, g_ram_handle) != ZSM_SUCCESS) // rewinds the song
+    {
+        return TSR_ERROR_BAD_ZSM;
+    }
+
+    zsm_start(zsm_repeat);
+    timer_start(g_config.saaym_config.irq_number, zsm_get_header().tick_rate, &zsm_update);
+
+    g_b_playing = true;
+
+    return TSR_ERROR_NONE;
+} /* tsr_play() */
+
+/*!
+ * @brief Replaces the loaded song.
+ *
+ * @note The song memory is allocated for the resident PSP, so it belongs to the player rather than the caller.
+ *
+ * @param[in] p_file_name ZSM file name.
+ *
+ * @return TSR_ERROR_NONE, or the reason the song was not loaded.
+ */
+static e_tsr_error_t
+tsr_load(char const * const p_file_name)
+{
+    tsr_stop();
+
+    uint16_t const caller_psp = tsr_swap_psp(g_resident_psp);
+
+    ram_free(&g_ram_handle);
+
+    tsr_prefer_upper_memory(true);
+    e_ram_result_t const ram_result = ram_load_file(&g_ram_handle, p_file_name);
+    tsr_prefer_upper_memory(false);
+
+    tsr_swap_psp(caller_psp);
+
+    if (ram_result == RAM_LOAD_UNABLE_TO_OPEN_FILE)
+    {
+        return TSR_ERROR_UNABLE_TO_OPEN_FILE;
+    }
+
+    if (ram_result != RAM_LOAD_SUCCESS)
+    {
+        return TSR_ERROR_INSUFFICIENT_MEMORY;
+    }
+
+    if (g_config.p_initialize(&g_config.saaym_config, g_ram_handle) != ZSM_SUCCESS)
+    {
+        ram_free(&g_ram_handle);
+
+        return TSR_ERROR_BAD_ZSM;
+    }
+
+    return TSR_ERROR_NONE;
+} /* tsr_load() */
+
+/*!
+ * @brief Frees every DOS memory block owned by the resident PSP (the PSP, the resident part, the heap and the song).
+ *
+ * @note The UMBs are linked into the memory chain for the walk, so blocks in upper memory are found too; the
+ *       caller's UMB link state and allocation strategy are restored afterwards.
+ */
+static void
+tsr_free_resident_memory(void)
+{
+    union REGS   regs;
+    struct SREGS sregs;
+
+    tsr_prefer_upper_memory(true);
+
+    segread(&sregs);
+    regs.h.ah = TSR_DOS_GET_LIST_OF_LISTS;
+    intdosx(&regs, &regs, &sregs);
+
+    uint16_t mcb = *(uint16_t __far *)MK_FP(sregs.es, regs.w.bx - sizeof(uint16_t)); // first MCB
+
+    for (;;)
+    {
+        uint8_t  const __far * const p_mcb = (uint8_t const __far *)MK_FP(mcb, 0);
+        uint16_t const               owner = *(uint16_t const __far *)(p_mcb + TSR_MCB_OWNER);
+        uint16_t const               size  = *(uint16_t const __far *)(p_mcb + TSR_MCB_SIZE);
+        bool     const               b_last = (p_mcb[0] == TSR_MCB_LAST);
+
+        if (owner == g_resident_psp)
+        {
+            _dos_freemem(mcb + 1U); // the block stays intact until DOS hands it out again
+        }
+
+        if (b_last)
+        {
+            break;
+        }
+
+        mcb += size + 1U;
+    }
+
+    tsr_prefer_upper_memory(false);
+} /* tsr_free_resident_memory() */
+
+/*!
+ * @brief Gets the MCB segment the program block is split at, in the g_resident_begin pad.
+ *
+ * @param[in] block_end Segment right after the program block.
+ *
+ * @return The MCB segment, or 0 if the image was not linked transient part first.
+ */
+static uint16_t
+tsr_get_split_mcb(uint16_t const block_end)
+{
+    uint8_t const __far * const p_pad = g_resident_begin;
+    uint16_t const              mcb   = FP_SEG(p_pad) + ((FP_OFF(p_pad) + TSR_PARAGRAPH_MASK) >> TSR_PARAGRAPH_SHIFT);
+
+    return ((mcb > (g_resident_psp + TSR_PSP_PARAGRAPHS)) && ((mcb + 1U) < block_end)) ? mcb : 0;
+} /* tsr_get_split_mcb() */
+
+/*!
+ * @brief Moves the resident part of the program block into a block of its own.
+ *
+ * @note Shrinking the program block makes DOS write a free MCB at split_mcb; it is claimed for the resident PSP
+ *       right away (nothing allocates in between), so the transient part is only freed by _dos_keep().
+ *
+ * @param[in] split_mcb MCB segment of the resident block (see tsr_get_split_mcb()).
+ * @param[in] block_end Segment right after the program block.
+ *
+ * @return true if the block was split, otherwise false (the program block is unchanged).
+ */
+static bool
+tsr_split_resident_block(uint16_t const split_mcb, uint16_t const block_end)
+{
+    unsigned max_paragraphs = 0;
+
+    if (_dos_setblock(split_mcb - g_resident_psp, g_resident_psp, &max_paragraphs) != 0)
+    {
+        return false;
+    }
+
+    uint8_t __far * const p_mcb = (uint8_t __far *)MK_FP(split_mcb, 0);
+
+    *(uint16_t __far *)(p_mcb + TSR_MCB_OWNER) = g_resident_psp;
+    _fmemcpy(p_mcb + TSR_MCB_NAME, MK_FP(g_resident_psp - 1U, TSR_MCB_NAME), TSR_MCB_NAME_SIZE); // for MEM /C
+
+    _dos_setblock(block_end - split_mcb - 1U, split_mcb + 1U, &max_paragraphs); // DOS may have merged the free block after it
+
+    return true;
+} /* tsr_split_resident_block() */
+
+static void IRQ_FAR_INTERRUPT tsr_api_handler(union INTPACK r);
+
+/*!
+ * @brief Removes the resident player.
+ *
+ * @return TSR_ERROR_NONE, or TSR_ERROR_VECTOR_HOOKED if the API interrupt no longer leads to the player.
+ */
+static e_tsr_error_t
+tsr_uninstall(void)
+{
+    if (irq_get_vector(g_config.interrupt_number) != (interrupt_handler_t)&tsr_api_handler)
+    {
+        return TSR_ERROR_VECTOR_HOOKED;
+    }
+
+    tsr_stop();
+    g_config.p_terminate();
+
+    irq_set_vector(g_config.interrupt_number, g_p_old_api_handler);
+
+    tsr_free_resident_memory();
+
+    return TSR_ERROR_NONE;
+} /* tsr_uninstall() */
+
+/*!
+ * @brief Runs an API call on the resident stack (see tsr_api_handler()).
+ */
+static void
+tsr_api_service(void)
+{
+    union INTPACK * const p_registers = g_p_api_registers;
+
+    _enable(); // timer_stop() waits for the playback interrupt
+
+    e_tsr_error_t error  = TSR_ERROR_NONE;
+    uint16_t      result = 0;
+
+    switch (p_registers->h.ah)
+    {
+        case TSR_FUNCTION_INSTALL_CHECK:
+            result            = TSR_SIGNATURE;
+            p_registers->w.bx = TSR_API_VERSION;
+            break;
+
+        case TSR_FUNCTION_LOAD:
+            error = tsr_load((char const *)MK_FP(p_registers->w.ds, p_registers->w.dx));
+            break;
+
+        case TSR_FUNCTION_PLAY:
+            error = tsr_play(p_registers->w.bx);
+            break;
+
+        case TSR_FUNCTION_STOP:
+            tsr_stop();
+            break;
+
+        case TSR_FUNCTION_VOLUME:
+            zsm_set_volume((p_registers->h.bl > ZSM_VOLUME_MAX) ? ZSM_VOLUME_MAX : p_registers->h.bl);
+            break;
+
+        case TSR_FUNCTION_STATUS:
+            result = (g_ram_handle ? TSR_STATUS_LOADED : 0) | ((g_b_playing && zsm_is_playing()) ? TSR_STATUS_PLAYING : 0);
+            p_registers->h.bl = zsm_get_volume();
+            p_registers->w.cx = g_ram_handle ? zsm_get_header().tick_rate : 0;
+            break;
+
+        case TSR_FUNCTION_UNINSTALL:
+            error = tsr_uninstall();
+            break;
+
+        default:
+            error = TSR_ERROR_UNKNOWN_FUNCTION;
+            break;
+    }
+
+    if (error != TSR_ERROR_NONE)
+    {
+        p_registers->w.ax     = error;
+        p_registers->w.flags |= INTR_CF;
+    }
+    else
+    {
+        p_registers->w.ax     = result;
+        p_registers->w.flags &= ~INTR_CF;
+    }
+} /* tsr_api_service() */
+
+/*!
+ * @brief Software interrupt API of the resident player (see tsr.h).
+ *
+ * @note Switches to the resident stack: the caller's stack may be small, and the C code expects SS to be DGROUP.
+ *
+ * @param[in,out] r Registers of the caller.
+ */
+static void IRQ_FAR_INTERRUPT
+tsr_api_handler(union INTPACK r)
+{
+    g_p_api_registers = &r;
+
+    irq_run_on_stack(&g_stack, &tsr_api_service);
+} /* tsr_api_handler() */
+
+/*!
+ * @brief Checks if a software interrupt vector is free (unset or pointing at an IRET).
+ *
+ * @param[in] p_handler The interrupt handler.
+ *
+ * @return true if the vector is free, otherwise false.
+ */
+static bool
+tsr_is_vector_free(interrupt_handler_t const p_handler)
+{
+    return (p_handler == NULL) || (*(uint8_t const __far *)p_handler == TSR_OPCODE_IRET);
+} /* tsr_is_vector_free() */
+
+#endif
+
+/*!
+ * @brief Plays the song in the background and terminates, staying resident.
+ *
+ * @note The chips must be initialized and the song set up (p_config->p_initialize()) already. Reports the resident
+ *       size and the measured per-tick cost of playback before going resident. Keeps the whole program block if
+ *       the image was not linked transient part first.
+ *
+ * @param[in] p_config     Resident player configuration.
+ * @param[in] p_ram_handle The loaded song.
+ *
+ * @return Only returns on failure, with the reason.
+ */
+e_tsr_error_t
+tsr_install(tsr_config_t const * const p_config, ram_handle_t const p_ram_handle)
+{
+#if defined(_M_I86)
+    interrupt_handler_t const p_old_handler = irq_get_vector(p_config->interrupt_number);
+
+    if (tsr_is_vector_free(p_old_handler) == false)
+    {
+        return TSR_ERROR_VECTOR_IN_USE;
+    }
+
+    g_config            = *p_config;
+    g_ram_handle        = p_ram_handle;
+    g_resident_psp      = _psp;
+    g_p_old_api_handler = p_old_handler;
+
+    zsm_start(g_config.zsm_repeat);
+    timer_set_stack(&g_stack);
+    timer_start(g_config.saaym_config.irq_number, zsm_get_header().tick_rate, &zsm_update);
+    g_b_playing = true;
+
+    delay(TSR_COST_WINDOW_MS);
+
+    uint16_t const tick_cost  = timer_get_tick_cost_in_microseconds();
+    uint32_t const permille   = ((uint32_t)tick_cost * zsm_get_header().tick_rate) / TSR_PERMILLE_SCALE; // of one second
+    uint16_t const block_end  = g_resident_psp + *(uint16_t const __far *)MK_FP(g_resident_psp - 1U, TSR_MCB_SIZE);
+    uint16_t const split_mcb  = tsr_get_split_mcb(block_end);
+    uint16_t const env        = *(uint16_t const __far *)MK_FP(g_resident_psp, TSR_PSP_ENVIRONMENT);
+
+    // Keep the PSP and the resident block (with its MCB), or the whole program block.
+    bool     const b_split    = (split_mcb != 0) && tsr_split_resident_block(split_mcb, block_end);
+    uint16_t const paragraphs = b_split ? TSR_PSP_PARAGRAPHS : (block_end - g_resident_psp);
+    uint16_t const resident   = b_split ? (TSR_PSP_PARAGRAPHS + (block_end - split_mcb)) : paragraphs;
+
+    _disable();
+    irq_set_vector(g_config.interrupt_number, (interrupt_handler_t)&tsr_api_handler);
+    _enable();
+
+    printf("Resident  : %lu bytes + %lu bytes song at %04X, API on INT %02Xh\n",
+           (unsigned long)resident << TSR_PARAGRAPH_SHIFT, (unsigned long)ram_get_size(p_ram_handle),
+           g_resident_psp, g_config.interrupt_number);
+    printf("Tick cost : %uus (%lu.%lu%% CPU)\n", tick_cost, (unsigned long)(permille / TSR_DECIMAL), (unsigned long)(permille % TSR_DECIMAL));
+    fflush(stdout);
+
+    if (env)
+    {
+        *(uint16_t __far *)MK_FP(g_resident_psp, TSR_PSP_ENVIRONMENT) = 0;
+        _dos_freemem(env);
+    }
+
+    _dos_keep(0, paragraphs);
+
+    return TSR_ERROR_NONE; // not reached
+#else
+    (void)p_config;
+    (void)p_ram_handle;
+
+    return TSR_ERROR_UNSUPPORTED;
+#endif
+} /* tsr_install() */
+
+/*!
+ * @brief Checks if the resident player answers on a software interrupt.
+ *
+ * @param[in] interrupt_number API software interrupt.
+ *
+ * @return true if the player is resident, otherwise false.
+ */
+bool
+tsr_is_installed(uint8_t const interrupt_number)
+{
+#if defined(_M_I86)
+    if (tsr_is_vector_free(irq_get_vector(interrupt_number)))
+    {
+        return false; // calling an unset vector would crash
+    }
+
+    union REGS regs;
+
+    regs.h.ah = TSR_FUNCTION_INSTALL_CHECK;
+    int86(interrupt_number, &regs, &regs);
+
+    return (regs.w.ax == TSR_SIGNATURE);
+#else
+    (void)interrupt_number;
+
+    return false;
+#endif
+} /* tsr_is_installed() */
+
+/*!
+ * @brief Calls a function of the resident player.
+ *
+ * @param[in] interrupt_number API software interrupt.
+ * @param[in] function         Function to call.
+ * @param[in] value            BX (BL for TSR_FUNCTION_VOLUME).
+ * @param[in] p_file_name      ZSM file name for TSR_FUNCTION_LOAD, otherwise NULL.
+ *
+ * @return TSR_ERROR_NONE, or the error the player returned.
+ */
+e_tsr_error_t
+tsr_call(uint8_t const interrupt_number, e_tsr_function_t const function, uint16_t const value, char const * const p_file_name)
+{
+#if defined(_M_I86)
+    if (tsr_is_installed(interrupt_number) == false)
+    {
+        return TSR_ERROR_NOT_INSTALLED;
+    }
+
+    union REGS   regs;
+    struct SREGS sregs;
+
+    segread(&sregs);
+    regs.h.ah = (uint8_t)function;
+    regs.w.bx = value;
+
+    if (p_file_name)
+    {
+        sregs.ds  = FP_SEG(p_file_name);
+        regs.w.dx = FP_OFF(p_file_name);
+    }
+
+    int86x(interrupt_number, &regs, &regs, &sregs);
+
+    return regs.w.cflag ? (e_tsr_error_t)regs.w.ax : TSR_ERROR_NONE;
+#else
+    (void)interrupt_number;
+    (void)function;
+    (void)value;
+    (void)p_file_name;
+
+    return TSR_ERROR_UNSUPPORTED;
+#endif
+} /* tsr_call() */
+
+/*!
+ * @brief Makes DOS allocate from upper memory blocks first (or restores the previous allocation strategy).
+ *
+ * @note Needs DOS 5 or later with UMBs (DOS=UMB); otherwise allocations simply stay in conventional memory.
+ *       Calls must be paired.
+ *
+ * @param[in] b_upper Allocate from upper memory first (true), restore (false).
+ */
+void
+tsr_prefer_upper_memory(bool const b_upper)
+{
+#if defined(_M_I86)
+    union REGS regs;
+
+    if (b_upper)
+    {
+        regs.h.ah = TSR_DOS_ALLOCATION;
+        regs.h.al = TSR_ALLOCATION_GET_STRATEGY;
+        intdos(&regs, &regs);
+        g_saved_strategy = regs.w.ax;
+
+        regs.h.ah = TSR_DOS_ALLOCATION;
+        regs.h.al = TSR_ALLOCATION_GET_UMB_LINK;
+        intdos(&regs, &regs);
+        g_saved_umb_link = regs.h.al;
+
+        regs.h.ah = TSR_DOS_ALLOCATION;
+        regs.h.al = TSR_ALLOCATION_SET_UMB_LINK;
+        regs.w.bx = 1;
+        intdos(&regs, &regs);
+
+        regs.h.ah = TSR_DOS_ALLOCATION;
+        regs.h.al = TSR_ALLOCATION_SET_STRATEGY;
+        regs.w.bx = TSR_STRATEGY_HIGH_FIRST;
+        intdos(&regs, &regs);
+    }
+    else
+    {
+        regs.h.ah = TSR_DOS_ALLOCATION;
+        regs.h.al = TSR_ALLOCATION_SET_STRATEGY;
+        regs.w.bx = g_saved_strategy;
+        intdos(&regs, &regs);
+
+        regs.h.ah = TSR_DOS_ALLOCATION;
+        regs.h.al = TSR_ALLOCATION_SET_UMB_LINK;
+        regs.w.bx = g_saved_umb_link;
+        intdos(&regs, &regs);
+    }
+#else
+    (void)b_upper;
+#endif
+} /* tsr_prefer_upper_memory() */
+
+/*** end of file ***/
@@ -0,0 +1,88 @@
+/** @file tsr.h
+ *
+ * @brief Resident (TSR) background player and its software interrupt API.
+ *
+ * @par
+ * The resident player answers on one software interrupt (TSR_INTERRUPT_DEFAULT unless chosen at install). Load AH
+ * with the function and call the interrupt from the foreground (not from an interrupt handler). On return the carry
+ * flag is clear on success, otherwise set with the e_tsr_error_t in AX.
+ *
+ *   AH  | Function      | In                         | Out
+ *   ----+---------------+----------------------------+-------------------------------------------------
+ *   00h | Install check |                            | AX = TSR_SIGNATURE, BX = TSR_API_VERSION
+ *   01h | Load          | DS:DX = ASCIIZ ZSM path    | stops playback first
+ *   02h | Play          | BX = repeat (-rN value)    | plays the loaded song from the start
+ *   03h | Stop          |                            | silences both chips
+ *   04h | Volume        | BL = volume (0-64)         |
+ *   05h | Status        |                            | AX = TSR_STATUS_*, BL = volume, CX = tick rate
+ *   FFh | Uninstall     |                            | frees the resident memory
+ *
+ * Calls and the playback interrupts run on a stack of the player's own; the caller's stack only holds the
+ * interrupt frame. Load opens the file through DOS, so call the API from the foreground only.
+ *
+ */
+
+#pragma once
+
+#define TSR_INTERRUPT_DEFAULT (0x65U)
+#define TSR_SIGNATURE         (0x5A53U) // 'ZS'
+#define TSR_API_VERSION       (0x0100U)
+
+#define TSR_STATUS_LOADED     (0x01U)
+#define TSR_STATUS_PLAYING    (0x02U)
+
+typedef enum
+{
+    TSR_FUNCTION_INSTALL_CHECK = 0x00,
+    TSR_FUNCTION_LOAD          = 0x01,
+    TSR_FUNCTION_PLAY          = 0x02,
+    TSR_FUNCTION_STOP          = 0x03,
+    TSR_FUNCTION_VOLUME        = 0x04,
+    TSR_FUNCTION_STATUS        = 0x05,
+    TSR_FUNCTION_UNINSTALL     = 0xFF
+} e_tsr_function_t;
+
+typedef enum
+{
+    TSR_ERROR_NONE,
+    TSR_ERROR_UNKNOWN_FUNCTION,
+    TSR_ERROR_UNABLE_TO_OPEN_FILE,
+    TSR_ERROR_INSUFFICIENT_MEMORY,
+    TSR_ERROR_BAD_ZSM,
+    TSR_ERROR_NOTHING_LOADED,
+    TSR_ERROR_VECTOR_IN_USE,   // install: the interrupt already has a handler
+    TSR_ERROR_VECTOR_HOOKED,   // uninstall: another program hooked the interrupt after the player
+    TSR_ERROR_NOT_INSTALLED,
+    TSR_ERROR_UNSUPPORTED      // 32-bit build
+} e_tsr_error_t;
+
+//--------------------------------------------------------------------
+#ifdef __cplusplus
+extern "C" {
+#endif
+//--------------------------------------------------------------------
+
+typedef e_zsm_result_t (*tsr_initialize_func_t)(saaym_config_t const * const p_saaym_config, ram_handle_t const p_ram_handle);
+typedef void (*tsr_terminate_func_t)(void);
+
+typedef struct
+{
+    saaym_config_t        saaym_config;
+    tsr_initialize_func_t p_initialize;     // sets up the player for a loaded song
+    tsr_terminate_func_t  p_terminate;      // shuts the chips down on uninstall
+    uint16_t              zsm_repeat;       // repeat for the song played at install
+    uint8_t               interrupt_number; // API software interrupt
+} tsr_config_t;
+
+e_tsr_error_t tsr_install(tsr_config_t const * const p_config, ram_handle_t const p_ram_handle);
+bool          tsr_is_installed(uint8_t const interrupt_number);
+e_tsr_error_t tsr_call(uint8_t const interrupt_number, e_tsr_function_t const function, uint16_t const value, char const * const p_file_name);
+void          tsr_prefer_upper_memory(bool const b_upper);
+
+//--------------------------------------------------------------------
+#ifdef __cplusplus
+}
+#endif
+//--------------------------------------------------------------------
+
+/*** end of file ***/
@@ -7,18 +7,53 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <conio.h>
+#include "irq.h"
 #include "ym2151.h"
 
+#pragma off (check_stack) // register writes are issued from the timer interrupt
+
 #define YM2151_REGISTER_COUNT  (256U)
 
 #define YM_CLOCK_RATIO_3579545 3495 // 3579545 / 1024
 #define YM_CLOCK_RATIO_4000000 3906 // 4000000 / 1024
 
+#define YM2151_CLOCK_3579545_IN_HZ (3579545UL)
+#define YM2151_CLOCK_4000000_IN_HZ (4000000UL)
+
 #define YM2151_START_TIMER_B (YM2151_RESET_TIMER_B | YM2151_IRQ_EN_TIMER_B | YM2151_LOAD_TIMER_B)
+#define YM2151_START_TIMER_A (YM2151_RESET_TIMER_A | YM2151_IRQ_EN_TIMER_A | YM2151_LOAD_TIMER_A)
+
+#define YM2151_SHIFT_CLKA_HI (2U)
+#define YM2151_MASK_CLKA_LO  (0x03U)
+
+#if defined(PCZSM_SAAYM_DIRECT)
+    #define YM2151_PORT_STORAGE // shared with ym2151_write_inline()
+#else
+    #define YM2151_PORT_STORAGE static
+#endif
+
+YM2151_PORT_STORAGE uint16_t g_ym2151_port_address = 0x22E;
+YM2151_PORT_STORAGE uint16_t g_ym2151_port_data    = 0x22F;
+static e_ym2151_clock_t      g_ym2151_clock        = YM2151_CLOCK_INVALID;
+static bool                  g_b_locked            = false;
 
-static uint16_t         g_port_address = 0x22E;
-static uint16_t         g_port_data    = 0x22F;
-static e_ym2151_clock_t g_ym2151_clock = YM2151_CLOCK_INVALID;
+static void ym2151_lock_begin(void);
+static void ym2151_lock_end(void);
+
+static irq_lock_region_t const g_lock_regions[] =
+{
+    IRQ_LOCK_REGION(g_ym2151_port_address),
+    IRQ_LOCK_REGION(g_ym2151_port_data),
+    IRQ_LOCK_REGION(g_ym2151_clock)
+};
+
+/*!
+ * @brief Start of the code reached at interrupt time (see irq_lock_code()).
+ */
+static void
+ym2151_lock_begin(void)
+{
+} /* ym2151_lock_begin() */
 
 /*!
  * @brief Waits until YM2151 is not busy
@@ -26,7 +61,7 @@ static e_ym2151_clock_t g_ym2151_clock = YM2151_CLOCK_INVALID;
 static void
 ym2151_wait_until_ready(void)
 {
-    while (inp(g_port_data) & YM2151_STATUS_WRITE_BUSY_FLAG)
+    while (inp(g_ym2151_port_data) & YM2151_STATUS_WRITE_BUSY_FLAG)
     {
         // wait until not busy
     }
@@ -44,6 +79,18 @@ ym2151_clear_all(void)
     }
 } /* ym2151_clear_all() */
 
+/*!
+ * @brief Points the driver at a YM2151 without touching its registers (for probing).
+ *
+ * @param[in] port_base_address The port base address where the YM2151 may reside.
+ */
+void
+ym2151_select_port(uint16_t const port_base_address)
+{
+    g_ym2151_port_address = port_base_address;
+    g_ym2151_port_data    = port_base_address + 1;
+} /* ym2151_select_port() */
+
 /*!
  * @brief Initializes YM2151 and other internal states.
  * 
@@ -53,8 +100,13 @@ ym2151_clear_all(void)
 void
 ym2151_initialize(uint16_t const port_base_address, e_ym2151_clock_t const clock)
 {
-    g_port_address = port_base_address;
-    g_port_data    = port_base_address + 1;
+    if (g_b_locked == false)
+    {
+        irq_lock_module("YM2151", &ym2151_lock_begin, &ym2151_lock_end, g_lock_regions, IRQ_LOCK_REGION_COUNT(g_lock_regions));
+        g_b_locked = true;
+    }
+
+    ym2151_select_port(port_base_address);
     g_ym2151_clock = clock;
 
     switch (clock)
@@ -92,12 +144,48 @@ void
 ym2151_write(uint8_t const address, uint8_t const data)
 {
     ym2151_wait_until_ready();
-    outp(g_port_address, address);
+    outp(g_ym2151_port_address, address);
 
     ym2151_wait_until_ready();
-    outp(g_port_data, data);
+    outp(g_ym2151_port_data, data);
 } /* ym2151_write() */
 
+/*!
+ * @brief Writes a burst of address/data pairs to the YM2151.
+ *
+ * @note Only the per write call overhead is removed: the ports are read once for the whole burst, but every write
+ *       still waits for the YM2151 to be ready before it is issued.
+ *
+ * @param[in] p_pairs Address/data pairs (address first).
+ * @param[in] count   Number of pairs.
+ */
+void
+ym2151_write_burst(uint8_t const * const p_pairs, uint8_t const count)
+{
+    uint16_t const port_address = g_ym2151_port_address;
+    uint16_t const port_data    = g_ym2151_port_data;
+
+    uint8_t const * p_pair = p_pairs;
+
+    for (uint8_t pair = 0; pair < count; ++pair)
+    {
+        uint8_t const address = *p_pair++;
+        uint8_t const data    = *p_pair++;
+
+        while (inp(port_data) & YM2151_STATUS_WRITE_BUSY_FLAG)
+        {
+            // wait until not busy
+        }
+        outp(port_address, address);
+
+        while (inp(port_data) & YM2151_STATUS_WRITE_BUSY_FLAG)
+        {
+            // wait until not busy
+        }
+        outp(port_data, data);
+    }
+} /* ym2151_write_burst() */
+
 /*!
  * @brief Sets the YM2151's Timer B value.
  * 
@@ -126,6 +214,28 @@ ym2151_set_timer_b_hz(uint16_t const rate_in_hertz)
     }
 } /* ym2151_set_timer_b_hz() */
 
+/*!
+ * @brief Sets the YM2151's Timer B from a period.
+ *
+ * @param[in] period The Timer B period in units of YM2151_TIMER_B_CLOCK_DIVIDER master clocks (1 to YM2151_TIMER_B_MAX_PERIOD).
+ */
+void
+ym2151_set_timer_b_period(uint16_t const period)
+{
+    ym2151_set_timer_b((uint8_t)(YM2151_TIMER_B_MAX_PERIOD - period));
+} /* ym2151_set_timer_b_period() */
+
+/*!
+ * @brief Gets the YM2151's master clock.
+ *
+ * @return The master clock in Hertz.
+ */
+uint32_t
+ym2151_get_clock_in_hz(void)
+{
+    return (g_ym2151_clock == YM2151_CLOCK_4000000_HZ) ? YM2151_CLOCK_4000000_IN_HZ : YM2151_CLOCK_3579545_IN_HZ;
+} /* ym2151_get_clock_in_hz() */
+
 /*!
  * @brief Enable (or disables) the YM2151's Timer B.
  *
@@ -137,6 +247,40 @@ ym2151_enable_timer_b(bool const b_enable)
     ym2151_write(YM2151_ADDRESS_TIMER, b_enable ? YM2151_START_TIMER_B : YM2151_RESET_TIMER_B); // Start/Stop Timer B
 } /* ym2151_enable_timer_b() */
 
+/*!
+ * @brief Sets the YM2151's Timer A value.
+ *
+ * @param[in] value The 10-bit Timer A value.
+ */
+void
+ym2151_set_timer_a(uint16_t const value)
+{
+    ym2151_write(YM2151_ADDRESS_CLKA_HI, (uint8_t)(value >> YM2151_SHIFT_CLKA_HI)); // set Timer A overflow (upper 8 bits)
+    ym2151_write(YM2151_ADDRESS_CLKA_LO, (uint8_t)(value & YM2151_MASK_CLKA_LO));  // set Timer A overflow (lower 2 bits)
+} /* ym2151_set_timer_a() */
+
+/*!
+ * @brief Sets the YM2151's Timer A from a period.
+ *
+ * @param[in] period The Timer A period in units of YM2151_TIMER_A_CLOCK_DIVIDER master clocks (1 to YM2151_TIMER_A_MAX_PERIOD).
+ */
+void
+ym2151_set_timer_a_period(uint16_t const period)
+{
+    ym2151_set_timer_a(YM2151_TIMER_A_MAX_PERIOD - period);
+} /* ym2151_set_timer_a_period() */
+
+/*!
+ * @brief Enable (or disables) the YM2151's Timer A.
+ *
+ * @param[in] b_enable Enable (true), Disable (false)
+ */
+void
+ym2151_enable_timer_a(bool const b_enable)
+{
+    ym2151_write(YM2151_ADDRESS_TIMER, b_enable ? YM2151_START_TIMER_A : YM2151_RESET_TIMER_A); // Start/Stop Timer A
+} /* ym2151_enable_timer_a() */
+
 /*!
  * @brief Reads the YM2151's status.
  *
@@ -144,7 +288,15 @@ ym2151_enable_timer_b(bool const b_enable)
  */
 uint8_t ym2151_read_status(void)
 {
-    return inp(g_port_data);
+    return inp(g_ym2151_port_data);
 } /* ym2151_read_status() */
 
+/*!
+ * @brief End of the code reached at interrupt time.
+ */
+static void
+ym2151_lock_end(void)
+{
+} /* ym2151_lock_end() */
+
 /*** end of file ***/
@@ -6,6 +6,10 @@
 
 #pragma once
 
+#if defined(PCZSM_SAAYM_DIRECT)
+    #include <conio.h> // inp() and outp() for ym2151_write_inline()
+#endif
+
 #define YM2151_ADDRESS_KON            (0x08U)
 #define YM2151_ADDRESS_CLKA_HI        (0x10U)
 #define YM2151_ADDRESS_CLKA_LO        (0x11U)
@@ -21,6 +25,10 @@
 #define YM2151_STATUS_TIMER_B_FLAG    (0x02U)
 #define YM2151_STATUS_WRITE_BUSY_FLAG (0x80U)
 #define YM2151_CHANNEL_COUNT          (0x08U)
+#define YM2151_TIMER_B_CLOCK_DIVIDER  (1024U) // master clocks per Timer B count
+#define YM2151_TIMER_B_MAX_PERIOD     (256U)  // Timer B counts per overflow at CLKB = 0
+#define YM2151_TIMER_A_CLOCK_DIVIDER  (64U)   // master clocks per Timer A count
+#define YM2151_TIMER_A_MAX_PERIOD     (1024U) // Timer A counts per overflow at CLKA = 0
 
 typedef enum
 {
@@ -40,14 +48,50 @@ extern "C" {
 #endif
 //--------------------------------------------------------------------
 
+void ym2151_select_port(uint16_t const port_base_address);
 void ym2151_initialize(uint16_t const port_base_address, e_ym2151_clock_t const clock);
 void ym2151_terminate(void);
 void ym2151_write(uint8_t const address, uint8_t const data);
+void ym2151_write_burst(uint8_t const * const p_pairs, uint8_t const count);
 void ym2151_set_timer_b(uint8_t const value);
 void ym2151_set_timer_b_hz(uint16_t const rate_in_hertz);
+void ym2151_set_timer_b_period(uint16_t const period);
+uint32_t ym2151_get_clock_in_hz(void);
 void ym2151_enable_timer_b(bool const b_enable);
+void ym2151_set_timer_a(uint16_t const value);
+void ym2151_set_timer_a_period(uint16_t const period);
+void ym2151_enable_timer_a(bool const b_enable);
 uint8_t ym2151_read_status(void);
 
+#if defined(PCZSM_SAAYM_DIRECT)
+extern uint16_t g_ym2151_port_address;
+extern uint16_t g_ym2151_port_data;
+
+/*!
+ * @brief Writes data to the YM2151 at the specified address, expanded in place at the call site.
+ *
+ * @note Only available in the SAAYM specialized build.
+ *
+ * @param[in] address Address of the YM2151 to write to.
+ * @param[in] data    Data to write to the specified address.
+ */
+static inline void
+ym2151_write_inline(uint8_t const address, uint8_t const data)
+{
+    while (inp(g_ym2151_port_data) & YM2151_STATUS_WRITE_BUSY_FLAG)
+    {
+        // wait until not busy
+    }
+    outp(g_ym2151_port_address, address);
+
+    while (inp(g_ym2151_port_data) & YM2151_STATUS_WRITE_BUSY_FLAG)
+    {
+        // wait until not busy
+    }
+    outp(g_ym2151_port_data, data);
+} /* ym2151_write_inline() */
+#endif
+
 //--------------------------------------------------------------------
 #ifdef __cplusplus
 }
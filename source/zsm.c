@@ -7,8 +7,46 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <string.h>
 #include "ram.h"
 #include "zsm.h"
+#include "vera.h"
+#include "telemetry.h"
+#include "irq.h"
+
+#pragma off (check_stack) // zsm_update() runs inside the timer interrupt
+
+#if defined(PCZSM_ASM_KERNEL)
+    // 8088 decode kernel (zsmk86.asm); handles PSG/FM writes and delays, returns delay ticks or 0 for C to decode.
+    extern uint8_t zsm_kernel_run(ram_bank_t * const p_ram_bank, uint16_t * const p_writes);
+
+    #define ZSM_KERNEL_STORAGE // register shadows are also updated by the kernel
+#else
+    #define ZSM_KERNEL_STORAGE static
+#endif
+
+#if defined(PCZSM_SAAYM_DIRECT)
+    // Playback core specialized for the SAAYM; register writes go straight to the drivers.
+    #include <conio.h>
+    #include "ym2151.h"
+    #include "saa1099.h"
+
+    #define ZSM_YM2151_WRITE(address, data)          ym2151_write_inline((address), (data))
+    #define ZSM_VERA_PSG_WRITE(address, data)        saa1099_vera_psg_write((address), (data))
+    #define ZSM_VERA_PSG_SET_VOLUME(volume)          saa1099_vera_psg_set_volume((volume))
+    #define ZSM_YM2151_WRITE_BURST(p_pairs, count)   ym2151_write_burst((p_pairs), (count))
+    #define ZSM_VERA_PSG_WRITE_BURST(p_pairs, count) saa1099_vera_psg_write_burst((p_pairs), (count))
+    #define ZSM_HAS_YM2151_WRITE_BURST()             (true)
+    #define ZSM_HAS_VERA_PSG_WRITE_BURST()           (true)
+#else
+    #define ZSM_YM2151_WRITE(address, data)          (*g_p_ym2151_write_func)((address), (data))
+    #define ZSM_VERA_PSG_WRITE(address, data)        (*g_p_vera_psg_write_func)((address), (data))
+    #define ZSM_VERA_PSG_SET_VOLUME(volume)          do { if (g_p_vera_psg_volume_func) { (*g_p_vera_psg_volume_func)((volume)); } } while (0)
+    #define ZSM_YM2151_WRITE_BURST(p_pairs, count)   (*g_p_ym2151_write_burst_func)((p_pairs), (count))
+    #define ZSM_VERA_PSG_WRITE_BURST(p_pairs, count) (*g_p_vera_psg_write_burst_func)((p_pairs), (count))
+    #define ZSM_HAS_YM2151_WRITE_BURST()             (g_p_ym2151_write_burst_func != NULL)
+    #define ZSM_HAS_VERA_PSG_WRITE_BURST()           (g_p_vera_psg_write_burst_func != NULL)
+#endif
 
 enum
 {
@@ -30,6 +68,52 @@ enum
 #define ZSM_MASK_CMD_DATA_FM_PAIRS    ((uint8_t)0x3FU)
 #define ZSM_MASK_CMD_DATA_DELAY       ((uint8_t)0x7FU)
 
+#define ZSM_KEY_EVENT_QUEUE_SIZE      (32U)
+#define ZSM_WRITE_PAIRS_SIZE          (ZSM_MASK_CMD_DATA_FM_PAIRS * 2U)
+#define ZSM_PSG_BURST_PAIRS           (ZSM_WRITE_PAIRS_SIZE / 2U)
+#define ZSM_YM2151_ADDRESS_KON        ((uint8_t)0x08U)
+#define ZSM_YM2151_ADDRESS_CHANNELS   ((uint8_t)0x20U)
+#define ZSM_YM2151_MASK_CHANNEL       ((uint8_t)0x07U)
+#define ZSM_YM2151_ADDRESS_CON        ((uint8_t)0x20U)
+#define ZSM_YM2151_ADDRESS_TL         ((uint8_t)0x60U)
+#define ZSM_YM2151_ADDRESS_KC         ((uint8_t)0x28U)
+#define ZSM_YM2151_ADDRESS_KF         ((uint8_t)0x30U)
+#define ZSM_YM2151_MASK_TL_RANGE      ((uint8_t)0xE0U)
+#define ZSM_YM2151_MASK_TL            ((uint8_t)0x7FU)
+#define ZSM_YM2151_MASK_CON           ((uint8_t)0x07U)
+#define ZSM_YM2151_SHIFT_OPERATOR     (3U)
+#define ZSM_YM2151_MASK_OPERATOR      ((uint8_t)0x03U)
+#define ZSM_YM2151_OPERATOR_COUNT     (4U)
+#define ZSM_YM2151_TL_MAX             ((uint8_t)0x7FU)
+#define ZSM_YM2151_ADDRESS_NOISE      ((uint8_t)0x0FU)
+#define ZSM_YM2151_ADDRESS_LFRQ       ((uint8_t)0x18U)
+#define ZSM_YM2151_ADDRESS_PMD_AMD    ((uint8_t)0x19U)
+#define ZSM_YM2151_ADDRESS_CT_W       ((uint8_t)0x1BU)
+#define ZSM_YM2151_SHIFT_PMD_SELECT   (7U)
+#define ZSM_YM2151_PMD_SELECT         ((uint8_t)0x80U)
+#define ZSM_YM2151_MASK_KEY_SLOTS     ((uint8_t)0x78U)
+#define ZSM_VERA_PSG_MASK_VOLUME      ((uint8_t)0x3FU)
+#define ZSM_VERA_PSG_MASK_MUTED       ((uint8_t)VERA_PSG_MASK_RIGHT_LEFT)
+#define ZSM_RESTORE_PAIRS_SIZE        (ZSM_YM2151_CHANNEL_COUNT * ZSM_YM2151_OPERATOR_COUNT * 2U)
+#define ZSM_RESTORE_PAIRS             (ZSM_RESTORE_PAIRS_SIZE / 2U)
+#define ZSM_DEFER_KC                  ((uint8_t)0x01U) // deferred YM2151 channel registers, per channel
+#define ZSM_DEFER_KF                  ((uint8_t)0x02U)
+#define ZSM_DEFER_SHIFT_TL            (2U)             // one bit per operator TL
+#define ZSM_PSG_DEFERRABLE_OFFSETS    ((uint8_t)((1U << VERA_PSG_OFFSET_FREQ_LO) | (1U << VERA_PSG_OFFSET_FREQ_HI)))
+
+typedef enum
+{
+    ZSM_CHIP_YM2151,
+    ZSM_CHIP_VERA_PSG
+} e_zsm_chip_t;
+
+typedef struct
+{
+    uint8_t chip;
+    uint8_t address;
+    uint8_t data;
+} zsm_key_event_t;
+
 #define RAM_UPDATE_POS() \
     if (g_ram_bank.p_current < (g_ram_bank.p_end - 1)) \
     { \
@@ -41,6 +125,17 @@ enum
         ram_get_bank(g_p_zsm_ram_handle, &g_ram_bank); \
     }
 
+/*!
+ * @brief Start of the code reached at interrupt time (see irq_lock_code()).
+ *
+ * @note The 8088 decode kernel (zsmk86.asm) only exists in the 16-bit build, where nothing is paged.
+ */
+static void
+zsm_lock_begin(void)
+{
+} /* zsm_lock_begin() */
+
+#if !defined(PCZSM_SAAYM_DIRECT)
 static void
 zsm_ym2151_write_func_null(uint8_t const address, uint8_t const data)
 {
@@ -55,9 +150,35 @@ zsm_vera_psg_func_null(uint8_t const address, uint8_t const data)
     (void)data;
 } /* zsm_vera_psg_func_null() */
 
+static ym2151_write_func_t         g_p_ym2151_write_func         = &zsm_ym2151_write_func_null;
+static vera_psg_write_func_t       g_p_vera_psg_write_func       = &zsm_vera_psg_func_null;
+static ym2151_write_burst_func_t   g_p_ym2151_write_burst_func   = NULL;
+static vera_psg_write_burst_func_t g_p_vera_psg_write_burst_func = NULL;
+static vera_psg_volume_func_t      g_p_vera_psg_volume_func      = NULL;
+#endif
+
+// Operators (M1, M2, C1, C2 in register order) acting as carriers for each YM2151 connection (algorithm).
+static uint8_t const g_ym2151_con_to_carriers[8] = { 0x08U, 0x08U, 0x08U, 0x08U, 0x0CU, 0x0EU, 0x0EU, 0x0FU };
+
+// Carrier TL attenuation (0.75 dB steps) for each master volume level; amplitude scales by volume / ZSM_VOLUME_MAX.
+static uint8_t const g_volume_to_tl_attenuation[ZSM_VOLUME_MAX + 1] =
+{
+    127U,  48U,  40U,  35U,  32U,  30U,  27U,  26U,  24U,  23U,  21U,  20U,  19U,  18U,  18U,  17U,
+     16U,  15U,  15U,  14U,  13U,  13U,  12U,  12U,  11U,  11U,  10U,  10U,  10U,   9U,   9U,   8U,
+      8U,   8U,   7U,   7U,   7U,   6U,   6U,   6U,   5U,   5U,   5U,   5U,   4U,   4U,   4U,   4U,
+      3U,   3U,   3U,   3U,   2U,   2U,   2U,   2U,   2U,   1U,   1U,   1U,   1U,   1U,   0U,   0U,
+      0U
+};
+
+ZSM_KERNEL_STORAGE uint8_t g_ym2151_shadow[ZSM_YM2151_REGISTER_COUNT];    // register values as the stream wrote them
+ZSM_KERNEL_STORAGE uint8_t g_vera_psg_shadow[ZSM_VERA_PSG_REGISTER_COUNT];
+ZSM_KERNEL_STORAGE uint8_t g_ym2151_key_ons[ZSM_YM2151_CHANNEL_COUNT];       // last KON written per channel
+ZSM_KERNEL_STORAGE uint8_t g_ym2151_lfo_depths[ZSM_YM2151_LFO_DEPTH_COUNT];  // AMD and PMD share register 0x19
+ZSM_KERNEL_STORAGE uint8_t g_tick_key_ons = 0;                                // key on events issued this tick
+ZSM_KERNEL_STORAGE uint8_t g_fm_mutes     = 0;
+ZSM_KERNEL_STORAGE uint8_t g_vera_psg_write_mask[ZSM_VERA_PSG_REGISTER_COUNT];  // clears the volume of muted channels
+
 static zsm_header_t          g_empty_header          = { 0 };
-static ym2151_write_func_t   g_p_ym2151_write_func   = &zsm_ym2151_write_func_null;
-static vera_psg_write_func_t g_p_vera_psg_write_func = &zsm_vera_psg_func_null;
 static ram_handle_t          g_p_zsm_ram_handle      = NULL;
 static bool                  g_play_stream           = false;
 static uint16_t              g_zsm_repeat            = 0;
@@ -65,8 +186,1008 @@ static uint8_t               g_delay_ticks           = 0;
 static uint8_t               g_repeat_count          = 0;
 static ram_bank_t            g_ram_bank;
 
+static e_zsm_write_order_t   g_write_order           = ZSM_WRITE_ORDER_STREAM;
+static zsm_key_event_t       g_key_events[ZSM_KEY_EVENT_QUEUE_SIZE];
+static uint8_t               g_key_event_count       = 0;
+static uint8_t               g_pending_fm_channels   = 0;
+static uint16_t              g_pending_psg_channels  = 0;
+static bool                  g_b_write_filter        = false; // true when every write must be inspected individually
+static uint8_t               g_write_pairs[ZSM_WRITE_PAIRS_SIZE];
+
+static uint8_t               g_fm_channel_mask       = 0;
+static uint16_t              g_psg_channel_mask      = 0;
+static uint8_t               g_volume                = ZSM_VOLUME_MAX;
+static uint8_t volatile      g_volume_requested      = ZSM_VOLUME_MAX;
+static uint8_t               g_tl_attenuation        = 0;
+static uint8_t               g_tl_remap[ZSM_YM2151_TL_MAX + 1];
+static uint8_t               g_fm_carriers[ZSM_YM2151_CHANNEL_COUNT];
+static uint16_t volatile     g_fade_ticks            = 0;
+static uint16_t              g_fade_ticks_left       = 0;
+static uint8_t               g_fade_start_volume     = 0;
+
+static uint16_t              g_psg_mutes             = 0;
+static uint8_t volatile      g_fm_mutes_requested    = 0;
+static uint16_t volatile     g_psg_mutes_requested   = 0;
+static uint8_t               g_tl_remap_muted[ZSM_YM2151_TL_MAX + 1];                // every level silenced
+static uint8_t const *       g_p_tl_remap[ZSM_YM2151_CHANNEL_COUNT];                 // carrier TL remap per channel
+static uint8_t               g_restore_pairs[ZSM_RESTORE_PAIRS_SIZE];
+static uint8_t               g_restore_pair_count    = 0;
+
+static uint16_t              g_write_budget          = 0;     // register writes per tick; 0 for no limit
+static uint16_t              g_tick_writes           = 0;     // register writes issued this tick
+static uint16_t              g_tick_count            = 0;
+static bool                  g_b_shedding            = false; // the tick went over budget; defer what can wait
+static uint8_t               g_fm_deferred[ZSM_YM2151_CHANNEL_COUNT];     // ZSM_DEFER_* bits
+static uint8_t               g_psg_deferred[ZSM_VERA_PSG_CHANNEL_COUNT];  // bits of VERA PSG register offsets
+static uint8_t               g_fm_deferred_channels  = 0;
+static uint16_t              g_psg_deferred_channels = 0;
+static uint32_t              g_deferred_writes       = 0;
+static uint32_t              g_superseded_writes     = 0;
+static bool                  g_b_locked              = false;
+
+static void zsm_lock_end(void);
+
+static irq_lock_region_t const g_lock_regions[] =
+{
+#if !defined(PCZSM_SAAYM_DIRECT)
+    IRQ_LOCK_REGION(g_p_ym2151_write_func),
+    IRQ_LOCK_REGION(g_p_vera_psg_write_func),
+    IRQ_LOCK_REGION(g_p_ym2151_write_burst_func),
+    IRQ_LOCK_REGION(g_p_vera_psg_write_burst_func),
+    IRQ_LOCK_REGION(g_p_vera_psg_volume_func),
+#endif
+    IRQ_LOCK_REGION(g_ym2151_con_to_carriers),
+    IRQ_LOCK_REGION(g_volume_to_tl_attenuation),
+    IRQ_LOCK_REGION(g_ym2151_shadow),
+    IRQ_LOCK_REGION(g_vera_psg_shadow),
+    IRQ_LOCK_REGION(g_ym2151_key_ons),
+    IRQ_LOCK_REGION(g_ym2151_lfo_depths),
+    IRQ_LOCK_REGION(g_tick_key_ons),
+    IRQ_LOCK_REGION(g_fm_mutes),
+    IRQ_LOCK_REGION(g_vera_psg_write_mask),
+    IRQ_LOCK_REGION(g_empty_header),
+    IRQ_LOCK_REGION(g_p_zsm_ram_handle),
+    IRQ_LOCK_REGION(g_play_stream),
+    IRQ_LOCK_REGION(g_zsm_repeat),
+    IRQ_LOCK_REGION(g_delay_ticks),
+    IRQ_LOCK_REGION(g_repeat_count),
+    IRQ_LOCK_REGION(g_ram_bank),
+    IRQ_LOCK_REGION(g_write_order),
+    IRQ_LOCK_REGION(g_key_events),
+    IRQ_LOCK_REGION(g_key_event_count),
+    IRQ_LOCK_REGION(g_pending_fm_channels),
+    IRQ_LOCK_REGION(g_pending_psg_channels),
+    IRQ_LOCK_REGION(g_b_write_filter),
+    IRQ_LOCK_REGION(g_write_pairs),
+    IRQ_LOCK_REGION(g_fm_channel_mask),
+    IRQ_LOCK_REGION(g_psg_channel_mask),
+    IRQ_LOCK_REGION(g_volume),
+    IRQ_LOCK_REGION(g_volume_requested),
+    IRQ_LOCK_REGION(g_tl_attenuation),
+    IRQ_LOCK_REGION(g_tl_remap),
+    IRQ_LOCK_REGION(g_fm_carriers),
+    IRQ_LOCK_REGION(g_fade_ticks),
+    IRQ_LOCK_REGION(g_fade_ticks_left),
+    IRQ_LOCK_REGION(g_fade_start_volume),
+    IRQ_LOCK_REGION(g_psg_mutes),
+    IRQ_LOCK_REGION(g_fm_mutes_requested),
+    IRQ_LOCK_REGION(g_psg_mutes_requested),
+    IRQ_LOCK_REGION(g_tl_remap_muted),
+    IRQ_LOCK_REGION(g_p_tl_remap),
+    IRQ_LOCK_REGION(g_restore_pairs),
+    IRQ_LOCK_REGION(g_restore_pair_count),
+    IRQ_LOCK_REGION(g_write_budget),
+    IRQ_LOCK_REGION(g_tick_writes),
+    IRQ_LOCK_REGION(g_tick_count),
+    IRQ_LOCK_REGION(g_b_shedding),
+    IRQ_LOCK_REGION(g_fm_deferred),
+    IRQ_LOCK_REGION(g_psg_deferred),
+    IRQ_LOCK_REGION(g_fm_deferred_channels),
+    IRQ_LOCK_REGION(g_psg_deferred_channels),
+    IRQ_LOCK_REGION(g_deferred_writes),
+    IRQ_LOCK_REGION(g_superseded_writes)
+};
+
+/*!
+ * @brief Recomputes whether decoded writes can be handed to the drivers unfiltered (in bursts or by the kernel).
+ */
+static void
+zsm_refresh_write_filter(void)
+{
+    // Mutes leave the write path alone; the unfiltered path diverts only the writes of muted channels.
+    g_b_write_filter = (g_write_order != ZSM_WRITE_ORDER_STREAM) || (g_tl_attenuation != 0) || (g_volume != ZSM_VOLUME_MAX) ||
+                       g_b_shedding || (g_fm_deferred_channels != 0) || (g_psg_deferred_channels != 0);
+} /* zsm_refresh_write_filter() */
+
+/*!
+ * @brief Drops every deferred write (the chips are about to be rewritten from the shadows).
+ */
+static void
+zsm_clear_deferred(void)
+{
+    memset(g_fm_deferred, 0, sizeof(g_fm_deferred));
+    memset(g_psg_deferred, 0, sizeof(g_psg_deferred));
+
+    g_fm_deferred_channels  = 0;
+    g_psg_deferred_channels = 0;
+    g_b_shedding            = false;
+} /* zsm_clear_deferred() */
+
+/*!
+ * @brief Counts register writes issued during the tick, starting to shed writes once the write budget is spent.
+ *
+ * @param[in] count Number of writes issued.
+ */
+static inline void
+zsm_count_writes(uint16_t const count)
+{
+    g_tick_writes += count;
+
+    if (g_write_budget)
+    {
+        if ((g_b_shedding == false) && (g_tick_writes >= g_write_budget))
+        {
+            g_b_shedding     = true;
+            g_b_write_filter = true; // the remaining writes of the tick must be inspected
+        }
+    }
+} /* zsm_count_writes() */
+
+/*!
+ * @brief Records a YM2151 global register write whose state the register shadow alone cannot hold.
+ *
+ * @param[in] address YM2151 register address (below ZSM_YM2151_ADDRESS_CHANNELS).
+ * @param[in] data    YM2151 register data.
+ */
+static void
+zsm_shadow_ym2151_global(uint8_t const address, uint8_t const data)
+{
+    if (address == ZSM_YM2151_ADDRESS_KON)
+    {
+        g_ym2151_key_ons[data & ZSM_YM2151_MASK_CHANNEL] = data;
+
+        if ((data & ZSM_YM2151_MASK_KEY_SLOTS) && (g_write_order != ZSM_WRITE_ORDER_KEY_BURST))
+        {
+            ++g_tick_key_ons; // queued key events are counted when zsm_flush_key_events() issues them
+        }
+    }
+    else if (address == ZSM_YM2151_ADDRESS_PMD_AMD)
+    {
+        g_ym2151_lfo_depths[data >> ZSM_YM2151_SHIFT_PMD_SELECT] = data;
+    }
+} /* zsm_shadow_ym2151_global() */
+
+/*!
+ * @brief Records a burst of YM2151 address/data pairs in the register shadow.
+ *
+ * @param[in] p_pairs Address/data pairs (address first).
+ * @param[in] count   Number of pairs.
+ */
+static void
+zsm_shadow_ym2151_pairs(uint8_t const * const p_pairs, uint8_t const count)
+{
+    uint8_t const * p_pair = p_pairs;
+
+    for (uint8_t pair = 0; pair < count; ++pair, p_pair += 2)
+    {
+        g_ym2151_shadow[p_pair[0]] = p_pair[1];
+
+        if (p_pair[0] < ZSM_YM2151_ADDRESS_CHANNELS)
+        {
+            zsm_shadow_ym2151_global(p_pair[0], p_pair[1]);
+        }
+    }
+} /* zsm_shadow_ym2151_pairs() */
+
+/*!
+ * @brief Issues the queued restore writes to a chip in one burst.
+ *
+ * @param[in] chip Chip the queued writes are destined for.
+ */
+static void
+zsm_flush_restore(e_zsm_chip_t const chip)
+{
+    uint8_t const * p_pair = g_restore_pairs;
+
+    if (g_restore_pair_count == 0)
+    {
+        return;
+    }
+
+    if (chip == ZSM_CHIP_YM2151)
+    {
+        if (ZSM_HAS_YM2151_WRITE_BURST())
+        {
+            ZSM_YM2151_WRITE_BURST(g_restore_pairs, g_restore_pair_count);
+        }
+        else
+        {
+            for (uint8_t pair = 0; pair < g_restore_pair_count; ++pair, p_pair += 2)
+            {
+                ZSM_YM2151_WRITE(p_pair[0], p_pair[1]);
+            }
+        }
+    }
+    else
+    {
+        if (ZSM_HAS_VERA_PSG_WRITE_BURST())
+        {
+            ZSM_VERA_PSG_WRITE_BURST(g_restore_pairs, g_restore_pair_count);
+        }
+        else
+        {
+            for (uint8_t pair = 0; pair < g_restore_pair_count; ++pair, p_pair += 2)
+            {
+                ZSM_VERA_PSG_WRITE(p_pair[0], p_pair[1]);
+            }
+        }
+    }
+
+    g_restore_pair_count = 0;
+} /* zsm_flush_restore() */
+
+/*!
+ * @brief Queues a register write that restores or re-levels a channel; issued by zsm_flush_restore().
+ *
+ * @param[in] chip    Chip the write is destined for (the queue is issued when full).
+ * @param[in] address Register address.
+ * @param[in] data    Register data.
+ */
+static void
+zsm_queue_restore(e_zsm_chip_t const chip, uint8_t const address, uint8_t const data)
+{
+    if (g_restore_pair_count == ZSM_RESTORE_PAIRS)
+    {
+        zsm_flush_restore(chip);
+    }
+
+    uint8_t * const p_pair = &g_restore_pairs[g_restore_pair_count << 1];
+
+    p_pair[0] = address;
+    p_pair[1] = data;
+
+    ++g_restore_pair_count;
+} /* zsm_queue_restore() */
+
+/*!
+ * @brief Rebuilds the carrier operators of every channel from the connection shadows.
+ *
+ * @note Carriers are not tracked while writes are unfiltered, except for muted channels.
+ */
+static void
+zsm_refresh_fm_carriers(void)
+{
+    for (uint8_t channel = 0; channel < ZSM_YM2151_CHANNEL_COUNT; ++channel)
+    {
+        g_fm_carriers[channel] = g_ym2151_con_to_carriers[g_ym2151_shadow[ZSM_YM2151_ADDRESS_CON + channel] & ZSM_YM2151_MASK_CON];
+    }
+} /* zsm_refresh_fm_carriers() */
+
+/*!
+ * @brief Gets the carrier attenuation currently applied to a channel.
+ *
+ * @param[in] channel YM2151 channel.
+ *
+ * @return Carrier attenuation (ZSM_YM2151_TL_MAX when muted).
+ */
+static inline uint8_t
+zsm_ym2151_channel_attenuation(uint8_t const channel)
+{
+    return (g_fm_mutes & (1U << channel)) ? ZSM_YM2151_TL_MAX : g_tl_attenuation;
+} /* zsm_ym2151_channel_attenuation() */
+
+/*!
+ * @brief Queues a channel's changed TL registers from the shadow, attenuating its carriers.
+ *
+ * @param[in] channel              YM2151 channel.
+ * @param[in] previous_carriers    Carrier operators as last written.
+ * @param[in] previous_attenuation Carrier attenuation as last written.
+ */
+static void
+zsm_ym2151_rewrite_tl(uint8_t const channel, uint8_t const previous_carriers, uint8_t const previous_attenuation)
+{
+    uint8_t const carriers = g_fm_carriers[channel];
+
+    for (uint8_t operator_index = 0; operator_index < ZSM_YM2151_OPERATOR_COUNT; ++operator_index)
+    {
+        uint8_t const operator_bit = 1U << operator_index;
+        uint8_t const address      = ZSM_YM2151_ADDRESS_TL + (operator_index << ZSM_YM2151_SHIFT_OPERATOR) + channel;
+        uint8_t const shadow       = g_ym2151_shadow[address];
+        uint8_t const total_level  = shadow & ZSM_YM2151_MASK_TL;
+
+        uint16_t const previous_level = (previous_carriers & operator_bit) ? (total_level + previous_attenuation) : total_level;
+        uint8_t  const level          = (carriers & operator_bit) ? g_p_tl_remap[channel][total_level] : total_level;
+
+        if (level != ((previous_level > ZSM_YM2151_TL_MAX) ? ZSM_YM2151_TL_MAX : previous_level))
+        {
+            zsm_queue_restore(ZSM_CHIP_YM2151, address, (shadow & ~ZSM_YM2151_MASK_TL) | level);
+        }
+    }
+} /* zsm_ym2151_rewrite_tl() */
+
+/*!
+ * @brief Applies a new master volume, rewriting only the registers whose output level changes.
+ *
+ * @param[in] volume Master volume (0 to ZSM_VOLUME_MAX).
+ */
+static void
+zsm_apply_volume(uint8_t const volume)
+{
+    uint8_t const previous_attenuation = g_tl_attenuation;
+    uint8_t const attenuation          = g_volume_to_tl_attenuation[volume];
+
+    g_volume         = volume;
+    g_tl_attenuation = attenuation;
+
+    for (uint8_t total_level = 0; total_level <= ZSM_YM2151_TL_MAX; ++total_level)
+    {
+        uint16_t const level = total_level + attenuation;
+
+        g_tl_remap[total_level] = (level > ZSM_YM2151_TL_MAX) ? ZSM_YM2151_TL_MAX : (uint8_t)level;
+    }
+
+    zsm_refresh_fm_carriers();
+
+    for (uint8_t channel = 0; channel < ZSM_YM2151_CHANNEL_COUNT; ++channel)
+    {
+        if ((g_fm_channel_mask & ~g_fm_mutes) & (1U << channel))
+        {
+            zsm_ym2151_rewrite_tl(channel, g_fm_carriers[channel], previous_attenuation);
+        }
+    }
+
+    zsm_flush_restore(ZSM_CHIP_YM2151);
+
+    ZSM_VERA_PSG_SET_VOLUME(volume);
+
+    for (uint8_t channel = 0; channel < ZSM_VERA_PSG_CHANNEL_COUNT; ++channel)
+    {
+        uint8_t const address = (channel << 2) + VERA_PSG_OFFSET_RL_VOLUME;
+        uint8_t const data    = g_vera_psg_shadow[address] & g_vera_psg_write_mask[address];
+
+        if ((g_psg_channel_mask & (1U << channel)) && (data & ZSM_VERA_PSG_MASK_VOLUME))
+        {
+            zsm_queue_restore(ZSM_CHIP_VERA_PSG, address, data);
+        }
+    }
+
+    zsm_flush_restore(ZSM_CHIP_VERA_PSG);
+
+    zsm_refresh_write_filter();
+} /* zsm_apply_volume() */
+
+/*!
+ * @brief Advances the master volume towards the requested volume or along the fade.
+ */
+static void
+zsm_update_volume(void)
+{
+    uint8_t volume = g_volume_requested;
+
+    if ((g_fade_ticks > 0) && (g_fade_ticks_left > 0))
+    {
+        --g_fade_ticks_left;
+
+        volume = (uint8_t)(((uint32_t)g_fade_start_volume * g_fade_ticks_left) / g_fade_ticks);
+        g_volume_requested = volume;
+    }
+
+    if (volume != g_volume)
+    {
+        zsm_apply_volume(volume);
+    }
+} /* zsm_update_volume() */
+
+/*!
+ * @brief Applies new channel mutes; muted channels are silenced and unmuted ones restored from the shadows.
+ *
+ * @param[in] fm_mutes  YM2151 channels to mute (bit per channel).
+ * @param[in] psg_mutes VERA PSG channels to mute (bit per channel).
+ */
+static void
+zsm_apply_mutes(uint8_t const fm_mutes, uint16_t const psg_mutes)
+{
+    uint8_t const  fm_changes  = (fm_mutes ^ g_fm_mutes) & g_fm_channel_mask;
+    uint16_t const psg_changes = (psg_mutes ^ g_psg_mutes) & g_psg_channel_mask;
+
+    zsm_refresh_fm_carriers();
+
+    for (uint8_t channel = 0; channel < ZSM_YM2151_CHANNEL_COUNT; ++channel)
+    {
+        uint8_t const channel_bit          = 1U << channel;
+        uint8_t const previous_attenuation = zsm_ym2151_channel_attenuation(channel);
+
+        g_fm_mutes = (fm_mutes & channel_bit) ? (g_fm_mutes | channel_bit) : (g_fm_mutes & ~channel_bit);
+        g_p_tl_remap[channel] = (fm_mutes & channel_bit) ? g_tl_remap_muted : g_tl_remap;
+
+        if (fm_changes & channel_bit)
+        {
+            zsm_ym2151_rewrite_tl(channel, g_fm_carriers[channel], previous_attenuation);
+        }
+    }
+
+    zsm_flush_restore(ZSM_CHIP_YM2151);
+
+    for (uint8_t channel = 0; channel < ZSM_VERA_PSG_CHANNEL_COUNT; ++channel)
+    {
+        uint16_t const channel_bit = 1U << channel;
+        uint8_t const  address     = (channel << 2) + VERA_PSG_OFFSET_RL_VOLUME;
+
+        g_vera_psg_write_mask[address] = (psg_mutes & channel_bit) ? ZSM_VERA_PSG_MASK_MUTED : 0xFFU;
+
+        if (psg_changes & channel_bit)
+        {
+            zsm_queue_restore(ZSM_CHIP_VERA_PSG, address, g_vera_psg_shadow[address] & g_vera_psg_write_mask[address]);
+        }
+    }
+
+    g_psg_mutes = psg_mutes;
+
+    zsm_flush_restore(ZSM_CHIP_VERA_PSG);
+
+    zsm_refresh_write_filter();
+} /* zsm_apply_mutes() */
+
+/*!
+ * @brief Applies channel mute changes requested since the previous tick.
+ */
+static void
+zsm_update_mutes(void)
+{
+    uint8_t const  fm_mutes  = g_fm_mutes_requested;
+    uint16_t const psg_mutes = g_psg_mutes_requested;
+
+    if ((fm_mutes != g_fm_mutes) || (psg_mutes != g_psg_mutes))
+    {
+        zsm_apply_mutes(fm_mutes, psg_mutes);
+    }
+} /* zsm_update_mutes() */
+
+/*!
+ * @brief Silences both chips with the fewest writes: key off and full carrier attenuation for sounding FM
+ *        channels, zero volume for sounding PSG channels. The register shadows are left untouched.
+ */
+static void
+zsm_silence(void)
+{
+    zsm_refresh_fm_carriers();
+
+    for (uint8_t channel = 0; channel < ZSM_YM2151_CHANNEL_COUNT; ++channel)
+    {
+        if (g_fm_channel_mask & (1U << channel))
+        {
+            if (g_ym2151_key_ons[channel] & ZSM_YM2151_MASK_KEY_SLOTS)
+            {
+                zsm_queue_restore(ZSM_CHIP_YM2151, ZSM_YM2151_ADDRESS_KON, channel);
+            }
+
+            for (uint8_t operator_index = 0; operator_index < ZSM_YM2151_OPERATOR_COUNT; ++operator_index)
+            {
+                if (g_fm_carriers[channel] & (1U << operator_index))
+                {
+                    zsm_queue_restore(ZSM_CHIP_YM2151, ZSM_YM2151_ADDRESS_TL + (operator_index << ZSM_YM2151_SHIFT_OPERATOR) + channel, ZSM_YM2151_TL_MAX);
+                }
+            }
+        }
+    }
+
+    zsm_flush_restore(ZSM_CHIP_YM2151);
+
+    for (uint8_t channel = 0; channel < ZSM_VERA_PSG_CHANNEL_COUNT; ++channel)
+    {
+        uint8_t const address = (channel << 2) + VERA_PSG_OFFSET_RL_VOLUME;
+        uint8_t const data    = g_vera_psg_shadow[address] & g_vera_psg_write_mask[address];
+
+        if ((g_psg_channel_mask & (1U << channel)) && (data & ZSM_VERA_PSG_MASK_VOLUME))
+        {
+            zsm_queue_restore(ZSM_CHIP_VERA_PSG, address, data & ~ZSM_VERA_PSG_MASK_VOLUME);
+        }
+    }
+
+    zsm_flush_restore(ZSM_CHIP_VERA_PSG);
+} /* zsm_silence() */
+
+/*!
+ * @brief Rewrites both chips from the register shadows, applying the current volume and mutes.
+ *
+ * @note Every channel is keyed off first, parameters follow and the key ons come last, so the
+ *       chips end up in the shadowed state whatever was written to them in between.
+ *       The YM2151 timer registers (0x10-0x14) belong to the timer and are not touched.
+ */
+static void
+zsm_restore(void)
+{
+    zsm_clear_deferred();
+
+    if (g_fm_channel_mask)
+    {
+        zsm_refresh_fm_carriers();
+
+        for (uint8_t channel = 0; channel < ZSM_YM2151_CHANNEL_COUNT; ++channel)
+        {
+            zsm_queue_restore(ZSM_CHIP_YM2151, ZSM_YM2151_ADDRESS_KON, channel);
+        }
+
+        zsm_queue_restore(ZSM_CHIP_YM2151, ZSM_YM2151_ADDRESS_NOISE, g_ym2151_shadow[ZSM_YM2151_ADDRESS_NOISE]);
+        zsm_queue_restore(ZSM_CHIP_YM2151, ZSM_YM2151_ADDRESS_LFRQ, g_ym2151_shadow[ZSM_YM2151_ADDRESS_LFRQ]);
+
+        for (uint8_t depth = 0; depth < ZSM_YM2151_LFO_DEPTH_COUNT; ++depth)
+        {
+            zsm_queue_restore(ZSM_CHIP_YM2151, ZSM_YM2151_ADDRESS_PMD_AMD, g_ym2151_lfo_depths[depth]);
+        }
+
+        zsm_queue_restore(ZSM_CHIP_YM2151, ZSM_YM2151_ADDRESS_CT_W, g_ym2151_shadow[ZSM_YM2151_ADDRESS_CT_W]);
+
+        for (uint16_t address = ZSM_YM2151_ADDRESS_CHANNELS; address < ZSM_YM2151_REGISTER_COUNT; ++address)
+        {
+            uint8_t const channel = address & ZSM_YM2151_MASK_CHANNEL;
+            uint8_t       data    = g_ym2151_shadow[address];
+
+            if (((address & ZSM_YM2151_MASK_TL_RANGE) == ZSM_YM2151_ADDRESS_TL) &&
+                (g_fm_carriers[channel] & (1U << ((address >> ZSM_YM2151_SHIFT_OPERATOR) & ZSM_YM2151_MASK_OPERATOR))))
+            {
+                data = (data & ~ZSM_YM2151_MASK_TL) | g_p_tl_remap[channel][data & ZSM_YM2151_MASK_TL];
+            }
+
+            zsm_queue_restore(ZSM_CHIP_YM2151, (uint8_t)address, data);
+        }
+
+        for (uint8_t channel = 0; channel < ZSM_YM2151_CHANNEL_COUNT; ++channel)
+        {
+            if (g_ym2151_key_ons[channel] & ZSM_YM2151_MASK_KEY_SLOTS)
+            {
+                zsm_queue_restore(ZSM_CHIP_YM2151, ZSM_YM2151_ADDRESS_KON, g_ym2151_key_ons[channel]);
+            }
+        }
+
+        zsm_flush_restore(ZSM_CHIP_YM2151);
+    }
+
+    if (g_psg_channel_mask)
+    {
+        for (uint8_t address = 0; address < ZSM_VERA_PSG_REGISTER_COUNT; ++address)
+        {
+            if (VERA_PSG_ADDRESS_TO_OFFSET(address) != VERA_PSG_OFFSET_RL_VOLUME)
+            {
+                zsm_queue_restore(ZSM_CHIP_VERA_PSG, address, g_vera_psg_shadow[address]);
+            }
+        }
+
+        for (uint8_t channel = 0; channel < ZSM_VERA_PSG_CHANNEL_COUNT; ++channel)
+        {
+            uint8_t const address = (channel << 2) + VERA_PSG_OFFSET_RL_VOLUME;
+
+            zsm_queue_restore(ZSM_CHIP_VERA_PSG, address, g_vera_psg_shadow[address] & g_vera_psg_write_mask[address]);
+        }
+
+        zsm_flush_restore(ZSM_CHIP_VERA_PSG);
+    }
+} /* zsm_restore() */
+
+/*!
+ * @brief Reads a command payload from the stream.
+ *
+ * @note The payload is returned in place when it does not cross a RAM bank; otherwise it is gathered into g_write_pairs.
+ *
+ * @param[in] size Payload size in bytes.
+ *
+ * @return Pointer to the contiguous payload.
+ */
+static uint8_t const *
+zsm_read_payload(uint8_t const size)
+{
+    uint8_t const * const p_payload = g_ram_bank.p_current;
+
+    if ((g_ram_bank.p_end - p_payload) > size) // strictly greater keeps p_current inside the bank like RAM_UPDATE_POS()
+    {
+        g_ram_bank.p_current += size;
+
+        return p_payload;
+    }
+
+    for (uint8_t index = 0; index < size; ++index)
+    {
+        g_write_pairs[index] = *g_ram_bank.p_current;
+        RAM_UPDATE_POS();
+    }
+
+    return g_write_pairs;
+} /* zsm_read_payload() */
+
+/*!
+ * @brief Issues all queued key events in the order they were decoded.
+ */
+static void
+zsm_flush_key_events(void)
+{
+    for (uint8_t index = 0; index < g_key_event_count; ++index)
+    {
+        zsm_key_event_t const * const p_key_event = &g_key_events[index];
+
+        if (p_key_event->chip == ZSM_CHIP_YM2151)
+        {
+            ZSM_YM2151_WRITE(p_key_event->address, p_key_event->data);
+
+            if (p_key_event->data & ZSM_YM2151_MASK_KEY_SLOTS)
+            {
+                ++g_tick_key_ons;
+            }
+        }
+        else
+        {
+            ZSM_VERA_PSG_WRITE(p_key_event->address, p_key_event->data);
+        }
+    }
+
+    zsm_count_writes(g_key_event_count);
+
+    g_key_event_count      = 0;
+    g_pending_fm_channels  = 0;
+    g_pending_psg_channels = 0;
+} /* zsm_flush_key_events() */
+
+/*!
+ * @brief Queues a key event for the next key burst.
+ *
+ * @param[in] chip    Chip the key event is destined for.
+ * @param[in] address Register address.
+ * @param[in] data    Register data.
+ */
+static void
+zsm_queue_key_event(e_zsm_chip_t const chip, uint8_t const address, uint8_t const data)
+{
+    if (g_key_event_count == ZSM_KEY_EVENT_QUEUE_SIZE)
+    {
+        zsm_flush_key_events(); // queue full; issue what is pending now rather than dropping events
+    }
+
+    zsm_key_event_t * const p_key_event = &g_key_events[g_key_event_count++];
+
+    p_key_event->chip    = (uint8_t)chip;
+    p_key_event->address = address;
+    p_key_event->data    = data;
+} /* zsm_queue_key_event() */
+
+/*!
+ * @brief Issues a YM2151 register write, remapping carrier TLs to the master volume.
+ *
+ * @param[in] address YM2151 register address.
+ * @param[in] data    YM2151 register data.
+ */
+static inline void
+zsm_ym2151_issue(uint8_t const address, uint8_t const data)
+{
+    zsm_count_writes(1);
+
+    if ((address & ZSM_YM2151_MASK_TL_RANGE) == ZSM_YM2151_ADDRESS_TL)
+    {
+        uint8_t const channel      = address & ZSM_YM2151_MASK_CHANNEL;
+        uint8_t const operator_bit = 1U << ((address >> ZSM_YM2151_SHIFT_OPERATOR) & ZSM_YM2151_MASK_OPERATOR);
+
+        if (g_fm_carriers[channel] & operator_bit)
+        {
+            ZSM_YM2151_WRITE(address, (data & ~ZSM_YM2151_MASK_TL) | g_p_tl_remap[channel][data & ZSM_YM2151_MASK_TL]);
+            return;
+        }
+    }
+
+    ZSM_YM2151_WRITE(address, data);
+} /* zsm_ym2151_issue() */
+
+/*!
+ * @brief Gets the deferral bit of a YM2151 register that may be deferred under load.
+ *
+ * @note Only pitch (KC, KF) and level (TL) writes are deferred; a later write of the same register supersedes them.
+ *
+ * @param[in] address YM2151 register address.
+ *
+ * @return ZSM_DEFER_* bit, or 0 if the register is never deferred.
+ */
+static inline uint8_t
+zsm_ym2151_defer_bit(uint8_t const address)
+{
+    uint8_t const channel_register = address & ~ZSM_YM2151_MASK_CHANNEL;
+
+    if (channel_register == ZSM_YM2151_ADDRESS_KC)
+    {
+        return ZSM_DEFER_KC;
+    }
+
+    if (channel_register == ZSM_YM2151_ADDRESS_KF)
+    {
+        return ZSM_DEFER_KF;
+    }
+
+    if ((address & ZSM_YM2151_MASK_TL_RANGE) == ZSM_YM2151_ADDRESS_TL)
+    {
+        return (uint8_t)(1U << (ZSM_DEFER_SHIFT_TL + ((address >> ZSM_YM2151_SHIFT_OPERATOR) & ZSM_YM2151_MASK_OPERATOR)));
+    }
+
+    return 0;
+} /* zsm_ym2151_defer_bit() */
+
+/*!
+ * @brief Issues the deferred writes of a YM2151 channel with the latest values from the shadow.
+ *
+ * @param[in] channel YM2151 channel.
+ */
+static void
+zsm_flush_deferred_fm(uint8_t const channel)
+{
+    uint8_t const deferred = g_fm_deferred[channel];
+
+    g_fm_deferred[channel]  = 0;
+    g_fm_deferred_channels &= (uint8_t)~(1U << channel);
+
+    if (deferred & ZSM_DEFER_KC)
+    {
+        zsm_ym2151_issue(ZSM_YM2151_ADDRESS_KC | channel, g_ym2151_shadow[ZSM_YM2151_ADDRESS_KC | channel]);
+    }
+
+    if (deferred & ZSM_DEFER_KF)
+    {
+        zsm_ym2151_issue(ZSM_YM2151_ADDRESS_KF | channel, g_ym2151_shadow[ZSM_YM2151_ADDRESS_KF | channel]);
+    }
+
+    for (uint8_t operator_index = 0; operator_index < ZSM_YM2151_OPERATOR_COUNT; ++operator_index)
+    {
+        if (deferred & (1U << (ZSM_DEFER_SHIFT_TL + operator_index)))
+        {
+            uint8_t const address = ZSM_YM2151_ADDRESS_TL + (operator_index << ZSM_YM2151_SHIFT_OPERATOR) + channel;
+
+            zsm_ym2151_issue(address, g_ym2151_shadow[address]);
+        }
+    }
+} /* zsm_flush_deferred_fm() */
+
+/*!
+ * @brief Issues the deferred frequency writes of a VERA PSG channel with the latest values from the shadow.
+ *
+ * @param[in] channel VERA PSG channel.
+ */
+static void
+zsm_flush_deferred_psg(uint8_t const channel)
+{
+    uint8_t const deferred = g_psg_deferred[channel];
+
+    g_psg_deferred[channel]  = 0;
+    g_psg_deferred_channels &= (uint16_t)~(1U << channel);
+
+    for (uint8_t offset = VERA_PSG_OFFSET_FREQ_LO; offset <= VERA_PSG_OFFSET_FREQ_HI; ++offset)
+    {
+        if (deferred & (1U << offset))
+        {
+            uint8_t const address = (channel << 2) + offset;
+
+            zsm_count_writes(1);
+            ZSM_VERA_PSG_WRITE(address, g_vera_psg_shadow[address]);
+        }
+    }
+} /* zsm_flush_deferred_psg() */
+
+/*!
+ * @brief Issues deferred writes until the tick's write count reaches the limit; the rest wait for a later tick.
+ *
+ * @param[in] write_limit Tick write count to stop at (the write budget, or UINT16_MAX for all).
+ */
+static void
+zsm_flush_deferred(uint16_t const write_limit)
+{
+    for (uint8_t channel = 0; (channel < ZSM_YM2151_CHANNEL_COUNT) && (g_tick_writes < write_limit); ++channel)
+    {
+        if (g_fm_deferred_channels & (1U << channel))
+        {
+            zsm_flush_deferred_fm(channel);
+        }
+    }
+
+    for (uint8_t channel = 0; (channel < ZSM_VERA_PSG_CHANNEL_COUNT) && (g_tick_writes < write_limit); ++channel)
+    {
+        if (g_psg_deferred_channels & (1U << channel))
+        {
+            zsm_flush_deferred_psg(channel);
+        }
+    }
+} /* zsm_flush_deferred() */
+
+/*!
+ * @brief Writes a YM2151 register, gathering key on/off writes when key bursts are enabled.
+ *
+ * @note Over the write budget, pitch and level writes are deferred (see zsm_ym2151_defer_bit()). A key on/off
+ *       first issues the channel's deferred writes, so notes always start with their latest pitch and level.
+ *
+ * @param[in] address YM2151 register address.
+ * @param[in] data    YM2151 register data.
+ */
+static inline void
+zsm_ym2151_write(uint8_t const address, uint8_t const data)
+{
+    g_ym2151_shadow[address] = data;
+
+    if (address < ZSM_YM2151_ADDRESS_CHANNELS)
+    {
+        zsm_shadow_ym2151_global(address, data);
+
+        if ((address == ZSM_YM2151_ADDRESS_KON) && (g_fm_deferred_channels & (1U << (data & ZSM_YM2151_MASK_CHANNEL))))
+        {
+            zsm_flush_deferred_fm(data & ZSM_YM2151_MASK_CHANNEL);
+        }
+    }
+
+    if (g_write_order == ZSM_WRITE_ORDER_KEY_BURST)
+    {
+        if (address == ZSM_YM2151_ADDRESS_KON)
+        {
+            g_pending_fm_channels |= (uint8_t)(1U << (data & ZSM_YM2151_MASK_CHANNEL));
+            zsm_queue_key_event(ZSM_CHIP_YM2151, address, data);
+            return;
+        }
+
+        // A channel register write must not overtake a key event already queued for that channel.
+        if ((address >= ZSM_YM2151_ADDRESS_CHANNELS) && (g_pending_fm_channels & (1U << (address & ZSM_YM2151_MASK_CHANNEL))))
+        {
+            zsm_flush_key_events();
+        }
+    }
+
+    uint8_t const defer_bit = zsm_ym2151_defer_bit(address);
+
+    if (defer_bit)
+    {
+        uint8_t const channel = address & ZSM_YM2151_MASK_CHANNEL;
+
+        if (g_fm_deferred[channel] & defer_bit)
+        {
+            ++g_superseded_writes; // the deferred value is never issued
+        }
+
+        if (g_b_shedding)
+        {
+            g_fm_deferred[channel] |= defer_bit;
+            g_fm_deferred_channels |= (uint8_t)(1U << channel);
+            ++g_deferred_writes;
+            return;
+        }
+
+        g_fm_deferred[channel] &= (uint8_t)~defer_bit;
+    }
+
+    zsm_ym2151_issue(address, data);
+
+    if ((address & ~ZSM_YM2151_MASK_CHANNEL) == ZSM_YM2151_ADDRESS_CON)
+    {
+        // A new connection moves the carriers; re-level the operators that changed role.
+        uint8_t const channel           = address & ZSM_YM2151_MASK_CHANNEL;
+        uint8_t const previous_carriers = g_fm_carriers[channel];
+
+        g_fm_carriers[channel] = g_ym2151_con_to_carriers[data & ZSM_YM2151_MASK_CON];
+
+        if (g_fm_carriers[channel] != previous_carriers)
+        {
+            zsm_ym2151_rewrite_tl(channel, previous_carriers, zsm_ym2151_channel_attenuation(channel));
+            zsm_flush_restore(ZSM_CHIP_YM2151);
+        }
+    }
+} /* zsm_ym2151_write() */
+
+/*!
+ * @brief Issues YM2151 address/data pairs decoded from the stream in one burst.
+ *
+ * @param[in] p_pairs Address/data pairs (address first).
+ * @param[in] count   Number of pairs.
+ */
+static inline void
+zsm_ym2151_issue_burst(uint8_t const * const p_pairs, uint8_t const count)
+{
+    zsm_shadow_ym2151_pairs(p_pairs, count);
+    ZSM_YM2151_WRITE_BURST(p_pairs, count);
+    zsm_count_writes(count);
+} /* zsm_ym2151_issue_burst() */
+
+/*!
+ * @brief Issues YM2151 address/data pairs while FM channels are muted, in stream order.
+ *
+ * @note Only the channel registers of muted channels go through zsm_ym2151_write(); the runs of pairs in between
+ *       are still issued in bursts, so the unmuted channels are written as they would be without mutes.
+ *
+ * @param[in] p_pairs Address/data pairs (address first).
+ * @param[in] count   Number of pairs.
+ */
+static void
+zsm_ym2151_issue_burst_muted(uint8_t const * const p_pairs, uint8_t const count)
+{
+    uint8_t run_start = 0;
+
+    for (uint8_t pair = 0; pair < count; ++pair)
+    {
+        uint8_t const address = p_pairs[pair << 1];
+
+        if ((address >= ZSM_YM2151_ADDRESS_CHANNELS) && (g_fm_mutes & (1U << (address & ZSM_YM2151_MASK_CHANNEL))))
+        {
+            if (pair > run_start)
+            {
+                zsm_ym2151_issue_burst(&p_pairs[run_start << 1], pair - run_start);
+            }
+
+            zsm_ym2151_write(address, p_pairs[(pair << 1) + 1]);
+
+            run_start = pair + 1;
+        }
+    }
+
+    if (count > run_start)
+    {
+        zsm_ym2151_issue_burst(&p_pairs[run_start << 1], count - run_start);
+    }
+} /* zsm_ym2151_issue_burst_muted() */
+
+/*!
+ * @brief Writes a VERA PSG register, gathering volume (key on/off) writes when key bursts are enabled.
+ *
+ * @note Over the write budget, frequency writes are deferred; a volume write first issues the channel's
+ *       deferred frequency. Volume writes key notes on and off and are never deferred.
+ *
+ * @param[in] address     VERA PSG register address.
+ * @param[in] stream_data VERA PSG register data as decoded from the stream.
+ */
+static inline void
+zsm_vera_psg_write(uint8_t const address, uint8_t const stream_data)
+{
+    uint8_t  const data        = stream_data & g_vera_psg_write_mask[address]; // muted channels keep a zero volume
+    uint8_t  const channel     = VERA_PSG_ADDRESS_TO_CHANNEL(address);
+    uint8_t  const offset_bit  = 1U << VERA_PSG_ADDRESS_TO_OFFSET(address);
+    uint16_t const channel_bit = 1U << channel;
+
+    g_vera_psg_shadow[address] = stream_data;
+
+    if ((VERA_PSG_ADDRESS_TO_OFFSET(address) == VERA_PSG_OFFSET_RL_VOLUME) && (g_psg_deferred_channels & channel_bit))
+    {
+        zsm_flush_deferred_psg(channel);
+    }
+
+    if (g_write_order == ZSM_WRITE_ORDER_KEY_BURST)
+    {
+        if (VERA_PSG_ADDRESS_TO_OFFSET(address) == VERA_PSG_OFFSET_RL_VOLUME)
+        {
+            g_pending_psg_channels |= channel_bit;
+            zsm_queue_key_event(ZSM_CHIP_VERA_PSG, address, data);
+            return;
+        }
+
+        if (g_pending_psg_channels & channel_bit)
+        {
+            zsm_flush_key_events();
+        }
+    }
+
+    if (offset_bit & ZSM_PSG_DEFERRABLE_OFFSETS)
+    {
+        if (g_psg_deferred[channel] & offset_bit)
+        {
+            ++g_superseded_writes;
+        }
+
+        if (g_b_shedding)
+        {
+            g_psg_deferred[channel] |= offset_bit;
+            g_psg_deferred_channels |= channel_bit;
+            ++g_deferred_writes;
+            return;
+        }
+
+        g_psg_deferred[channel] &= (uint8_t)~offset_bit;
+    }
+
+    zsm_count_writes(1);
+    ZSM_VERA_PSG_WRITE(address, data);
+} /* zsm_vera_psg_write() */
+
 /*!
  * @brief Intializes the ZSM playback system.
+ *
+ * @note In the SAAYM specialized build (PCZSM_SAAYM_DIRECT) the write functions are only checked for presence;
+ *       writes always go straight to ym2151_write_inline() and saa1099_vera_psg_write(), so both chips are
+ *       required there (ZSM_MISSING_CHIP otherwise).
  * 
  * @param[in] p_zsm_ram_handle      The ram handle to the ZSM data.
  * @param[in] p_ym2151_write_func   Pointer to the YM2151 write function.
@@ -79,6 +1200,14 @@ zsm_initialize(ram_handle_t p_zsm_ram_handle, ym2151_write_func_t const p_ym2151
 {
     if (p_zsm_ram_handle)
     {
+        if (g_b_locked == false)
+        {
+            irq_lock_module("ZSM", &zsm_lock_begin, &zsm_lock_end, g_lock_regions, IRQ_LOCK_REGION_COUNT(g_lock_regions));
+            g_b_locked = true;
+        }
+
+        ram_lock(p_zsm_ram_handle);
+
         g_p_zsm_ram_handle = p_zsm_ram_handle;
 
         zsm_header_t const * const p_header = (zsm_header_t const * const)ram_get_address(g_p_zsm_ram_handle, 0);
@@ -87,6 +1216,15 @@ zsm_initialize(ram_handle_t p_zsm_ram_handle, ym2151_write_func_t const p_ym2151
         {
             g_play_stream = false;
 
+#if defined(PCZSM_SAAYM_DIRECT)
+            if ((p_ym2151_write_func == NULL) || (p_vera_psg_write_func == NULL))
+            {
+                return ZSM_MISSING_CHIP; // writes can not be skipped here; an absent YM2151 would stall its busy wait
+            }
+
+            bool const b_has_ym2151   = (p_header->fm_channel_mask != 0);
+            bool const b_has_vera_psg = (p_header->psg_channel_mask != 0);
+#else
             if (p_header->fm_channel_mask && p_ym2151_write_func)
             {
                 g_p_ym2151_write_func = p_ym2151_write_func;
@@ -97,8 +1235,48 @@ zsm_initialize(ram_handle_t p_zsm_ram_handle, ym2151_write_func_t const p_ym2151
                 g_p_vera_psg_write_func = p_vera_psg_write_func;
             }
 
-            if ((g_p_ym2151_write_func != &zsm_ym2151_write_func_null) || (g_p_vera_psg_write_func != &zsm_vera_psg_func_null))
+            bool const b_has_ym2151   = (g_p_ym2151_write_func != &zsm_ym2151_write_func_null);
+            bool const b_has_vera_psg = (g_p_vera_psg_write_func != &zsm_vera_psg_func_null);
+#endif
+
+            if (b_has_ym2151 || b_has_vera_psg)
             {
+                g_fm_channel_mask  = b_has_ym2151 ? p_header->fm_channel_mask : 0;
+                g_psg_channel_mask = b_has_vera_psg ? p_header->psg_channel_mask : 0;
+
+                memset(g_ym2151_shadow, 0, sizeof(g_ym2151_shadow));
+                memset(g_vera_psg_shadow, 0, sizeof(g_vera_psg_shadow));
+                memset(g_ym2151_key_ons, 0, sizeof(g_ym2151_key_ons));
+
+                g_ym2151_lfo_depths[0] = 0;
+                g_ym2151_lfo_depths[1] = ZSM_YM2151_PMD_SELECT;
+                memset(g_fm_carriers, 0, sizeof(g_fm_carriers));
+
+                memset(g_tl_remap_muted, ZSM_YM2151_TL_MAX, sizeof(g_tl_remap_muted));
+                memset(g_vera_psg_write_mask, 0xFF, sizeof(g_vera_psg_write_mask));
+
+                for (uint8_t total_level = 0; total_level <= ZSM_YM2151_TL_MAX; ++total_level)
+                {
+                    g_tl_remap[total_level] = total_level; // unattenuated until the first volume change
+                }
+
+                for (uint8_t channel = 0; channel < ZSM_YM2151_CHANNEL_COUNT; ++channel)
+                {
+                    g_p_tl_remap[channel] = g_tl_remap;
+                }
+
+                g_volume              = ZSM_VOLUME_MAX;
+                g_tl_attenuation      = 0;
+                g_fm_mutes            = 0;
+                g_psg_mutes           = 0;
+                g_fm_mutes_requested  = 0;
+                g_psg_mutes_requested = 0;
+
+                zsm_clear_deferred();
+
+                g_deferred_writes   = 0;
+                g_superseded_writes = 0;
+
                 ram_seek_bank(g_p_zsm_ram_handle, sizeof(zsm_header_t), RAM_SEEK_ORIGIN_SET, &g_ram_bank);
 
                 return ZSM_SUCCESS;
@@ -126,6 +1304,32 @@ zsm_update(void)
         return;
     }
 
+    g_tick_writes  = 0;
+    g_tick_key_ons = 0;
+
+    if (g_write_budget)
+    {
+        g_b_shedding = false;
+
+        zsm_refresh_write_filter();
+    }
+
+    if (g_key_event_count > 0)
+    {
+        zsm_flush_key_events(); // key events decoded during the previous tick land at the start of this one
+    }
+
+    zsm_update_mutes();
+    zsm_update_volume();
+
+    if ((g_fade_ticks > 0) && (g_fade_ticks_left == 0))
+    {
+        // Fade out finished
+        g_play_stream = false;
+        g_fade_ticks  = 0;
+        return;
+    }
+
     if (g_delay_ticks > 0)
     {
         --g_delay_ticks;
@@ -133,6 +1337,22 @@ zsm_update(void)
 
     while (g_play_stream && (g_delay_ticks == 0))
     {
+#if defined(PCZSM_ASM_KERNEL)
+        if ((g_b_write_filter == false) && (g_write_budget == 0)) // the kernel only issues unfiltered writes and has no budget check
+        {
+            uint16_t writes = 0;
+
+            g_delay_ticks = zsm_kernel_run(&g_ram_bank, &writes);
+
+            zsm_count_writes(writes);
+
+            if (g_delay_ticks != 0)
+            {
+                continue;
+            }
+        }
+#endif
+
         uint8_t const command = *g_ram_bank.p_current;
         RAM_UPDATE_POS();
 
@@ -167,6 +1387,9 @@ zsm_update(void)
                     {
                         g_play_stream = false;
                         g_delay_ticks = 0;
+
+                        zsm_flush_deferred(UINT16_MAX);
+                        zsm_flush_key_events();
                     }
                 }
                 break;
@@ -181,21 +1404,67 @@ zsm_update(void)
 
                         RAM_UPDATE_POS();
 
-                        (*g_p_vera_psg_write_func)(address, data);
+                        if ((g_b_write_filter == false) && ZSM_HAS_VERA_PSG_WRITE_BURST())
+                        {
+                            // Gather the run of consecutive PSG writes and hand it over at once.
+                            uint8_t pairs = 1;
+
+                            g_write_pairs[0] = address;
+                            g_write_pairs[1] = data & g_vera_psg_write_mask[address]; // muted channels keep a zero volume
+
+                            g_vera_psg_shadow[address] = data;
+
+                            while ((pairs < ZSM_PSG_BURST_PAIRS) && (*g_ram_bank.p_current < ZSM_CMD_EXT))
+                            {
+                                uint8_t * const p_pair = &g_write_pairs[pairs << 1];
+
+                                p_pair[0] = *g_ram_bank.p_current & ZSM_MASK_CMD_DATA_PSG_ADDRESS;
+                                RAM_UPDATE_POS();
+                                g_vera_psg_shadow[p_pair[0]] = *g_ram_bank.p_current;
+
+                                p_pair[1] = *g_ram_bank.p_current & g_vera_psg_write_mask[p_pair[0]];
+                                RAM_UPDATE_POS();
+
+                                ++pairs;
+                            }
+
+                            ZSM_VERA_PSG_WRITE_BURST(g_write_pairs, pairs);
+                            zsm_count_writes(pairs);
+                        }
+                        else
+                        {
+                            zsm_vera_psg_write(address, data);
+                        }
                     }
                     else if (command < ZSM_CMD_EOF)
                     {
                         // FM write
                         uint8_t const register_value_pairs = (command & ZSM_MASK_CMD_DATA_FM_PAIRS);
 
-                        for(uint8_t register_value_pair = 0; register_value_pair < register_value_pairs; ++register_value_pair)
+                        if ((g_b_write_filter == false) && ZSM_HAS_YM2151_WRITE_BURST())
+                        {
+                            uint8_t const * const p_pairs = zsm_read_payload(register_value_pairs << 1);
+
+                            if (g_fm_mutes)
+                            {
+                                zsm_ym2151_issue_burst_muted(p_pairs, register_value_pairs);
+                            }
+                            else
+                            {
+                                zsm_ym2151_issue_burst(p_pairs, register_value_pairs);
+                            }
+                        }
+                        else
                         {
-                            uint8_t const address = *g_ram_bank.p_current;
-                            RAM_UPDATE_POS();
-                            uint8_t const data    = *g_ram_bank.p_current;
-                            RAM_UPDATE_POS();
+                            for(uint8_t register_value_pair = 0; register_value_pair < register_value_pairs; ++register_value_pair)
+                            {
+                                uint8_t const address = *g_ram_bank.p_current;
+                                RAM_UPDATE_POS();
+                                uint8_t const data    = *g_ram_bank.p_current;
+                                RAM_UPDATE_POS();
 
-                            (*g_p_ym2151_write_func)(address, data);
+                                zsm_ym2151_write(address, data);
+                            }
                         }
                     }
                     else
@@ -207,8 +1476,26 @@ zsm_update(void)
                 break;
         }
     }
+
+    bool const b_shedding = g_b_shedding;
+
+    if (g_fm_deferred_channels || g_psg_deferred_channels)
+    {
+        zsm_flush_deferred(g_write_budget); // catch up while the tick has budget left
+        zsm_refresh_write_filter();
+    }
+
+    telemetry_publish(g_tick_count++, g_tick_writes, g_tick_key_ons, b_shedding ? TELEMETRY_FLAG_SHEDDING : 0);
 } /* zsm_update() */
 
+/*!
+ * @brief End of the code reached at interrupt time.
+ */
+static void
+zsm_lock_end(void)
+{
+} /* zsm_lock_end() */
+
 /*!
  * @brief Start ZSM playback.
  * 
@@ -217,6 +1504,11 @@ zsm_update(void)
 void
 zsm_start(uint16_t const zsm_repeat)
 {
+    g_key_event_count      = 0;
+    g_pending_fm_channels  = 0;
+    g_pending_psg_channels = 0;
+
+    g_tick_count     = 0;
     g_delay_ticks    = 1;
     g_play_stream    = true;
     g_zsm_repeat     = zsm_repeat;
@@ -232,6 +1524,253 @@ zsm_stop(void)
     g_play_stream = false;
 } /* zsm_stop() */
 
+/*!
+ * @brief Suspends playback, capturing the chip state and stream position, and silences both chips.
+ *
+ * @note Call with the playback timer stopped. Use zsm_resume() to carry on where playback left off,
+ *       e.g. after pausing or after another program has used the SAAYM in between.
+ *
+ * @param[out] p_snapshot Snapshot receiving the playback state.
+ */
+void
+zsm_suspend(zsm_snapshot_t * const p_snapshot)
+{
+    p_snapshot->b_playing = g_play_stream;
+    g_play_stream         = false;
+
+    // Queued key events are already part of the shadows and are restored on resume.
+    g_key_event_count      = 0;
+    g_pending_fm_channels  = 0;
+    g_pending_psg_channels = 0;
+
+    memcpy(p_snapshot->ym2151_registers, g_ym2151_shadow, sizeof(p_snapshot->ym2151_registers));
+    memcpy(p_snapshot->ym2151_key_ons, g_ym2151_key_ons, sizeof(p_snapshot->ym2151_key_ons));
+    memcpy(p_snapshot->ym2151_lfo_depths, g_ym2151_lfo_depths, sizeof(p_snapshot->ym2151_lfo_depths));
+    memcpy(p_snapshot->vera_psg_registers, g_vera_psg_shadow, sizeof(p_snapshot->vera_psg_registers));
+
+    p_snapshot->position     = g_ram_bank;
+    p_snapshot->delay_ticks  = g_delay_ticks;
+    p_snapshot->repeat_count = g_repeat_count;
+
+    zsm_silence();
+} /* zsm_suspend() */
+
+/*!
+ * @brief Resumes playback from a snapshot taken by zsm_suspend(), restoring both chips in one burst.
+ *
+ * @note Call with the playback timer stopped; the snapshot must belong to the ZSM currently initialized.
+ *       The current master volume and channel mutes are applied to the restored state.
+ *
+ * @param[in] p_snapshot Snapshot holding the playback state.
+ */
+void
+zsm_resume(zsm_snapshot_t const * const p_snapshot)
+{
+    g_play_stream = false;
+
+    g_key_event_count      = 0;
+    g_pending_fm_channels  = 0;
+    g_pending_psg_channels = 0;
+
+    memcpy(g_ym2151_shadow, p_snapshot->ym2151_registers, sizeof(g_ym2151_shadow));
+    memcpy(g_ym2151_key_ons, p_snapshot->ym2151_key_ons, sizeof(g_ym2151_key_ons));
+    memcpy(g_ym2151_lfo_depths, p_snapshot->ym2151_lfo_depths, sizeof(g_ym2151_lfo_depths));
+    memcpy(g_vera_psg_shadow, p_snapshot->vera_psg_registers, sizeof(g_vera_psg_shadow));
+
+    g_ram_bank     = p_snapshot->position;
+    g_delay_ticks  = p_snapshot->delay_ticks;
+    g_repeat_count = p_snapshot->repeat_count;
+
+    zsm_restore();
+
+    g_play_stream = p_snapshot->b_playing;
+} /* zsm_resume() */
+
+/*!
+ * @brief Selects the order in which decoded register writes are issued.
+ *
+ * @note With ZSM_WRITE_ORDER_KEY_BURST, key on/off writes (YM2151 KON and VERA PSG volume) decoded during a
+ *       tick are held back and issued together at the start of the next tick, after all parameter writes.
+ *       This trades a constant one tick delay for key events that no longer wander around within the tick.
+ *
+ * @param[in] write_order The write order to use.
+ */
+void
+zsm_set_write_order(e_zsm_write_order_t const write_order)
+{
+    g_write_order = write_order;
+
+    zsm_refresh_write_filter();
+} /* zsm_set_write_order() */
+
+/*!
+ * @brief Sets the master volume.
+ *
+ * @note Takes effect at the next tick; cancels a fade in progress.
+ *
+ * @param[in] volume Master volume (0 to ZSM_VOLUME_MAX).
+ */
+void
+zsm_set_volume(uint8_t const volume)
+{
+    g_fade_ticks       = 0;
+    g_fade_ticks_left  = 0;
+    g_volume_requested = (volume > ZSM_VOLUME_MAX) ? ZSM_VOLUME_MAX : volume;
+} /* zsm_set_volume() */
+
+/*!
+ * @brief Gets the master volume.
+ *
+ * @return Master volume (0 to ZSM_VOLUME_MAX).
+ */
+uint8_t
+zsm_get_volume(void)
+{
+    return g_volume_requested;
+} /* zsm_get_volume() */
+
+/*!
+ * @brief Fades the master volume out and stops playback once silent.
+ *
+ * @param[in] ticks Fade length in ticks.
+ */
+void
+zsm_fade_out(uint16_t const ticks)
+{
+    if (ticks == 0)
+    {
+        zsm_stop();
+    }
+    else if (g_fade_ticks == 0)
+    {
+        g_fade_start_volume = g_volume_requested;
+        g_fade_ticks_left   = ticks;
+        g_fade_ticks        = ticks; // written last; zsm_update() starts fading once this is set
+    }
+} /* zsm_fade_out() */
+
+/*!
+ * @brief Checks whether a fade out is in progress.
+ *
+ * @return true if fading, otherwise false.
+ */
+bool
+zsm_is_fading(void)
+{
+    return g_fade_ticks != 0;
+} /* zsm_is_fading() */
+
+/*!
+ * @brief Mutes individual channels.
+ *
+ * @note Takes effect at the next tick. Muted YM2151 channels keep playing with their carriers at full attenuation
+ *       and muted VERA PSG channels at zero volume, so unmuting restores a held note from the register shadows.
+ *       While no channel is muted the decode path is unchanged.
+ *
+ * @param[in] fm_mutes  YM2151 channels to mute (bit per channel).
+ * @param[in] psg_mutes VERA PSG channels to mute (bit per channel).
+ */
+void
+zsm_set_channel_mutes(uint8_t const fm_mutes, uint16_t const psg_mutes)
+{
+    g_fm_mutes_requested  = fm_mutes;
+    g_psg_mutes_requested = psg_mutes;
+} /* zsm_set_channel_mutes() */
+
+/*!
+ * @brief Gets the muted channels.
+ *
+ * @param[out] p_fm_mutes  YM2151 channels muted (bit per channel).
+ * @param[out] p_psg_mutes VERA PSG channels muted (bit per channel).
+ */
+void
+zsm_get_channel_mutes(uint8_t * const p_fm_mutes, uint16_t * const p_psg_mutes)
+{
+    *p_fm_mutes  = g_fm_mutes_requested;
+    *p_psg_mutes = g_psg_mutes_requested;
+} /* zsm_get_channel_mutes() */
+
+/*!
+ * @brief Sets the per tick register write budget.
+ *
+ * @note Once a tick has issued this many writes, its remaining YM2151 pitch (KC, KF) and level (TL) writes and
+ *       VERA PSG frequency writes are deferred; key on/off, volume and patch writes always go out. A deferred
+ *       write is issued with the latest value before the channel's next key on/off, or once a later tick has
+ *       budget left, so writes superseded in the meantime are dropped. Call with the playback timer stopped.
+ *
+ * @note The 8088 decode kernel (PCZSM_ASM_KERNEL) issues a whole tick at once, so it is bypassed while a budget
+ *       is set.
+ *
+ * @param[in] writes_per_tick Register writes per tick, or 0 to issue every write.
+ */
+void
+zsm_set_write_budget(uint16_t const writes_per_tick)
+{
+    g_write_budget = writes_per_tick;
+
+    if (writes_per_tick == 0)
+    {
+        zsm_flush_deferred(UINT16_MAX);
+    }
+
+    g_tick_writes = 0;
+    g_b_shedding  = false;
+
+    zsm_refresh_write_filter();
+} /* zsm_set_write_budget() */
+
+/*!
+ * @brief Gets how many writes were deferred by the write budget.
+ *
+ * @param[out] p_deferred_writes   Writes deferred since playback was initialized.
+ * @param[out] p_superseded_writes Deferred writes dropped because a later write of the same register replaced them.
+ */
+void
+zsm_get_write_budget_stats(uint32_t * const p_deferred_writes, uint32_t * const p_superseded_writes)
+{
+    *p_deferred_writes   = g_deferred_writes;
+    *p_superseded_writes = g_superseded_writes;
+} /* zsm_get_write_budget_stats() */
+
+/*!
+ * @brief Sets the VERA PSG master volume function.
+ *
+ * @note The function rescales the driver's VERA PSG volume translation; zsm rewrites the affected volume registers afterwards.
+ *       Ignored in the SAAYM specialized build, which always uses saa1099_vera_psg_set_volume().
+ *
+ * @param[in] p_vera_psg_volume_func Pointer to the VERA PSG master volume function (NULL if unsupported).
+ */
+void
+zsm_set_vera_psg_volume_func(vera_psg_volume_func_t const p_vera_psg_volume_func)
+{
+#if defined(PCZSM_SAAYM_DIRECT)
+    (void)p_vera_psg_volume_func;
+#else
+    g_p_vera_psg_volume_func = p_vera_psg_volume_func;
+#endif
+} /* zsm_set_vera_psg_volume_func() */
+
+/*!
+ * @brief Sets the burst write functions used to hand a whole command's register pairs to a driver at once.
+ *
+ * @note Must be called after zsm_initialize(); a burst function is only used when its chip is being played.
+ *       Ignored in the SAAYM specialized build, which always uses ym2151_write_burst() and saa1099_vera_psg_write_burst().
+ *
+ * @param[in] p_ym2151_write_burst_func   Pointer to the YM2151 burst write function (NULL for single writes).
+ * @param[in] p_vera_psg_write_burst_func Pointer to the VERA PSG burst write function (NULL for single writes).
+ */
+void
+zsm_set_write_burst_funcs(ym2151_write_burst_func_t const p_ym2151_write_burst_func, vera_psg_write_burst_func_t const p_vera_psg_write_burst_func)
+{
+#if defined(PCZSM_SAAYM_DIRECT)
+    (void)p_ym2151_write_burst_func;
+    (void)p_vera_psg_write_burst_func;
+#else
+    g_p_ym2151_write_burst_func   = (g_p_ym2151_write_func != &zsm_ym2151_write_func_null) ? p_ym2151_write_burst_func : NULL;
+    g_p_vera_psg_write_burst_func = (g_p_vera_psg_write_func != &zsm_vera_psg_func_null) ? p_vera_psg_write_burst_func : NULL;
+#endif
+} /* zsm_set_write_burst_funcs() */
+
 /*!
  * @brief Checks whether ZSM playback is active.
  * 
@@ -254,4 +1793,165 @@ zsm_get_header(void)
     return g_p_zsm_ram_handle ? *(zsm_header_t const *)ram_get_address(g_p_zsm_ram_handle, 0) : g_empty_header;
 } /* zsm_get_header() */
 
+/*!
+ * @brief Gets the stream position of the next command.
+ *
+ * @return Offset from the start of the ZSM file (0 if nothing is loaded).
+ */
+uint32_t
+zsm_get_stream_offset(void)
+{
+    return g_p_zsm_ram_handle ? ram_get_offset(g_p_zsm_ram_handle, &g_ram_bank) : 0;
+} /* zsm_get_stream_offset() */
+
+/*!
+ * @brief Measures the length of the loaded song by walking its stream.
+ *
+ * @note Walks the whole stream once (without playing it), a bank at a time; call before the playback timer is
+ *       started, as a large song keeps an 8088 busy for a while.
+ *
+ * @param[out] p_loop_tick Tick the loop point is reached at, or the length if the song does not loop.
+ *
+ * @return Ticks from the start to the end of the stream (0 if nothing is loaded).
+ */
+uint32_t
+zsm_get_length_in_ticks(uint32_t * const p_loop_tick)
+{
+    uint32_t ticks = 0;
+
+    *p_loop_tick = 0;
+
+    if (g_p_zsm_ram_handle == NULL)
+    {
+        return 0;
+    }
+
+    zsm_header_t const * const p_header    = (zsm_header_t const * const)ram_get_address(g_p_zsm_ram_handle, 0);
+    uint32_t             const loop_offset = ((uint32_t)p_header->loop_point.bank << 16) | (p_header->loop_point.address);
+    uint32_t             const size        = ram_get_size(g_p_zsm_ram_handle);
+
+    ram_bank_t ram_bank;
+
+    uint32_t bank_offset   = 0;                    // stream offset of the bank's first byte
+    uint32_t skip          = sizeof(zsm_header_t); // bytes to pass over before the next command
+    bool     b_ext_length  = false;                // the next byte is an EXT command's length
+    bool     b_loop_passed = (loop_offset == 0);
+    bool     b_eof         = false;
+
+    ram_bank.bank = 0;
+
+    while ((b_eof == false) && (bank_offset < size))
+    {
+        ram_get_bank(g_p_zsm_ram_handle, &ram_bank);
+
+        uint8_t const *       p_current = ram_bank.p_start;
+        uint8_t const * const p_end     = ram_bank.p_end;
+
+        while (p_current < p_end)
+        {
+            if (skip)
+            {
+                uint32_t const left = (uint32_t)(p_end - p_current);
+                uint32_t const step = (skip < left) ? skip : left;
+
+                p_current += step;
+                skip      -= step;
+                continue;
+            }
+
+            if (b_ext_length)
+            {
+                skip         = *p_current++ & ZSM_MASK_CMD_DATA_EXT;
+                b_ext_length = false;
+                continue;
+            }
+
+            if ((b_loop_passed == false) && ((bank_offset + (uint32_t)(p_current - ram_bank.p_start)) >= loop_offset))
+            {
+                *p_loop_tick  = ticks;
+                b_loop_passed = true;
+            }
+
+            uint8_t const command = *p_current++;
+
+            if (command == ZSM_CMD_EOF)
+            {
+                b_eof = true;
+                break;
+            }
+            else if (command == ZSM_CMD_EXT)
+            {
+                b_ext_length = true;
+            }
+            else if (command < ZSM_CMD_EXT)
+            {
+                skip = 1U; // PSG write data
+            }
+            else if (command < ZSM_CMD_EOF)
+            {
+                skip = (uint32_t)(command & ZSM_MASK_CMD_DATA_FM_PAIRS) << 1; // FM register/value pairs
+            }
+            else
+            {
+                ticks += command & ZSM_MASK_CMD_DATA_DELAY;
+            }
+        }
+
+        bank_offset += (uint32_t)(p_end - ram_bank.p_start);
+        ++ram_bank.bank;
+    }
+
+    if (b_loop_passed == false)
+    {
+        *p_loop_tick = ticks;
+    }
+
+    return ticks;
+} /* zsm_get_length_in_ticks() */
+
+/*!
+ * @brief Gets how loud each channel currently plays, as the stream set it up (before volume and mutes).
+ *
+ * @note Derived from the register shadows, so it can be read from the main loop while the song plays: an FM
+ *       channel's level is its loudest carrier while keyed on, a PSG channel's level its volume while routed to
+ *       either side.
+ *
+ * @param[out] p_fm_levels  ZSM_YM2151_CHANNEL_COUNT levels (0 to ZSM_CHANNEL_LEVEL_MAX).
+ * @param[out] p_psg_levels ZSM_VERA_PSG_CHANNEL_COUNT levels (0 to ZSM_CHANNEL_LEVEL_MAX).
+ */
+void
+zsm_get_channel_levels(uint8_t * const p_fm_levels, uint8_t * const p_psg_levels)
+{
+    for (uint8_t channel = 0; channel < ZSM_YM2151_CHANNEL_COUNT; ++channel)
+    {
+        uint8_t const carriers    = g_ym2151_con_to_carriers[g_ym2151_shadow[ZSM_YM2151_ADDRESS_CON + channel] & ZSM_YM2151_MASK_CON];
+        uint8_t       total_level = ZSM_YM2151_TL_MAX;
+
+        if (g_ym2151_key_ons[channel] & ZSM_YM2151_MASK_KEY_SLOTS)
+        {
+            for (uint8_t operator_index = 0; operator_index < ZSM_YM2151_OPERATOR_COUNT; ++operator_index)
+            {
+                if (carriers & (1U << operator_index))
+                {
+                    uint8_t const level = g_ym2151_shadow[ZSM_YM2151_ADDRESS_TL | (operator_index << ZSM_YM2151_SHIFT_OPERATOR) | channel] & ZSM_YM2151_MASK_TL;
+
+                    if (level < total_level)
+                    {
+                        total_level = level;
+                    }
+                }
+            }
+        }
+
+        p_fm_levels[channel] = (ZSM_YM2151_TL_MAX - total_level) >> 1; // 0.75 dB steps to 1.5 dB steps
+    }
+
+    for (uint8_t channel = 0; channel < ZSM_VERA_PSG_CHANNEL_COUNT; ++channel)
+    {
+        uint8_t const rl_volume = g_vera_psg_shadow[(channel << 2) | VERA_PSG_OFFSET_RL_VOLUME];
+
+        p_psg_levels[channel] = (rl_volume & VERA_PSG_MASK_RIGHT_LEFT) ? (rl_volume & VERA_PSG_MASK_VOLUME) : 0;
+    }
+} /* zsm_get_channel_levels() */
+
 /*** end of file ***/
@@ -11,10 +11,25 @@ typedef enum
     ZSM_SUCCESS,
     ZSM_BAD_DATA_POINTER,
     ZSM_UNSUPPORTED_VERSION,
-    ZSM_NOTHING_TO_PLAY
+    ZSM_NOTHING_TO_PLAY,
+    ZSM_MISSING_CHIP
 } e_zsm_result_t;
 
+typedef enum
+{
+    ZSM_WRITE_ORDER_STREAM,    // issue writes in stream order
+    ZSM_WRITE_ORDER_KEY_BURST  // issue key on/off writes together at the start of each tick
+} e_zsm_write_order_t;
+
 #define ZSM_REPEAT_FOREVER (0x8000U)
+#define ZSM_VOLUME_MAX     (64U)
+
+#define ZSM_YM2151_REGISTER_COUNT   (256U)
+#define ZSM_YM2151_CHANNEL_COUNT    (8U)
+#define ZSM_YM2151_LFO_DEPTH_COUNT  (2U)
+#define ZSM_VERA_PSG_REGISTER_COUNT (64U)
+#define ZSM_VERA_PSG_CHANNEL_COUNT  (16U)
+#define ZSM_CHANNEL_LEVEL_MAX       (63U)
 
 #pragma pack(push, 1)
 typedef struct zsm_offset
@@ -42,6 +57,18 @@ typedef struct
     uint8_t      * p_data_stream;
 } zsm_data_t;
 
+typedef struct zsm_snapshot
+{
+    uint8_t    ym2151_registers[ZSM_YM2151_REGISTER_COUNT];
+    uint8_t    ym2151_key_ons[ZSM_YM2151_CHANNEL_COUNT];
+    uint8_t    ym2151_lfo_depths[ZSM_YM2151_LFO_DEPTH_COUNT];
+    uint8_t    vera_psg_registers[ZSM_VERA_PSG_REGISTER_COUNT];
+    ram_bank_t position;
+    uint8_t    delay_ticks;
+    uint8_t    repeat_count;
+    bool       b_playing;
+} zsm_snapshot_t;
+
 //--------------------------------------------------------------------
 #ifdef __cplusplus
 extern "C" {
@@ -50,13 +77,32 @@ extern "C" {
 
 typedef void(*ym2151_write_func_t)(uint8_t const address, uint8_t const data);
 typedef void(*vera_psg_write_func_t)(uint8_t const address, uint8_t const data);
+typedef void(*ym2151_write_burst_func_t)(uint8_t const * const p_pairs, uint8_t const count);
+typedef void(*vera_psg_write_burst_func_t)(uint8_t const * const p_pairs, uint8_t const count);
+typedef void(*vera_psg_volume_func_t)(uint8_t const volume);
 
 e_zsm_result_t     zsm_initialize(ram_handle_t p_zsm_ram_handle, ym2151_write_func_t const p_ym2151_func, vera_psg_write_func_t const p_vera_psg_write_func);
 void               zsm_update(void);
 void               zsm_start(uint16_t const zsm_repeat);
 void               zsm_stop(void);
+void               zsm_suspend(zsm_snapshot_t * const p_snapshot);
+void               zsm_resume(zsm_snapshot_t const * const p_snapshot);
+void               zsm_set_write_order(e_zsm_write_order_t const write_order);
+void               zsm_set_volume(uint8_t const volume);
+uint8_t            zsm_get_volume(void);
+void               zsm_fade_out(uint16_t const ticks);
+bool               zsm_is_fading(void);
+void               zsm_set_channel_mutes(uint8_t const fm_mutes, uint16_t const psg_mutes);
+void               zsm_get_channel_mutes(uint8_t * const p_fm_mutes, uint16_t * const p_psg_mutes);
+void               zsm_set_write_budget(uint16_t const writes_per_tick);
+void               zsm_get_write_budget_stats(uint32_t * const p_deferred_writes, uint32_t * const p_superseded_writes);
+void               zsm_set_vera_psg_volume_func(vera_psg_volume_func_t const p_vera_psg_volume_func);
+void               zsm_set_write_burst_funcs(ym2151_write_burst_func_t const p_ym2151_write_burst_func, vera_psg_write_burst_func_t const p_vera_psg_write_burst_func);
 bool               zsm_is_playing(void);
 zsm_header_t const zsm_get_header(void);
+uint32_t           zsm_get_stream_offset(void);
+uint32_t           zsm_get_length_in_ticks(uint32_t * const p_loop_tick);
+void               zsm_get_channel_levels(uint8_t * const p_fm_levels, uint8_t * const p_psg_levels);
 
 //--------------------------------------------------------------------
 #ifdef __cplusplus
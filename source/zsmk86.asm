@@ -0,0 +1,232 @@
+;** @file zsmk86.asm
+;*
+;* @brief 8088 ZSM decode kernel.
+;*
+;* @par
+;* Hand tuned replacement for the zsm_update() decode loop on the 16-bit
+;* (large model) build.  The stream pointer lives in DS:SI and is read with
+;* LODSB/LODSW, the YM2151 status/data port lives in DI, and commands are
+;* dispatched through a four entry jump table indexed by the top two bits of
+;* the command byte.  Register shadows (including the per channel key on and
+;* the AMD/PMD depths sharing register 19h) are updated as writes are issued.
+;* PSG writes are masked with g_vera_psg_write_mask so muted channels keep a
+;* zero volume; while any FM channel is muted FM commands are left to C,
+;* which diverts only the writes of the muted channels.
+;*
+;* The kernel only decodes PSG writes, FM writes and delays.  It hands control
+;* back to zsm_update() (without consuming the command) for EXT and EOF
+;* commands and whenever fewer than ZSM_KERNEL_TAIL_BYTES remain in the
+;* current RAM bank, so bank switching and looping stay in C.
+;*
+;* Build with asm=1 (16-bit only); see MAKEFILE.  Compare the cost per tick
+;* against the C decoder with -bP (or a profile=1 build) of each build.
+;*
+;* uint8_t zsm_kernel_run(ram_bank_t * const p_ram_bank, uint16_t * const p_writes);
+;*
+;*   In : DX:AX far pointer to the current ram_bank_t.
+;*        CX:BX far pointer to the count of register writes issued.
+;*   Out: AL delay ticks (1..127) if a delay command ended the tick, otherwise
+;*        0 and p_current points at the command zsm_update() must decode.
+;*
+
+.8086
+
+                name    zsmk86
+
+ZSM_CMD_MASK_DATA              equ 3Fh
+ZSM_CMD_MASK_DELAY             equ 7Fh
+ZSM_KERNEL_TAIL_BYTES          equ 128     ; longest command (FM, 63 pairs) plus one byte
+YM2151_STATUS_WRITE_BUSY_FLAG  equ 80h
+YM2151_ADDRESS_KON             equ 08h
+YM2151_ADDRESS_PMD_AMD         equ 19h
+YM2151_ADDRESS_CHANNELS        equ 20h
+YM2151_MASK_CHANNEL            equ 07h
+YM2151_MASK_KEY_SLOTS          equ 78h
+
+RAM_BANK_P_END                 equ 4       ; offset of ram_bank_t.p_end
+RAM_BANK_P_CURRENT             equ 8       ; offset of ram_bank_t.p_current
+
+DGROUP          group   _DATA
+
+_DATA           segment word public 'DATA'
+                extrn   _g_ym2151_port_data:word
+                extrn   _g_ym2151_shadow:byte
+                extrn   _g_vera_psg_shadow:byte
+                extrn   _g_ym2151_key_ons:byte
+                extrn   _g_ym2151_lfo_depths:byte
+                extrn   _g_tick_key_ons:byte
+                extrn   _g_fm_mutes:byte
+                extrn   _g_vera_psg_write_mask:byte
+
+kernel_writes   dw      0                   ; register writes issued by this call
+_DATA           ends
+
+ZSMK86_TEXT     segment byte public 'CODE'
+                assume  cs:ZSMK86_TEXT, ds:DGROUP
+
+                extrn   saa1099_vera_psg_write_:far
+
+                public  zsm_kernel_run_
+
+dispatch_table  dw      psg_command         ; 00h-3Fh
+                dw      fm_command          ; 40h-7Fh
+                dw      delay_command       ; 80h-BFh
+                dw      delay_command       ; C0h-FFh
+
+zsm_kernel_run_ proc    far
+                push    bx
+                push    cx
+                push    dx
+                push    si
+                push    di
+                push    bp
+                push    ds
+                push    es
+                push    cx                  ; write count segment
+                push    bx                  ; write count offset
+                push    dx                  ; ram_bank_t segment
+                push    ax                  ; ram_bank_t offset
+
+                mov     di, _g_ym2151_port_data
+                push    ds
+                pop     es                  ; ES = DGROUP for the rest of the kernel
+                mov     es:kernel_writes, 0
+
+                mov     bx, ax
+                mov     ds, dx
+                mov     bp, [bx + RAM_BANK_P_END]
+                sub     bp, ZSM_KERNEL_TAIL_BYTES
+                jnc     limit_ok
+                xor     bp, bp              ; bank shorter than the tail; everything goes to C
+limit_ok:
+                lds     si, [bx + RAM_BANK_P_CURRENT]
+
+next_command:
+                cmp     si, bp
+                jae     return_to_c
+                lodsb
+                mov     bl, al
+                xor     bh, bh
+                rol     bl, 1               ; bits 7..6 of the command
+                rol     bl, 1               ;   become a word index
+                rol     bl, 1               ;   in bits 2..1
+                and     bl, 6
+                jmp     word ptr cs:dispatch_table[bx]
+
+psg_command:
+                mov     cl, al              ; VERA PSG address
+                lodsb                       ; VERA PSG data
+                mov     bl, cl
+                mov     es:_g_vera_psg_shadow[bx], al
+                and     al, es:_g_vera_psg_write_mask[bx] ; muted channels keep a zero volume
+                inc     es:kernel_writes
+                xor     ah, ah
+                mov     dx, ax
+                mov     al, cl
+                push    cx
+                push    si
+                push    di
+                push    bp
+                push    ds
+                push    es
+                push    es
+                pop     ds                  ; C expects DS = DGROUP
+                call    saa1099_vera_psg_write_
+                pop     es
+                pop     ds
+                pop     bp
+                pop     di
+                pop     si
+                pop     cx
+                jmp     next_command
+
+fm_command:
+                and     al, ZSM_CMD_MASK_DATA
+                jz      return_to_c_unread  ; EXT
+                cmp     es:_g_fm_mutes, 0
+                jne     return_to_c_unread  ; muted FM channels are filtered in C
+                mov     cl, al
+                xor     ch, ch
+                add     es:kernel_writes, cx
+                mov     dx, di              ; DX = YM2151 status/data port
+fm_pair:
+                lodsw                       ; AL = register, AH = value
+                mov     bl, al
+                xor     bh, bh
+                mov     es:_g_ym2151_shadow[bx], ah
+                cmp     bl, YM2151_ADDRESS_CHANNELS
+                jb      fm_global
+fm_shadowed:
+                mov     bh, ah              ; BL = register, BH = value
+fm_wait_address:
+                in      al, dx
+                test    al, YM2151_STATUS_WRITE_BUSY_FLAG
+                jnz     fm_wait_address
+                dec     dx                  ; address port
+                mov     al, bl
+                out     dx, al
+                inc     dx                  ; data port
+fm_wait_data:
+                in      al, dx
+                test    al, YM2151_STATUS_WRITE_BUSY_FLAG
+                jnz     fm_wait_data
+                mov     al, bh
+                out     dx, al
+                loop    fm_pair
+                jmp     next_command
+
+fm_global:
+                cmp     bl, YM2151_ADDRESS_KON
+                jne     fm_not_key_on
+                mov     bl, ah
+                and     bl, YM2151_MASK_CHANNEL
+                mov     es:_g_ym2151_key_ons[bx], ah
+                test    ah, YM2151_MASK_KEY_SLOTS
+                jz      fm_global_done
+                inc     es:_g_tick_key_ons  ; key on (any slot set)
+                jmp     short fm_global_done
+fm_not_key_on:
+                cmp     bl, YM2151_ADDRESS_PMD_AMD
+                jne     fm_global_done
+                mov     bl, ah
+                rol     bl, 1               ; PMD select bit
+                and     bl, 1               ;   becomes the depth index
+                mov     es:_g_ym2151_lfo_depths[bx], ah
+fm_global_done:
+                mov     bl, al              ; BL = register again (BH is still zero)
+                jmp     short fm_shadowed
+
+delay_command:
+                and     al, ZSM_CMD_MASK_DELAY
+                jz      return_to_c_unread  ; EOF
+                xor     ah, ah
+                jmp     short kernel_exit
+
+return_to_c_unread:
+                dec     si
+return_to_c:
+                xor     ax, ax
+
+kernel_exit:
+                pop     bx                  ; ram_bank_t offset
+                pop     ds                  ; ram_bank_t segment
+                mov     [bx + RAM_BANK_P_CURRENT], si
+                mov     cx, es:kernel_writes
+                pop     bx                  ; write count offset
+                pop     ds                  ; write count segment
+                mov     [bx], cx
+
+                pop     es
+                pop     ds
+                pop     bp
+                pop     di
+                pop     si
+                pop     dx
+                pop     cx
+                pop     bx
+                ret
+zsm_kernel_run_ endp
+
+ZSMK86_TEXT     ends
+
+                end